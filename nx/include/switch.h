@@ -21,6 +21,7 @@ extern "C" {
 
 #include "switch/kernel/svc.h"
 #include "switch/kernel/wait.h"
+#include "switch/kernel/waitset.h"
 #include "switch/kernel/tmem.h"
 #include "switch/kernel/shmem.h"
 #include "switch/kernel/mutex.h"
@@ -28,6 +29,7 @@ extern "C" {
 #include "switch/kernel/levent.h"
 #include "switch/kernel/uevent.h"
 #include "switch/kernel/utimer.h"
+#include "switch/kernel/timerwheel.h"
 #include "switch/kernel/rwlock.h"
 #include "switch/kernel/condvar.h"
 #include "switch/kernel/thread.h"
@@ -165,10 +167,14 @@ extern "C" {
 #include "switch/runtime/env.h"
 #include "switch/runtime/hosversion.h"
 #include "switch/runtime/diag.h"
+#include "switch/runtime/init.h"
+#include "switch/runtime/arena.h"
 #include "switch/runtime/nxlink.h"
 #include "switch/runtime/resolver.h"
 #include "switch/runtime/pad.h"
 #include "switch/runtime/ringcon.h"
+#include "switch/runtime/motion.h"
+#include "switch/runtime/irimage.h"
 #include "switch/runtime/btdev.h"
 
 #include "switch/runtime/util/utf.h"
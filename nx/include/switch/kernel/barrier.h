@@ -5,15 +5,15 @@
  * @copyright libnx Authors
  */
 #pragma once
-#include "mutex.h"
-#include "condvar.h"
+#include "../types.h"
 
 /// Barrier structure.
 typedef struct Barrier {
-    u64 count;  ///< Number of threads to reach the barrier.
-    u64 total;  ///< Number of threads to wait on.
-    Mutex mutex;
-    CondVar condvar;
+    u32 count;       ///< Number of threads yet to reach the barrier in the current phase.
+    u32 total;       ///< Number of threads to wait on.
+    u32 phase;       ///< Incremented each time the barrier opens.
+    u32 num_waiters; ///< Number of threads blocked (or about to block) on the phase.
+    u32 spin_count;  ///< Number of polls of the phase before blocking.
 } Barrier;
 
 /**
@@ -23,8 +23,18 @@ typedef struct Barrier {
  */
 void barrierInit(Barrier *b, u64 thread_count);
 
+/**
+ * @brief Initializes a barrier whose waiters poll it for a while before blocking.
+ * @param b Barrier object.
+ * @param thread_count Number of threads the barrier must wait for.
+ * @param spin_count Number of polls before blocking in the kernel.
+ * @note Spinning suits fork-join workloads where the threads run on different cores and reach the barrier at nearly the same time.
+ */
+void barrierInitWithSpin(Barrier *b, u64 thread_count, u32 spin_count);
+
 /**
  * @brief Forces threads to wait until all threads have called barrierWait.
  * @param b Barrier object.
+ * @note The last thread to arrive only enters the kernel if other threads are blocked.
  */
 void barrierWait(Barrier *b);
@@ -11,6 +11,7 @@
  * @brief Fills a buffer with random data.
  * @param buf Pointer to the buffer.
  * @param len Size of the buffer in bytes.
+ * @note Each thread draws from its own generator, which is keyed from the process-wide one on first use.
  */
 void randomGet(void* buf, size_t len);
 
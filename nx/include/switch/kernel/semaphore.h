@@ -1,20 +1,18 @@
 /**
  * @file semaphore.h
- * @brief Thread synchronization based on Mutex.
+ * @brief Thread synchronization based on an atomic counter and kernel address arbitration.
  * @author SciresM & Kevoot
  * @copyright libnx Authors
  */
 #pragma once
 
-#include "mutex.h"
-#include "condvar.h"
+#include "../types.h"
 
 /// Semaphore structure.
 typedef struct Semaphore
 {
-    CondVar condvar; ///< Condition variable object.
-    Mutex   mutex;   ///< Mutex object.
-    u64     count;   ///< Internal counter.
+    u32 count;       ///< Internal counter.
+    u32 num_waiters; ///< Number of threads blocked (or about to block) on the counter.
 } Semaphore;
 
 /**
@@ -27,12 +25,14 @@ void semaphoreInit(Semaphore *s, u64 initial_count);
 /**
  * @brief Increments the Semaphore to allow other threads to continue.
  * @param s Semaphore object.
+ * @note This only enters the kernel when a thread is blocked on the semaphore.
  */
 void semaphoreSignal(Semaphore *s);
 
 /**
  * @brief Decrements Semaphore and waits if 0.
  * @param s Semaphore object.
+ * @note This only enters the kernel when the counter is 0.
  */
 void semaphoreWait(Semaphore *s);
 
@@ -21,6 +21,14 @@ typedef struct Thread {
     struct Thread** prev_next;
 } Thread;
 
+/// Statistics of the pool of stacks recycled by \ref threadClose.
+typedef struct {
+    u64    hits;        ///< Number of \ref threadCreate calls that reused a pooled stack.
+    u64    misses;      ///< Number of \ref threadCreate calls that had to allocate and map a new stack.
+    u32    num_cached;  ///< Number of stacks currently held by the pool.
+    size_t cached_size; ///< Total size of the stacks currently held by the pool.
+} ThreadStackPoolStats;
+
 /// Creates a \ref Waiter for a \ref Thread.
 static inline Waiter waiterForThread(Thread* t)
 {
@@ -37,6 +45,7 @@ static inline Waiter waiterForThread(Thread* t)
  * @param prio Thread priority (0x00~0x3F); 0x2C is the usual priority of the main thread, 0x3B is a special priority on cores 0..2 that enables preemptive multithreading (0x3F on core 3).
  * @param cpuid ID of the core on which to create the thread (0~3); or -2 to use the default core for the current process.
  * @return Result code.
+ * @note When stack_mem is NULL, the stack may be taken from a pool of already mapped stacks of the same size (see \ref threadClose).
  */
 Result threadCreate(
     Thread* t, ThreadFunc entry, void* arg, void *stack_mem, size_t stack_sz,
@@ -65,9 +74,23 @@ Result threadWaitForExit(Thread* t);
  * @brief Frees up resources associated with a thread.
  * @param t Thread information structure.
  * @return Result code.
+ * @note Automatically allocated stacks are kept mapped in a pool for reuse by later threads, within the limits set by
+ *       the weak symbols __nx_thread_stack_pool_max_entries and __nx_thread_stack_pool_max_size.
+ *       The pool is flushed by \ref __libnx_exit; custom exit paths should call \ref threadStackPoolFlush themselves.
  */
 Result threadClose(Thread* t);
 
+/**
+ * @brief Releases all stacks held by the thread stack pool.
+ */
+void threadStackPoolFlush(void);
+
+/**
+ * @brief Retrieves statistics about the thread stack pool.
+ * @param[out] out Output statistics.
+ */
+void threadGetStackPoolStats(ThreadStackPoolStats* out);
+
 /**
  * @brief Pauses the execution of a thread.
  * @param t Thread information structure.
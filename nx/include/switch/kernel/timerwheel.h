@@ -0,0 +1,89 @@
+/**
+ * @file timerwheel.h
+ * @brief Hierarchical timer wheel servicing many user-mode timers through a single waitable object.
+ * @copyright libnx Authors
+ */
+#pragma once
+#include "wait.h"
+#include "utimer.h"
+
+#define TIMERWHEEL_LEVEL_BITS 6                         ///< Number of bits of expiration time covered by each wheel level.
+#define TIMERWHEEL_SLOTS      (1U<<TIMERWHEEL_LEVEL_BITS) ///< Number of slots in each wheel level.
+#define TIMERWHEEL_LEVELS     4                         ///< Number of wheel levels.
+
+typedef struct TimerWheel TimerWheel;
+typedef struct TimerWheelEntry TimerWheelEntry;
+
+/// Timer callback, invoked from \ref timerWheelDispatch.
+typedef void (*TimerWheelFunc)(TimerWheelEntry* e, void* userdata);
+
+/// Timer registered in a \ref TimerWheel. Must be zero-initialized before first use.
+struct TimerWheelEntry {
+    TimerWheelEntry* next;
+    TimerWheelEntry** pprev;
+    TimerWheelFunc func;   ///< Callback.
+    void* userdata;        ///< Callback argument.
+    u64 expires;           ///< Expiration time (in wheel units).
+    u64 interval;          ///< Interval (in wheel units).
+    TimerType type : 8;    ///< Timer type (see \ref TimerType).
+    u8 level;
+    u8 slot;
+    bool active : 1;       ///< Whether the timer is currently scheduled.
+};
+
+/// Hierarchical timer wheel object.
+struct TimerWheel {
+    Waitable waitable;
+    u64 resolution;        ///< Length of a wheel unit (in ticks).
+    u64 base_tick;         ///< System tick corresponding to unit 0.
+    u64 cur;               ///< Next unit to be processed.
+    u64 wake_unit;         ///< Unit at which the current listeners will wake up.
+    u64 occupied[TIMERWHEEL_LEVELS];
+    TimerWheelEntry* slots[TIMERWHEEL_LEVELS][TIMERWHEEL_SLOTS];
+    TimerWheelEntry* overflow;
+    TimerWheelEntry* expired;
+};
+
+/// Creates a waiter for a timer wheel. The waiter is signalled whenever at least one timer has expired.
+static inline Waiter waiterForTimerWheel(TimerWheel* w)
+{
+    Waiter wait_obj;
+    wait_obj.type = WaiterType_Waitable;
+    wait_obj.waitable = &w->waitable;
+    return wait_obj;
+}
+
+/**
+ * @brief Creates a timer wheel.
+ * @param[out] w TimerWheel object.
+ * @param[in] resolution Granularity of the wheel (in nanoseconds). Timers never fire early, but may fire up to this long late.
+ * @note It is safe to wait on the wheel with several threads simultaneously.
+ */
+void timerWheelCreate(TimerWheel* w, u64 resolution);
+
+/**
+ * @brief Schedules a timer in the wheel. This is O(1).
+ * @param[in] w TimerWheel object.
+ * @param[in] e TimerWheelEntry object. If the timer is already scheduled, it is rescheduled.
+ * @param[in] interval Interval (in nanoseconds).
+ * @param[in] type Type of timer (see \ref TimerType).
+ * @param[in] func Callback invoked when the timer fires.
+ * @param[in] userdata Argument passed to the callback.
+ */
+void timerWheelAdd(TimerWheel* w, TimerWheelEntry* e, u64 interval, TimerType type, TimerWheelFunc func, void* userdata);
+
+/**
+ * @brief Cancels a scheduled timer. This is O(1).
+ * @param[in] w TimerWheel object.
+ * @param[in] e TimerWheelEntry object.
+ */
+void timerWheelCancel(TimerWheel* w, TimerWheelEntry* e);
+
+/**
+ * @brief Invokes the callbacks of all expired timers, and reschedules repeating timers.
+ * @param[in] w TimerWheel object.
+ * @return Number of callbacks invoked.
+ * @note Callbacks are invoked without any lock held, and may add or cancel timers in the same wheel.
+ * @note For a repeating timer: if the timer expires several times before being dispatched, the callback is only invoked once.
+ */
+u32 timerWheelDispatch(TimerWheel* w);
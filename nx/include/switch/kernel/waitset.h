@@ -0,0 +1,79 @@
+/**
+ * @file waitset.h
+ * @brief Persistent sets of generic waitable synchronization objects.
+ * @copyright libnx Authors
+ */
+#pragma once
+#include "wait.h"
+
+typedef struct WaitSet WaitSet;
+typedef struct WaitSetEntry WaitSetEntry;
+typedef struct WaitSetHelper WaitSetHelper;
+
+/// Persistent wait set object.
+struct WaitSet {
+    Mutex mutex;
+    WaitSetEntry* entries;     ///< Entry slots (capacity elements).
+    u64* ready;                ///< Bitmap of entries that have been signalled.
+    s32* rearm;                ///< Stack of entries that need to be re-armed before the next wait.
+    s32 num_rearm;
+    s32 capacity;
+
+    Handle direct_handles[MAX_WAIT_OBJECTS]; ///< Handles waited on directly by the waiting thread.
+    s32 direct_ids[MAX_WAIT_OBJECTS];
+    s32 num_direct;
+    u32 direct_gen;
+
+    WaitSetHelper* helpers;    ///< Helper threads waiting on handles that do not fit in the direct array.
+    s32 num_helpers;
+
+    Handle waiting_thread;
+};
+
+/**
+ * @brief Creates a wait set.
+ * @param[out] s WaitSet object.
+ * @param[in] capacity Maximum number of objects that can be registered in the set.
+ * @return Result code.
+ * @note Unlike \ref waitObjects, the capacity is not limited by \ref MAX_WAIT_OBJECTS. Kernel handles past the
+ *       limit are waited on by helper threads which forward their signals to the set.
+ */
+Result waitSetCreate(WaitSet* s, s32 capacity);
+
+/**
+ * @brief Closes a wait set.
+ * @param[in] s WaitSet object.
+ * @note Registered objects are not closed; they are only unregistered from the set.
+ */
+void waitSetClose(WaitSet* s);
+
+/**
+ * @brief Registers a generic waitable synchronization object in the set.
+ * @param[in] s WaitSet object.
+ * @param[in] w \ref Waiter structure.
+ * @param[out] id_out Variable that will receive the identifier of the registered object.
+ * @return Result code.
+ * @note The object remains registered across waits until \ref waitSetRemove is called.
+ */
+Result waitSetAdd(WaitSet* s, Waiter w, s32* id_out);
+
+/**
+ * @brief Unregisters an object from the set.
+ * @param[in] s WaitSet object.
+ * @param[in] id Identifier returned by \ref waitSetAdd.
+ */
+void waitSetRemove(WaitSet* s, s32 id);
+
+/**
+ * @brief Waits for any object registered in the set to be signalled, optionally with a timeout.
+ * @param[in] s WaitSet object.
+ * @param[out] id_out Variable that will receive the identifier of the signalled object.
+ * @param[in] timeout Timeout (in nanoseconds).
+ * @return Result code.
+ * @note Only objects that were returned by a previous wait (or newly added) are re-armed; objects that did not
+ *       fire stay registered and are not re-registered on every wait.
+ * @note Only one thread may wait on a given set at a time.
+ * @note If a registered handle becomes invalid (e.g. it was closed), the error is returned and id_out receives the
+ *       identifier of the offending object, which is not waited on again; it should then be removed with \ref waitSetRemove.
+ */
+Result waitSetWait(WaitSet* s, s32* id_out, u64 timeout);
@@ -7,6 +7,18 @@
 #define GPFIFO_ENTRY_NOT_MAIN    BIT(9)
 #define GPFIFO_ENTRY_NO_PREFETCH BIT(31)
 
+#define GPFIFO_BUSY_BACKOFF_MIN_US 500
+#define GPFIFO_BUSY_BACKOFF_MAX_US 100000
+
+typedef struct NvGpuChannelStats
+{
+    u64 num_kickoffs;    // Successful submissions.
+    u64 num_busy;        // Submission attempts rejected with LibnxNvidiaError_Busy.
+    u64 num_stalls;      // Blocking kickoffs that had to wait for the channel to drain.
+    u64 stall_ticks;     // Total time spent waiting in blocking kickoffs.
+    u64 max_stall_ticks; // Longest single wait in a blocking kickoff.
+} NvGpuChannelStats;
+
 typedef struct NvGpuChannel
 {
     NvChannel base;
@@ -16,6 +28,7 @@ typedef struct NvGpuChannel
     u32 fence_incr;
     nvioctl_gpfifo_entry entries[GPFIFO_QUEUE_SIZE];
     u32 num_entries;
+    NvGpuChannelStats stats;
 } NvGpuChannel;
 
 Result nvGpuChannelCreate(NvGpuChannel* c, struct NvAddressSpace* as, NvChannelPriority prio);
@@ -24,6 +37,7 @@ void   nvGpuChannelClose(NvGpuChannel* c);
 Result nvGpuChannelZcullBind(NvGpuChannel* c, iova_t iova);
 Result nvGpuChannelAppendEntry(NvGpuChannel* c, iova_t start, size_t num_cmds, u32 flags, u32 flush_threshold);
 Result nvGpuChannelKickoff(NvGpuChannel* c);
+Result nvGpuChannelTryKickoff(NvGpuChannel* c);
 Result nvGpuChannelGetErrorNotification(NvGpuChannel* c, NvNotification* notif);
 Result nvGpuChannelGetErrorInfo(NvGpuChannel* c, NvError* error);
 
@@ -42,3 +56,8 @@ static inline void nvGpuChannelIncrFence(NvGpuChannel* c)
 {
     ++c->fence_incr;
 }
+
+static inline void nvGpuChannelGetStats(NvGpuChannel* c, NvGpuChannelStats* stats_out)
+{
+    *stats_out = c->stats;
+}
@@ -126,6 +126,7 @@ enum {
     LibnxError_InvalidCmifOutHeader,
     LibnxError_ShouldNotHappen,
     LibnxError_Timeout,
+    LibnxError_HashMismatch,
 };
 
 /// libnx binder error codes
@@ -0,0 +1,59 @@
+/**
+ * @file arena.h
+ * @brief Arena (bump pointer) allocator for batches of short-lived allocations.
+ * @copyright libnx Authors
+ */
+#pragma once
+#include "../types.h"
+
+typedef struct ArenaBlock ArenaBlock;
+
+/// Arena object.
+typedef struct {
+    ArenaBlock* head;      ///< Most recently allocated block.
+    size_t block_size;     ///< Default size of each block.
+} Arena;
+
+/// Position in an arena, used to release everything allocated after it (see \ref arenaRewind).
+typedef struct {
+    ArenaBlock* block;
+    size_t used;
+} ArenaMark;
+
+/**
+ * @brief Creates an arena.
+ * @param[out] a Arena object.
+ * @param[in] block_size Size of the blocks requested from the heap. Larger allocations get a block of their own.
+ * @note No memory is allocated until the first call to \ref arenaAlloc.
+ */
+void arenaCreate(Arena* a, size_t block_size);
+
+/**
+ * @brief Allocates memory from an arena.
+ * @param[in] a Arena object.
+ * @param[in] size Size of the allocation.
+ * @param[in] alignment Alignment of the allocation (must be a power of two, at most 0x10).
+ * @return Pointer to the allocated memory, or NULL on failure.
+ * @note Memory allocated from an arena cannot be freed individually; see \ref arenaRewind and \ref arenaClose.
+ */
+void* arenaAlloc(Arena* a, size_t size, size_t alignment);
+
+/**
+ * @brief Retrieves the current position of an arena.
+ * @param[in] a Arena object.
+ * @return Arena position.
+ */
+ArenaMark arenaGetMark(Arena* a);
+
+/**
+ * @brief Releases everything allocated from an arena after the specified position.
+ * @param[in] a Arena object.
+ * @param[in] m Position previously obtained with \ref arenaGetMark.
+ */
+void arenaRewind(Arena* a, ArenaMark m);
+
+/**
+ * @brief Releases all memory owned by an arena.
+ * @param[in] a Arena object.
+ */
+void arenaClose(Arena* a);
@@ -127,8 +127,18 @@ typedef enum {
 	debugDevice_NULL,    ///< Swallows prints to stderr
 	debugDevice_SVC,     ///< Outputs stderr debug statements using svcOutputDebugString, which can then be captured by interactive debuggers
 	debugDevice_CONSOLE, ///< Directs stderr debug statements to Switch console window
+	debugDevice_SVCBuffered, ///< Same as debugDevice_SVC, but writes are queued in a ring buffer and output in batches by a background thread [4.0.0+]
 } debugDevice;
 
+/// Statistics of the debugDevice_SVCBuffered log sink.
+typedef struct {
+	u64 bytes_written;  ///< Bytes queued in the ring buffer.
+	u64 bytes_dropped;  ///< Bytes dropped, either because the ring buffer was full or because the output failed.
+	u32 writes_dropped; ///< Writes dropped as a whole, because the ring buffer was full or smaller than the write.
+	u32 overflows;      ///< Number of times a write found the ring buffer full.
+	u32 flushes;        ///< Number of batched outputs issued by the background thread.
+} DebugLogStats;
+
 /**
  * @brief Loads the font into the console.
  * @param console Pointer to the console to update, if NULL it will update the current console.
@@ -186,5 +196,26 @@ void consoleUpdate(PrintConsole* console);
  */
 void consoleDebugInit(debugDevice device);
 
+/**
+ * @brief Blocks until everything written so far to the debugDevice_SVCBuffered sink has been output.
+ * @note Call this before exiting, as queued output is otherwise lost.
+ */
+void consoleDebugFlush(void);
+
+/**
+ * @brief Redirects the output of the debugDevice_SVCBuffered sink to a file descriptor, such as the socket returned by \ref nxlinkConnectToHost.
+ * @param fd File descriptor to write to, or -1 to go back to svcOutputDebugString.
+ */
+void consoleDebugSetOutputFd(int fd);
+
+/**
+ * @brief Retrieves the statistics of the debugDevice_SVCBuffered sink.
+ * @param[out] stats Output \ref DebugLogStats.
+ * @note The ring buffer size and the flush interval (in nanoseconds) are set with the weak symbols
+ *       __nx_console_debug_buffer_size and __nx_console_debug_flush_interval. The background thread sleeps while the
+ *       ring is empty; the interval is how long it waits after the first write so later ones are output with it.
+ */
+void consoleDebugGetStats(DebugLogStats *stats);
+
 /// Clears the screan by using printf("\x1b[2J");
 void consoleClear(void);
@@ -8,6 +8,8 @@
 #pragma once
 
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
 #include "../../services/fs.h"
 
 #define FSDEV_DIRITER_MAGIC 0x66736476 ///< "fsdv"
@@ -19,12 +21,60 @@ typedef struct
   FsDir             fd;            ///< File descriptor
   ssize_t           index;         ///< Current entry index
   size_t            size;          ///< Current batch size
+  FsDirectoryEntry *entries;       ///< Batch buffer, initially the one following this struct
+  size_t            capacity;      ///< Capacity of the batch buffer, grows for large directories
+  void             *device;        ///< Device the directory was opened on (internal)
+  char             *path;          ///< FS path of the directory, NULL if it couldn't be allocated
 } fsdev_dir_t;
 
+/// Directory entry returned by \ref fsdevReadDirectoryBulk.
+typedef struct
+{
+  char              name[FS_MAX_PATH]; ///< Entry name (UTF-8).
+  FsDirEntryType    type;              ///< Entry type.
+  s64               file_size;         ///< File size, 0 for directories.
+  FsTimeStampRaw    timestamps;        ///< File timestamps, only retrieved with \ref FsdevReadDirFlag_TimeStamps (check is_valid).
+} FsdevDirEntry;
+
+/// Flags for \ref fsdevReadDirectoryBulk.
+typedef enum {
+  FsdevReadDirFlag_TimeStamps = BIT(0), ///< Also retrieve file timestamps. This costs one IPC per file.
+} FsdevReadDirFlag;
+
+/// Info retrieved by \ref fsdevStat in addition to the entry type.
+typedef enum {
+  FsdevStatFlag_Size       = BIT(0), ///< File size, which costs opening and closing the file.
+  FsdevStatFlag_TimeStamps = BIT(1), ///< File timestamps.
+} FsdevStatFlag;
+
+#define FSDEV_TREE_MAX_THREADS 16 ///< Maximum number of threads used by \ref fsdevWalk and \ref fsdevCopyTree.
+
+/// Entry visited by \ref fsdevWalk and \ref fsdevCopyTree.
+typedef struct
+{
+  const char       *path;              ///< FS path of the entry (without the device prefix).
+  FsDirEntryType    type;              ///< Entry type.
+  s64               file_size;         ///< File size, 0 for directories.
+  u32               depth;             ///< Depth below the root of the walk, starting at 1.
+} FsdevWalkEntry;
+
+/// Callback for \ref fsdevWalk and \ref fsdevCopyTree. Returning false skips the entry: directories aren't entered, and nothing is copied.
+typedef bool (*FsdevWalkCallback)(const FsdevWalkEntry *entry, void *userdata);
+
+/// Statistics of \ref fsdevWalk and \ref fsdevCopyTree.
+typedef struct
+{
+  u64               num_dirs;          ///< Number of directories visited.
+  u64               num_files;         ///< Number of files visited.
+  u64               total_size;        ///< Total size of the files visited (copied, for \ref fsdevCopyTree).
+  u64               elapsed_ns;        ///< Duration of the operation.
+  u64               bytes_per_second;  ///< Throughput, from total_size and elapsed_ns.
+} FsdevTreeStats;
+
 /// Retrieves a pointer to temporary stage for reading entries
 NX_CONSTEXPR FsDirectoryEntry* fsdevDirGetEntries(fsdev_dir_t *dir)
 {
-  return (FsDirectoryEntry*)(void*)(dir+1);
+  return dir->entries;
 }
 
 /// Initializes and mounts the sdmc device if accessible.
@@ -88,6 +138,54 @@ Result fsdevCreateFile(const char* path, size_t size, u32 flags);
 /// Recursively deletes the directory specified by the input path (as used in stdio).
 Result fsdevDeleteDirectoryRecursively(const char *path);
 
+/// Like stat(), but only retrieves the info selected by flags (bitmask of \ref FsdevStatFlag) in addition to the entry type.
+/// With flags=0 this takes a single IPC. Fields which weren't requested are zero, unless they were cached.
+/// Returns -1 and sets errno on failure.
+int fsdevStat(const char *path, struct stat *st, u32 flags);
+
+/**
+ * @brief Reads up to n entries from a directory opened with opendir(), in as few IPCs as possible.
+ * @param[in] dir Directory, which must belong to an fsdev device. Entries are shared with readdir().
+ * @param[out] out Output entries.
+ * @param[in] n Maximum number of entries to read.
+ * @param[in] flags Bitmask of \ref FsdevReadDirFlag.
+ * @return Number of entries read, 0 at the end of the directory, or -1 with errno set on failure.
+ * @note The entries are read straight into out, so a single IPC returns up to n entries.
+ *       When the stat cache is enabled, the entries are also added to it.
+ */
+ssize_t fsdevReadDirectoryBulk(DIR *dir, FsdevDirEntry *out, size_t n, u32 flags);
+
+/// Drops the stat cache of the specified device (or of the device of the specified path, as used in stdio). Use this after modifying the filesystem without going through fsdev.
+/// The cache holds up to __nx_fsdev_stat_cache_size entries per device (weak symbol, default 0 = disabled), including paths which don't exist.
+/// Entries are dropped when fsdev writes, truncates, renames, creates or deletes the path, and on \ref fsdevCommitDevice.
+Result fsdevInvalidateStatCache(const char *name);
+
+/**
+ * @brief Walks a directory tree breadth-first, on several threads.
+ * @param[in] path Root directory (as used in stdio).
+ * @param[in] num_threads Number of threads including the calling one, at most \ref FSDEV_TREE_MAX_THREADS. 0 uses one per fs session (see __nx_fs_num_sessions).
+ * @param[in] callback Callback invoked for each entry below the root, optional.
+ * @param[in] userdata Argument passed to the callback.
+ * @param[out] stats Output \ref FsdevTreeStats, optional.
+ * @note The callback is invoked concurrently from all the threads. Each thread issues its requests through its own fs session.
+ */
+Result fsdevWalk(const char *path, u32 num_threads, FsdevWalkCallback callback, void *userdata, FsdevTreeStats *stats);
+
+/**
+ * @brief Copies a file or directory tree, on several threads.
+ * @param[in] src Source file or directory (as used in stdio).
+ * @param[in] dst Destination (as used in stdio), which may be on another device. Existing files are overwritten.
+ *                It must not be src itself or below it (LibnxError_BadInput).
+ * @param[in] num_threads See \ref fsdevWalk.
+ * @param[in] callback Callback invoked for each entry below src before it is copied, optional. Paths are source paths.
+ * @param[in] userdata Argument passed to the callback.
+ * @param[out] stats Output \ref FsdevTreeStats, optional.
+ * @note Files larger than __nx_fsdev_copy_chunk_size (weak symbol) are copied in chunks. When \ref fsAsyncInitialize was used,
+ *       the next chunk is read while the current one is written.
+ * @note The operation stops at the first failure, whose result is returned.
+ */
+Result fsdevCopyTree(const char *src, const char *dst, u32 num_threads, FsdevWalkCallback callback, void *userdata, FsdevTreeStats *stats);
+
 /// Unmounts all devices and cleans up any resources used by the FS driver.
 Result fsdevUnmountAll(void);
 
@@ -68,3 +68,32 @@ Result usbCommsWriteAsync(void *buffer, size_t size, u32 *urbId, u32 interface);
 Result usbCommsGetWriteResult(u32 urbId, u32 *transferredSize, u32 interface);
 
 ///@}
+
+///@name Pipelined API
+///@{
+
+/**
+ * @brief Read data with the default interface, keeping several transfers in flight.
+ * @note The buffer has no alignment requirement. Data is received into a ring of page-aligned buffers
+ *       (set the weak symbols __nx_usb_comms_pipeline_depth (max 8) and __nx_usb_comms_pipeline_urb_size to size it).
+ * @note Transfers are sized from the remaining request, so the host does not need to end a transfer with a ZLP when it
+ *       sends exactly \p size bytes. Transfers still posted when a call returns early (on a short packet) keep receiving
+ *       data, which is returned by the next call. Hence on a given interface this must not be mixed with the other read functions.
+ * @return The transferred size, which is smaller than \p size when the host ended a transfer early.
+ */
+size_t usbCommsReadPipelined(void* buffer, size_t size);
+
+/**
+ * @brief Write data with the default interface, keeping several transfers in flight.
+ * @note Page-aligned data is posted in place, anything else is copied through the same kind of ring as \ref usbCommsReadPipelined.
+ *       All transfers have completed when this returns.
+ */
+size_t usbCommsWritePipelined(const void* buffer, size_t size);
+
+/// Same as usbCommsReadPipelined except with the specified interface.
+size_t usbCommsReadPipelinedEx(void* buffer, size_t size, u32 interface);
+
+/// Same as usbCommsWritePipelined except with the specified interface.
+size_t usbCommsWritePipelinedEx(const void* buffer, size_t size, u32 interface);
+
+///@}
@@ -0,0 +1,37 @@
+/**
+ * @file init.h
+ * @brief Application startup timeline.
+ * @copyright libnx Authors
+ */
+#pragma once
+#include "../types.h"
+
+/// Phases of the default \ref __appInit implementation.
+typedef enum {
+    InitPhase_Sm          = 0, ///< sm initialization.
+    InitPhase_HosVersion  = 1, ///< System version detection through setsys.
+    InitPhase_Applet      = 2, ///< applet initialization.
+    InitPhase_Hid         = 3, ///< hid initialization.
+    InitPhase_Time        = 4, ///< time initialization, including newlib time setup.
+    InitPhase_Fs          = 5, ///< fs initialization.
+    InitPhase_Sdmc        = 6, ///< fsdevMountSdmc.
+    InitPhase_Win         = 7, ///< __nx_win_init.
+    InitPhase_UserAppInit = 8, ///< userAppInit.
+    InitPhase_Count,
+} InitPhase;
+
+/// Startup timeline, in system ticks (see \ref armGetSystemTick).
+typedef struct {
+    u64 start_tick;                 ///< Tick at which \ref __appInit started.
+    u64 end_tick;                   ///< Tick at which \ref __appInit finished.
+    u64 begin[InitPhase_Count];     ///< Tick at which each phase began (0 if it did not run).
+    u64 end[InitPhase_Count];       ///< Tick at which each phase ended (0 if it did not run).
+    bool parallel;                  ///< Whether independent services were initialized concurrently.
+} InitTimeline;
+
+/**
+ * @brief Gets the timeline recorded by the default \ref __appInit implementation.
+ * @note Set the weak symbol __nx_init_parallel to true to initialize time and fs (including the sdmc mount)
+ *       on short-lived helper threads, concurrently with applet and hid.
+ */
+const InitTimeline* initGetTimeline(void);
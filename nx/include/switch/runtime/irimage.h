@@ -0,0 +1,108 @@
+/**
+ * @file irimage.h
+ * @brief Local processing of IR camera images obtained with the irs image transfer processor.
+ * @copyright libnx Authors
+ */
+#pragma once
+#include "../types.h"
+#include "../kernel/mutex.h"
+#include "../kernel/condvar.h"
+#include "../kernel/thread.h"
+#include "../services/irs.h"
+
+/// Background fetcher of image transfer processor frames.
+typedef struct {
+    IrsIrCameraHandle handle;
+    Thread thread;
+    Mutex mutex;
+    CondVar cond;
+    u8* buffers[3];
+    IrsImageTransferProcessorState states[3];
+    size_t size;
+    u32 writing;                  ///< Buffer being filled by the fetch thread.
+    u32 ready;                    ///< Most recent complete frame, not yet acquired.
+    u32 front;                    ///< Buffer returned by the last \ref irImageStreamAcquire.
+    bool ready_valid;
+    u64 poll_interval;
+    Result last_result;           ///< Result of the last failed fetch, or 0.
+    bool exit_requested;
+} IrImageStream;
+
+/**
+ * @brief Thresholds an image: pixels with an intensity >= threshold become 0xFF, all others 0.
+ * @param[in] src Input image.
+ * @param[out] dst Output image, may be the same as src.
+ * @param[in] size Size of the image in pixels.
+ * @param[in] threshold Intensity threshold.
+ */
+void irImageThreshold(const u8* src, u8* dst, size_t size, u8 threshold);
+
+/**
+ * @brief Downscales an image by a factor of 2 in each direction, averaging each 2x2 block.
+ * @param[in] src Input image.
+ * @param[out] dst Output image, (width/2)*(height/2) pixels.
+ * @param[in] width Width of the input image (must be even).
+ * @param[in] height Height of the input image (must be even).
+ */
+void irImageDownscale2x(const u8* src, u8* dst, u32 width, u32 height);
+
+/**
+ * @brief Computes the average intensity and intensity-weighted centroid of each block of a grid laid over an image, like the moment processor.
+ * @param[in] image Input image.
+ * @param[in] width Width of the image.
+ * @param[in] height Height of the image.
+ * @param[in] blocks_x Number of grid columns.
+ * @param[in] blocks_y Number of grid rows.
+ * @param[out] out Output array of blocks_x*blocks_y \ref IrsMomentStatistic, row-major. Centroids are in image coordinates.
+ */
+void irImageComputeMoments(const u8* image, u32 width, u32 height, u32 blocks_x, u32 blocks_y, IrsMomentStatistic *out);
+
+/**
+ * @brief Gets the size of the work buffer required by \ref irImageFindClusters.
+ * @param[in] width Width of the image.
+ * @param[in] height Height of the image.
+ * @return Size in bytes.
+ */
+size_t irImageGetClusterWorkSize(u32 width, u32 height);
+
+/**
+ * @brief Finds the 8-connected clusters of pixels with an intensity >= threshold, like the clustering processor.
+ * @param[in] image Input image.
+ * @param[in] width Width of the image.
+ * @param[in] height Height of the image.
+ * @param[in] threshold Intensity threshold.
+ * @param[in] min_pixels Clusters with fewer pixels are discarded.
+ * @param[out] out Output array of \ref IrsClusteringData. Centroids are intensity-weighted.
+ * @param[in] max_clusters Size of the out array in entries. The largest clusters are kept.
+ * @param[in] workbuf Work buffer, see \ref irImageGetClusterWorkSize. Must be 4-byte aligned.
+ * @return Number of clusters written to out.
+ */
+size_t irImageFindClusters(const u8* image, u32 width, u32 height, u8 threshold, u32 min_pixels, IrsClusteringData *out, size_t max_clusters, void* workbuf);
+
+/**
+ * @brief Creates an \ref IrImageStream and starts its fetch thread.
+ * @note The image transfer processor must already be running (see \ref irsRunImageTransferProcessor).
+ * @note Frames are fetched into a separate buffer while the caller processes the last acquired one, so that processing overlaps the transfer of the next frame.
+ * @param[out] s \ref IrImageStream
+ * @param[in] handle \ref IrsIrCameraHandle
+ * @param[in] size Size of each frame buffer, normally the image size of the configured format.
+ * @param[in] poll_interval Interval (in nanoseconds) between fetches when no new frame is available; 0 selects 5ms.
+ * @return Result code.
+ */
+Result irImageStreamCreate(IrImageStream* s, IrsIrCameraHandle handle, size_t size, u64 poll_interval);
+
+/**
+ * @brief Waits for a frame newer than the previously acquired one.
+ * @param[in] s \ref IrImageStream
+ * @param[out] image Output pointer to the frame, valid until the next call.
+ * @param[out] state Optional output \ref IrsImageTransferProcessorState of the frame.
+ * @param[in] timeout Timeout (in nanoseconds).
+ * @return Result code; KERNELRESULT(TimedOut) if no new frame arrived in time.
+ */
+Result irImageStreamAcquire(IrImageStream* s, const u8** image, IrsImageTransferProcessorState *state, u64 timeout);
+
+/**
+ * @brief Stops the fetch thread of an \ref IrImageStream and frees its buffers.
+ * @param[in] s \ref IrImageStream
+ */
+void irImageStreamClose(IrImageStream* s);
@@ -10,20 +10,25 @@ u32 resolverGetCancelHandle(void);
 /// Retrieves whether service discovery is enabled for resolver commands on the current thread.
 bool resolverGetEnableServiceDiscovery(void);
 
-/// [5.0.0+] Retrieves whether the DNS cache is used to resolve queries on the current thread (not implemented).
+/// Retrieves whether the in-process DNS cache is used to resolve queries on the current thread.
 bool resolverGetEnableDnsCache(void);
 
 /// Enables or disables service discovery for the current thread.
 void resolverSetEnableServiceDiscovery(bool enable);
 
-/// [5.0.0+] Enables or disables the usage of the DNS cache on the current thread (not implemented).
+/**
+ * @brief Enables or disables the usage of the in-process DNS cache on the current thread (enabled by default).
+ * @note The cache itself is disabled unless the weak symbol __nx_resolver_cache_ttl is set to a nonzero lifetime (in nanoseconds)
+ *       for cached results of gethostbyname and getaddrinfo. __nx_resolver_cache_max_entries bounds the number of cached results.
+ * @note Concurrent lookups of the same query share a single sfdnsres request. Failed lookups aren't cached.
+ */
 void resolverSetEnableDnsCache(bool enable);
 
 /// Cancels a previous resolver command (handle obtained with \ref resolverGetCancelHandle prior to calling the command).
 Result resolverCancel(u32 handle);
 
-/// [5.0.0+] Removes a hostname from the DNS cache (not implemented).
+/// Removes a hostname from the in-process DNS cache. The sfdnsres cache is left untouched (not implemented).
 Result resolverRemoveHostnameFromCache(const char* hostname);
 
-/// [5.0.0+] Removes an IP address from the DNS cache (not implemented).
+/// Removes an IP address from the in-process DNS cache, which currently drops every cached result. The sfdnsres cache is left untouched (not implemented).
 Result resolverRemoveIpAddressFromCache(u32 ip);
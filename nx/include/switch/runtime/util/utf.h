@@ -52,6 +52,15 @@ ssize_t encode_utf8 (uint8_t *out, uint32_t in);
  */
 ssize_t encode_utf16(uint16_t *out, uint32_t in);
 
+/** Validate a UTF-8 sequence
+ *
+ *  @param[in]  in  Input sequence (null-terminated)
+ *
+ *  @returns number of code units before the null terminator
+ *  @returns -1 for error
+ */
+ssize_t validate_utf8(const uint8_t *in);
+
 /** Convert a UTF-8 sequence into a UTF-16 sequence
  *
  *  Fills the output buffer up to \a len code units.
@@ -9,6 +9,7 @@
 #pragma once
 #include "../types.h"
 #include "../kernel/event.h"
+#include "../kernel/uevent.h"
 #include "../services/ncm_types.h"
 #include "../services/acc.h"
 #include "../sf/service.h"
@@ -659,6 +660,49 @@ Result fsStorageGetSize(FsStorage* s, s64* out);
 Result fsStorageOperateRange(FsStorage* s, FsOperationId op_id, s64 off, s64 len, FsRangeInfo* out); ///< [4.0.0+]
 void fsStorageClose(FsStorage* s);
 
+// Asynchronous I/O
+
+/// Asynchronous read request. The object must stay valid until the request completes.
+typedef struct FsAsyncRequest FsAsyncRequest;
+struct FsAsyncRequest {
+    UEvent event;          ///< Signalled when the request completes.
+    Result result;         ///< Result of the request, valid once completed.
+    u64 bytes_read;        ///< Number of bytes read (file reads only), valid once completed.
+
+    FsAsyncRequest* next;
+    Service* s;
+    bool is_storage;
+    u32 option;
+    u32 priority;
+    s64 offset;
+    void* buf;
+    u64 size;
+};
+
+/// Creates a \ref Waiter for a \ref FsAsyncRequest, signalled once the request completes.
+static inline Waiter waiterForFsAsyncRequest(FsAsyncRequest* req) {
+    return waiterForUEvent(&req->event);
+}
+
+/**
+ * @brief Starts the asynchronous I/O worker pool, with one worker thread per fs session (see __nx_fs_num_sessions).
+ * @param[in] queue_depth Maximum number of queued requests. Submitting more requests blocks until the workers catch up.
+ * @note Requests queued for the same file/storage with contiguous offsets and contiguous buffers are coalesced into a single read.
+ */
+Result fsAsyncInitialize(u32 queue_depth);
+
+/// Stops the asynchronous I/O worker pool, after completing all queued requests. Also done automatically by \ref fsExit.
+void fsAsyncExit(void);
+
+/// Queues an asynchronous \ref fsFileRead. The request uses the fs priority (see \ref fsSetPriority) of the calling thread.
+Result fsFileReadAsync(FsFile* f, s64 off, void* buf, u64 read_size, u32 option, FsAsyncRequest* req);
+
+/// Queues an asynchronous \ref fsStorageRead. The request uses the fs priority (see \ref fsSetPriority) of the calling thread.
+Result fsStorageReadAsync(FsStorage* s, s64 off, void* buf, u64 read_size, FsAsyncRequest* req);
+
+/// Waits for an asynchronous request to complete, and returns its result.
+Result fsAsyncRequestWait(FsAsyncRequest* req, u64* bytes_read);
+
 // ISaveDataInfoReader
 
 /// Read FsSaveDataInfo data into the buf array.
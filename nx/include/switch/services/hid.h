@@ -1306,6 +1306,32 @@ typedef struct HidNpadSharedMemoryFormat {
     HidNpadSharedMemoryEntry entries[10];
 } HidNpadSharedMemoryFormat;
 
+#define HID_INPUT_SNAPSHOT_MAX_NPADS  10    ///< Maximum number of npads tracked by a \ref HidInputSnapshot.
+#define HID_INPUT_SNAPSHOT_MAX_STATES 17    ///< Maximum number of new states returned per LIFO by \ref hidUpdateInputSnapshot.
+
+/// Per-npad data of a \ref HidInputSnapshot.
+typedef struct HidNpadSnapshot {
+    u32 id;                                                                         ///< \ref HidNpadIdType
+    u32 style_set;                                                                  ///< Bitfield of \ref HidNpadStyleTag at the time of the last update.
+    u32 num_states;                                                                 ///< Number of new entries in states.
+    u32 num_six_axis_states[2];                                                     ///< Number of new entries in six_axis_states, for each device.
+    bool dropped;                                                                   ///< Whether npad states were overwritten before they could be read.
+    bool six_axis_dropped[2];                                                       ///< Whether six-axis states were overwritten before they could be read, for each device.
+    u32 cursor_style;                                                               ///< Internal: style whose LIFOs the cursors below refer to.
+    u64 cursor;                                                                     ///< Internal: sampling number of the newest npad state read so far.
+    u64 six_axis_cursor[2];                                                         ///< Internal: sampling number of the newest six-axis state read so far.
+    HidNpadCommonState states[HID_INPUT_SNAPSHOT_MAX_STATES];                       ///< New npad states, newest first.
+    HidSixAxisSensorState six_axis_states[2][HID_INPUT_SNAPSHOT_MAX_STATES];        ///< New six-axis states, newest first. Device 1 is only used by NpadJoyDual (right Joy-Con).
+} HidNpadSnapshot;
+
+/// Snapshot of the input of several npads, see \ref hidUpdateInputSnapshot.
+typedef struct HidInputSnapshot {
+    u32 num_npads;                                                                  ///< Number of tracked npads.
+    bool read_six_axis;                                                             ///< Whether six-axis sensor states are read.
+    u64 update_ticks;                                                               ///< System ticks spent in the last \ref hidUpdateInputSnapshot call.
+    HidNpadSnapshot npads[HID_INPUT_SNAPSHOT_MAX_NPADS];                            ///< Tracked npads.
+} HidInputSnapshot;
+
 // End HidNpad
 
 // Begin HidGesture
@@ -1788,6 +1814,23 @@ size_t hidGetNpadStatesSystem(HidNpadIdType id, HidNpadSystemState *states, size
  */
 size_t hidGetSixAxisSensorStates(HidSixAxisSensorHandle handle, HidSixAxisSensorState *states, size_t count);
 
+/**
+ * @brief Initializes a \ref HidInputSnapshot.
+ * @param[out] s \ref HidInputSnapshot
+ * @param[in] ids Input array of \ref HidNpadIdType.
+ * @param[in] count Size of the ids array, at most \ref HID_INPUT_SNAPSHOT_MAX_NPADS.
+ * @param[in] read_six_axis Whether six-axis sensor states should be read too. The sensors must have been started with \ref hidStartSixAxisSensor.
+ */
+void hidInitializeInputSnapshot(HidInputSnapshot *s, const HidNpadIdType *ids, size_t count, bool read_six_axis);
+
+/**
+ * @brief Reads the states of all npads tracked by a \ref HidInputSnapshot that are newer than the ones returned by the previous update.
+ * @note Each LIFO is read once, newest entry first, and each entry is validated individually: a torn entry is re-read on its own, instead of restarting the whole read.
+ * @note The npad LIFO is chosen from the current style set the same way as \ref padUpdate. NpadGc trigger states are not included.
+ * @param[in] s \ref HidInputSnapshot
+ */
+void hidUpdateInputSnapshot(HidInputSnapshot *s);
+
 ///@}
 
 ///@name Gesture
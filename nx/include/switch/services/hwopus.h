@@ -9,6 +9,14 @@
 #include "../types.h"
 #include "../sf/service.h"
 #include "../kernel/tmem.h"
+#include "../kernel/mutex.h"
+#include "../kernel/condvar.h"
+
+#define HWOPUS_MAX_FRAME_SAMPLES 5760 ///< Maximum number of samples per channel decoded from a single packet (120ms at 48kHz).
+#define HWOPUS_POOL_MAX_DECODERS 8    ///< Maximum number of decoders in a \ref HwopusDecoderPool.
+
+/// Size in bytes of the buffer required by \ref hwopusPcmRingInit for the given capacity (in samples per channel) and channel count.
+#define HWOPUS_PCM_RING_BUFFER_SIZE(_capacity, _channels) (((_capacity) + HWOPUS_MAX_FRAME_SAMPLES) * (_channels) * sizeof(s16))
 
 typedef struct {
     Service s;
@@ -23,6 +31,39 @@ typedef struct {
     u32 final_range; ///< Indicates the final range of the codec encoder's entropy coder. This can be left at zero.
 } HwopusHeader;
 
+/// Single-producer single-consumer ring of interleaved PCM samples, filled by \ref hwopusDecodeInterleavedBatch.
+typedef struct {
+    s16 *buffer;       ///< Sample buffer, followed by room for one packet which wraps around the end of the ring.
+    u32 capacity;      ///< Capacity of the ring, in samples per channel.
+    u32 channel_count; ///< Number of interleaved channels.
+    u64 read_pos;      ///< Total number of samples per channel read so far.
+    u64 write_pos;     ///< Total number of samples per channel written so far.
+} HwopusPcmRing;
+
+/// Result of \ref hwopusDecodeInterleavedBatch.
+typedef struct {
+    u32 packets;     ///< Number of packets decoded.
+    u32 samples;     ///< Number of samples per channel written to the ring.
+    size_t consumed; ///< Number of bytes of opusin consumed. Decoding resumes at this offset.
+    u64 perf;        ///< Sum of the decode times reported by the service [4.0.0+], 0 otherwise.
+} HwopusBatchResult;
+
+/// Decoder slot of a \ref HwopusDecoderPool.
+typedef struct {
+    HwopusDecoder decoder;
+    u64 owner;       ///< Stream which last used this decoder.
+    bool has_owner;  ///< Whether owner is valid.
+    bool busy;       ///< Whether the decoder is in use.
+} HwopusDecoderPoolSlot;
+
+/// Set of decoder sessions shared among many streams of the same format.
+typedef struct {
+    Mutex mutex;
+    CondVar condvar;
+    u32 num_decoders;
+    HwopusDecoderPoolSlot slots[HWOPUS_POOL_MAX_DECODERS];
+} HwopusDecoderPool;
+
 /// Used internally.
 typedef struct {
     s32 SampleRate;
@@ -42,3 +83,61 @@ Result hwopusDecoderMultistreamInitialize(HwopusDecoder* decoder, s32 SampleRate
 /// Decodes opus data.
 Result hwopusDecodeInterleaved(HwopusDecoder* decoder, s32 *DecodedDataSize, s32 *DecodedSampleCount, const void* opusin, size_t opusin_size, s16 *pcmbuf, size_t pcmbuf_size);
 
+
+/**
+ * @brief Initializes a PCM ring.
+ * @param[out] ring \ref HwopusPcmRing
+ * @param[in] buffer Sample buffer.
+ * @param[in] buffer_size Size of the buffer in bytes, see \ref HWOPUS_PCM_RING_BUFFER_SIZE. Must be at least
+ *            HWOPUS_PCM_RING_BUFFER_SIZE(HWOPUS_MAX_FRAME_SAMPLES, channel_count), as decoding needs room for a full frame.
+ * @param[in] channel_count Number of interleaved channels, must match the decoder.
+ */
+Result hwopusPcmRingInit(HwopusPcmRing* ring, s16 *buffer, size_t buffer_size, u32 channel_count);
+
+/// Gets the number of samples per channel which can be read from the ring.
+u32 hwopusPcmRingGetAvailable(HwopusPcmRing* ring);
+
+/**
+ * @brief Reads interleaved samples from the ring.
+ * @param[in] ring \ref HwopusPcmRing
+ * @param[out] out Output buffer, which must have room for count*channel_count samples.
+ * @param[in] count Maximum number of samples per channel to read.
+ * @return Number of samples per channel read.
+ * @note This may be called concurrently with a single thread decoding into the ring.
+ */
+u32 hwopusPcmRingRead(HwopusPcmRing* ring, s16 *out, u32 count);
+
+/**
+ * @brief Decodes consecutive opus packets into a PCM ring.
+ * @param[in] decoder \ref HwopusDecoder
+ * @param[in] ring \ref HwopusPcmRing
+ * @param[in] opusin Packets, each starting with a \ref HwopusHeader.
+ * @param[in] opusin_size Size of opusin in bytes.
+ * @param[out] out Output \ref HwopusBatchResult, optional.
+ * @note Decoding stops early when the ring lacks room for \ref HWOPUS_MAX_FRAME_SAMPLES, or at a truncated packet.
+ *       Packets are decoded directly into the ring without intermediate copies, except for the part of a packet wrapping around its end.
+ * @note The service decodes a single packet per request, so this still issues one IPC per packet.
+ */
+Result hwopusDecodeInterleavedBatch(HwopusDecoder* decoder, HwopusPcmRing* ring, const void* opusin, size_t opusin_size, HwopusBatchResult* out);
+
+/**
+ * @brief Creates a decoder pool.
+ * @param[out] pool \ref HwopusDecoderPool
+ * @param[in] num_decoders Number of decoder sessions, at most \ref HWOPUS_POOL_MAX_DECODERS.
+ * @param[in] SampleRate Sample rate of all streams.
+ * @param[in] ChannelCount Channel count of all streams.
+ */
+Result hwopusDecoderPoolCreate(HwopusDecoderPool* pool, u32 num_decoders, s32 SampleRate, s32 ChannelCount);
+
+/// Closes a decoder pool. No decode may be in progress.
+void hwopusDecoderPoolClose(HwopusDecoderPool* pool);
+
+/**
+ * @brief Decodes consecutive opus packets of a stream with a decoder taken from the pool, see \ref hwopusDecodeInterleavedBatch.
+ * @param[in] pool \ref HwopusDecoderPool
+ * @param[in] stream_id Caller-defined identifier of the stream.
+ * @note A decoder last used by the same stream is preferred. When a decoder switches streams its context is reset [6.0.0+],
+ *       before that the first packet is decoded with the state left by the previous stream.
+ * @note Blocks until a decoder is available.
+ */
+Result hwopusDecoderPoolDecodeBatch(HwopusDecoderPool* pool, u64 stream_id, HwopusPcmRing* ring, const void* opusin, size_t opusin_size, HwopusBatchResult* out);
@@ -27,6 +27,19 @@ typedef struct {
     u8 pad[7];              ///< [3.0.0+]
 } NcmRightsId;
 
+/// Callback used by \ref ncmContentStorageWritePlaceHolderFromStream to read up to \p size bytes of content into \p buffer.
+typedef Result (*NcmInstallReadFunc)(void* userdata, void* buffer, size_t size, size_t* out_size);
+
+/// Statistics of \ref ncmContentStorageWritePlaceHolderFromStream.
+typedef struct {
+    u64 total_size;    ///< Bytes written.
+    u64 elapsed_ns;    ///< Total time spent.
+    u64 read_ns;       ///< Time spent in the read callback.
+    u64 hash_ns;       ///< Time spent hashing.
+    u64 write_ns;      ///< Time spent in WritePlaceHolder.
+    double mb_per_sec; ///< Overall throughput, in MB/s.
+} NcmInstallStats;
+
 /// Initialize ncm.
 Result ncmInitialize(void);
 
@@ -58,6 +71,19 @@ Result ncmContentStorageCreatePlaceHolder(NcmContentStorage* cs, const NcmConten
 Result ncmContentStorageDeletePlaceHolder(NcmContentStorage* cs, const NcmPlaceHolderId* placeholder_id);
 Result ncmContentStorageHasPlaceHolder(NcmContentStorage* cs, bool* out, const NcmPlaceHolderId* placeholder_id);
 Result ncmContentStorageWritePlaceHolder(NcmContentStorage* cs, const NcmPlaceHolderId* placeholder_id, u64 offset, const void* data, size_t data_size);
+
+/**
+ * @brief Writes a whole placeholder from a stream, overlapping reading, hashing and writing.
+ * @note The calling thread invokes \p read_func to fill a pool of page-aligned buffers, which are hashed and written with \ref ncmContentStorageWritePlaceHolder
+ *       by two helper threads at the same time. The pool is sized with the weak symbols __nx_ncm_install_buffer_count and __nx_ncm_install_buffer_size.
+ * @param cs \ref NcmContentStorage
+ * @param placeholder_id Placeholder to write, starting at offset 0. It must have been created with \ref ncmContentStorageCreatePlaceHolder beforehand.
+ * @param content_id When not NULL, the SHA-256 of the data is checked against this ContentId, LibnxError_HashMismatch is returned on mismatch.
+ * @param read_func Callback reading the next chunk of data. It must set *out_size to 0 at the end of the stream.
+ * @param userdata User data passed to \p read_func.
+ * @param[out] out_stats Optional \ref NcmInstallStats.
+ */
+Result ncmContentStorageWritePlaceHolderFromStream(NcmContentStorage* cs, const NcmPlaceHolderId* placeholder_id, const NcmContentId* content_id, NcmInstallReadFunc read_func, void* userdata, NcmInstallStats* out_stats);
 Result ncmContentStorageRegister(NcmContentStorage* cs, const NcmContentId* content_id, const NcmPlaceHolderId* placeholder_id);
 Result ncmContentStorageDelete(NcmContentStorage* cs, const NcmContentId* content_id);
 Result ncmContentStorageHas(NcmContentStorage* cs, bool* out, const NcmContentId* content_id);
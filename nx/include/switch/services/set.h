@@ -917,6 +917,18 @@ void setExit(void);
 /// Gets the Service object for the actual set service session.
 Service* setGetServiceSession(void);
 
+/**
+ * @brief Drops every value held by the settings cache.
+ * @note The cache is disabled by default, set the weak symbol __nx_set_cache to true to enable it.
+ *       It then holds the results of the following getters: \ref setGetLanguageCode, \ref setGetRegionCode, \ref setGetQuestFlag,
+ *       \ref setGetDeviceNickname, \ref setsysGetFirmwareVersion, \ref setsysGetLockScreenFlag, \ref setsysGetColorSetId,
+ *       \ref setsysGetSettingsItemValueSize, \ref setsysGetSettingsItemValue, \ref setsysGetQuestFlag, \ref setsysGetPrimaryAlbumStorage,
+ *       \ref setsysGetSerialNumber, \ref setsysGetDeviceNickname, \ref setsysGetProductModel and \ref setsysGetKeyboardLayout.
+ * @note The cache is invalidated automatically by the corresponding setters of this process, and when set or set:sys is exited. There is no notification for
+ *       changes made by other processes, so call this when those matter (for example when resuming from the home menu).
+ */
+void setCacheInvalidate(void);
+
 /// Converts LanguageCode to \ref SetLanguage.
 Result setMakeLanguage(u64 LanguageCode, SetLanguage *Language);
 
@@ -131,3 +131,26 @@ Result timeToCalendarTimeWithMyRule(u64 timestamp, TimeCalendarTime *caltime, Ti
 Result timeToPosixTime(const TimeZoneRule *rule, const TimeCalendarTime *caltime, u64 *timestamp_list, s32 timestamp_list_count, s32 *timestamp_count);
 Result timeToPosixTimeWithMyRule(const TimeCalendarTime *caltime, u64 *timestamp_list, s32 timestamp_list_count, s32 *timestamp_count);
 
+/**
+ * @brief Converts a POSIX timestamp to calendar time in-process, without an IPC round trip.
+ * @note Equivalent to \ref timeToCalendarTime. The rule can be obtained with \ref timeLoadTimeZoneRule (use the output of \ref timeGetDeviceLocationName for the device's own rule), and does not require the time service afterwards.
+ * @param[in] rule Time zone rule.
+ * @param[in] timestamp POSIX UTC timestamp.
+ * @param[out] caltime Output \ref TimeCalendarTime, optional.
+ * @param[out] info Output \ref TimeCalendarAdditionalInfo, optional.
+ * @return Result code.
+ */
+Result timeToCalendarTimeOffline(const TimeZoneRule *rule, u64 timestamp, TimeCalendarTime *caltime, TimeCalendarAdditionalInfo *info);
+
+/**
+ * @brief Converts calendar time to POSIX timestamps in-process, without an IPC round trip.
+ * @note Equivalent to \ref timeToPosixTime. Ambiguous local times (e.g. when DST ends) produce two timestamps, in ascending order.
+ * @param[in] rule Time zone rule.
+ * @param[in] caltime Input \ref TimeCalendarTime.
+ * @param[out] timestamp_list Output POSIX UTC timestamps.
+ * @param[in] timestamp_list_count Number of entries in timestamp_list.
+ * @param[out] timestamp_count Number of timestamps written.
+ * @return Result code.
+ */
+Result timeToPosixTimeOffline(const TimeZoneRule *rule, const TimeCalendarTime *caltime, u64 *timestamp_list, s32 timestamp_list_count, s32 *timestamp_count);
+
@@ -1,22 +1,48 @@
+#include "result.h"
 #include "kernel/barrier.h"
+#include "kernel/svc.h"
 
-void barrierInit(Barrier *b, u64 total) {
-    b->count = 0;
-    b->total = total - 1;
-    mutexInit(&b->mutex);
-    condvarInit(&b->condvar);
+void barrierInitWithSpin(Barrier *b, u64 thread_count, u32 spin_count) {
+    b->count = thread_count;
+    b->total = thread_count;
+    b->phase = 0;
+    b->num_waiters = 0;
+    b->spin_count = spin_count;
+}
+
+void barrierInit(Barrier *b, u64 thread_count) {
+    barrierInitWithSpin(b, thread_count, 0);
 }
 
 void barrierWait(Barrier *b) {
-    mutexLock(&b->mutex);
+    u32 phase = __atomic_load_n(&b->phase, __ATOMIC_ACQUIRE);
 
-    if (b->count++ == b->total) {
-        b->count = 0;
-        condvarWake(&b->condvar, b->total);
+    if (__atomic_sub_fetch(&b->count, 1, __ATOMIC_ACQ_REL) == 0) {
+        // Last arrival: rearm the barrier, then open it. No thread can arrive for the
+        // next phase before the phase changes, so the counter can be reset plainly.
+        __atomic_store_n(&b->count, b->total, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&b->phase, 1, __ATOMIC_SEQ_CST);
+
+        if (__atomic_load_n(&b->num_waiters, __ATOMIC_SEQ_CST))
+            svcSignalToAddress(&b->phase, SignalType_Signal, 0, -1);
+        return;
     }
-    else {
-        condvarWait(&b->condvar, &b->mutex);
+
+    for (u32 i = 0; i < b->spin_count; i++) {
+        if (__atomic_load_n(&b->phase, __ATOMIC_ACQUIRE) != phase)
+            return;
+        __asm__ __volatile__("yield" ::: "memory");
+    }
+
+    __atomic_add_fetch(&b->num_waiters, 1, __ATOMIC_SEQ_CST);
+    // The kernel reads the value with a plain load; make sure the registration is visible first.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    while (__atomic_load_n(&b->phase, __ATOMIC_ACQUIRE) == phase) {
+        Result rc = svcWaitForAddress(&b->phase, ArbitrationType_WaitIfEqual, phase, -1);
+        if (R_FAILED(rc) && R_VALUE(rc) != KERNELRESULT(InvalidState))
+            svcBreak(BreakReason_Assert, 0, 0); // should not happen
     }
 
-    mutexUnlock(&b->mutex);
+    __atomic_sub_fetch(&b->num_waiters, 1, __ATOMIC_RELAXED);
 }
@@ -7,6 +7,7 @@
 */
 
 #include <string.h>
+#include <arm_neon.h>
 #include "types.h"
 #include "result.h"
 #include "kernel/mutex.h"
@@ -71,6 +72,66 @@ static void _Round(u8 output[64], const u32 input[16])
         U32TO8_LITTLE(output + 4 * i,x[i]);
 }
 
+#define ROTATE4(v,c) (vsriq_n_u32(vshlq_n_u32((v),(c)),(v),32-(c)))
+#define ROTATE4_16(v) (vreinterpretq_u32_u16(vrev32q_u16(vreinterpretq_u16_u32(v))))
+
+#define QUARTERROUND4(a,b,c,d) \
+    x[a] = vaddq_u32(x[a],x[b]); x[d] = ROTATE4_16(veorq_u32(x[d],x[a])); \
+    x[c] = vaddq_u32(x[c],x[d]); x[b] = ROTATE4(veorq_u32(x[b],x[c]),12); \
+    x[a] = vaddq_u32(x[a],x[b]); x[d] = ROTATE4(veorq_u32(x[d],x[a]), 8); \
+    x[c] = vaddq_u32(x[c],x[d]); x[b] = ROTATE4(veorq_u32(x[b],x[c]), 7);
+
+// Computes 4 consecutive blocks of keystream at once, with each vector lane holding the state of one block.
+static void _Round4(u8 output[256], const u32 input[16])
+{
+    static const u32 lane_offsets[4] = { 0, 1, 2, 3 };
+    uint32x4_t in[16];
+    uint32x4_t x[16];
+    int i;
+
+    for (i = 0;i < 16;++i)
+        in[i] = vdupq_n_u32(input[i]);
+
+    // Per-lane block counter, carrying into the high word.
+    in[12] = vaddq_u32(in[12], vld1q_u32(lane_offsets));
+    in[13] = vsubq_u32(in[13], vcltq_u32(in[12], vdupq_n_u32(input[12])));
+
+    for (i = 0;i < 16;++i)
+        x[i] = in[i];
+
+    for (i = 8;i > 0;i -= 2) {
+        QUARTERROUND4( 0, 4, 8,12);
+        QUARTERROUND4( 1, 5, 9,13);
+        QUARTERROUND4( 2, 6,10,14);
+        QUARTERROUND4( 3, 7,11,15);
+        QUARTERROUND4( 0, 5,10,15);
+        QUARTERROUND4( 1, 6,11,12);
+        QUARTERROUND4( 2, 7, 8,13);
+        QUARTERROUND4( 3, 4, 9,14);
+    }
+
+    for (i = 0;i < 16;++i)
+        x[i] = vaddq_u32(x[i],in[i]);
+
+    // Transpose each group of 4 words back into block order.
+    for (i = 0;i < 16;i += 4) {
+        uint32x4_t t0 = vtrn1q_u32(x[i+0], x[i+1]);
+        uint32x4_t t1 = vtrn2q_u32(x[i+0], x[i+1]);
+        uint32x4_t t2 = vtrn1q_u32(x[i+2], x[i+3]);
+        uint32x4_t t3 = vtrn2q_u32(x[i+2], x[i+3]);
+
+        uint64x2_t r0 = vtrn1q_u64(vreinterpretq_u64_u32(t0), vreinterpretq_u64_u32(t2));
+        uint64x2_t r1 = vtrn1q_u64(vreinterpretq_u64_u32(t1), vreinterpretq_u64_u32(t3));
+        uint64x2_t r2 = vtrn2q_u64(vreinterpretq_u64_u32(t0), vreinterpretq_u64_u32(t2));
+        uint64x2_t r3 = vtrn2q_u64(vreinterpretq_u64_u32(t1), vreinterpretq_u64_u32(t3));
+
+        vst1q_u8(output + 0*64 + 4*i, vreinterpretq_u8_u64(r0));
+        vst1q_u8(output + 1*64 + 4*i, vreinterpretq_u8_u64(r1));
+        vst1q_u8(output + 2*64 + 4*i, vreinterpretq_u8_u64(r2));
+        vst1q_u8(output + 3*64 + 4*i, vreinterpretq_u8_u64(r3));
+    }
+}
+
 static const char sigma[16] = "expand 32-byte k";
 
 static void chachaInit(ChaCha* x, const u8* key, const u8* iv)
@@ -127,10 +188,29 @@ static void chachaEncrypt(ChaCha* x, const u8* m, u8* c, size_t bytes)
     }
 }
 
+static void chachaKeystream4(ChaCha* x, u8 output[256])
+{
+    _Round4(output, x->input);
+
+    x->input[12] += 4;
+    if (x->input[12] < 4)
+        x->input[13] = PLUSONE(x->input[13]);
+}
+
 static ChaCha g_chacha;
 static bool   g_randInit = false;
 static Mutex  g_randMutex;
 
+// Per-thread generator, keyed from the process-wide one so that the fast path needs no locking.
+typedef struct {
+    ChaCha chacha;
+    u8     buf[256];
+    u32    pos;
+    bool   init;
+} RandomThreadState;
+
+static __thread RandomThreadState g_randThread;
+
 static void _randomInit(void)
 {
     // Has already initialized?
@@ -164,21 +244,75 @@ static void _randomInit(void)
     g_randInit = true;
 }
 
-void randomGet(void* buf, size_t len)
+static RandomThreadState* _randomGetThreadState(void)
 {
-    mutexLock(&g_randMutex);
+    RandomThreadState* st = &g_randThread;
+    if (st->init)
+        return st;
 
+    u8 key[32];
+    u8 iv[8];
+
+    mutexLock(&g_randMutex);
     _randomInit();
+    memset(key, 0, sizeof key);
+    chachaEncrypt(&g_chacha, key, key, sizeof key);
+    mutexUnlock(&g_randMutex);
 
-    memset(buf, 0, len);
-    chachaEncrypt(&g_chacha, (const u8*)buf, (u8*)buf, len);
+    memset(iv, 0, sizeof iv);
+    chachaInit(&st->chacha, key, iv);
+    memset(key, 0, sizeof key);
 
-    mutexUnlock(&g_randMutex);
+    st->pos = sizeof(st->buf);
+    st->init = true;
+    return st;
+}
+
+void randomGet(void* buf, size_t len)
+{
+    RandomThreadState* st = _randomGetThreadState();
+    u8* out = (u8*)buf;
+
+    while (len > 0)
+    {
+        if (st->pos == sizeof(st->buf)) {
+            // Large requests are served straight from the keystream.
+            if (len >= sizeof(st->buf)) {
+                chachaKeystream4(&st->chacha, out);
+                out += sizeof(st->buf);
+                len -= sizeof(st->buf);
+                continue;
+            }
+
+            chachaKeystream4(&st->chacha, st->buf);
+            st->pos = 0;
+        }
+
+        size_t n = sizeof(st->buf) - st->pos;
+        if (n > len)
+            n = len;
+
+        // Consumed keystream is wiped so it can't be recovered later.
+        memcpy(out, &st->buf[st->pos], n);
+        memset(&st->buf[st->pos], 0, n);
+        st->pos += n;
+        out += n;
+        len -= n;
+    }
 }
 
 u64 randomGet64(void)
 {
+    RandomThreadState* st = &g_randThread;
     u64 tmp;
+
+    if (st->init && st->pos + sizeof(tmp) <= sizeof(st->buf)) {
+        memcpy(&tmp, &st->buf[st->pos], sizeof(tmp));
+        memset(&st->buf[st->pos], 0, sizeof(tmp));
+        st->pos += sizeof(tmp);
+        return tmp;
+    }
+
     randomGet(&tmp, sizeof(tmp));
     return tmp;
 }
@@ -1,38 +1,43 @@
 // Copyright 2018 Kevoot
+#include "result.h"
 #include "kernel/semaphore.h"
 #include "kernel/svc.h"
 
 void semaphoreInit(Semaphore *s, u64 initial_count) {
-    s->count = initial_count;
-    mutexInit(&s->mutex);
-    condvarInit(&s->condvar);
+    s->count = initial_count > UINT32_MAX ? UINT32_MAX : (u32)initial_count;
+    s->num_waiters = 0;
 }
 
 void semaphoreSignal(Semaphore *s) {
-    mutexLock(&s->mutex);
-    s->count++;
-    condvarWakeOne(&s->condvar);
-    mutexUnlock(&s->mutex);
+    __atomic_add_fetch(&s->count, 1, __ATOMIC_SEQ_CST);
+
+    // Pairs with the waiter registering itself before it checks the counter in the kernel.
+    if (__atomic_load_n(&s->num_waiters, __ATOMIC_SEQ_CST))
+        svcSignalToAddress(&s->count, SignalType_Signal, 0, 1);
 }
 
-void semaphoreWait(Semaphore *s) {
-    mutexLock(&s->mutex);
-    // Wait until signalled.
-    while (!s->count) {
-        condvarWait(&s->condvar, &s->mutex);
+bool semaphoreTryWait(Semaphore *s) {
+    u32 val = __atomic_load_n(&s->count, __ATOMIC_RELAXED);
+
+    while (val) {
+        if (__atomic_compare_exchange_n(&s->count, &val, val - 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return true;
     }
-    s->count--;
-    mutexUnlock(&s->mutex);
+
+    return false;
 }
 
-bool semaphoreTryWait(Semaphore *s) {
-    mutexLock(&s->mutex);
-    bool success = false;
-    // Check and immediately return success.
-    if (s->count) {
-        s->count--;
-        success = true;
+void semaphoreWait(Semaphore *s) {
+    while (!semaphoreTryWait(s)) {
+        __atomic_add_fetch(&s->num_waiters, 1, __ATOMIC_SEQ_CST);
+        // The kernel reads the value with a plain load; make sure the registration is visible first.
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+        // Sleeps unless the counter became nonzero in the meantime (InvalidState).
+        Result rc = svcWaitForAddress(&s->count, ArbitrationType_WaitIfEqual, 0, -1);
+        if (R_FAILED(rc) && R_VALUE(rc) != KERNELRESULT(InvalidState))
+            svcBreak(BreakReason_Assert, 0, 0); // should not happen
+
+        __atomic_sub_fetch(&s->num_waiters, 1, __ATOMIC_RELAXED);
     }
-    mutexUnlock(&s->mutex);
-    return success;
 }
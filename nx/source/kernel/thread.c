@@ -24,6 +24,29 @@ static Thread g_mainThread;
 static u64 g_tlsUsageMask;
 static void (* g_tlsDestructors[NUM_TLS_SLOTS])(void*);
 
+#define STACK_POOL_NUM_CLASSES 8
+
+/// Maximum number of stack mappings kept around by \ref threadClose for reuse. Set to 0 to disable the pool.
+__attribute__((weak)) u32 __nx_thread_stack_pool_max_entries = 8;
+/// Maximum total size of the stack mappings kept around by \ref threadClose for reuse.
+__attribute__((weak)) size_t __nx_thread_stack_pool_max_size = 0x400000;
+
+// Stored at the start of the (still mapped) stack mirror of a pooled stack.
+typedef struct StackPoolEntry {
+    struct StackPoolEntry* next;
+    void* stack_mem;
+} StackPoolEntry;
+
+typedef struct {
+    size_t size;
+    StackPoolEntry* head;
+    u32 count;
+} StackPoolClass;
+
+static Mutex g_stackPoolMutex;
+static StackPoolClass g_stackPoolClasses[STACK_POOL_NUM_CLASSES];
+static ThreadStackPoolStats g_stackPoolStats;
+
 // Thread creation args; keep this struct's size 16-byte aligned
 typedef struct {
     Thread*        t;
@@ -85,6 +108,74 @@ void __libnx_init_thread(void) {
     getThreadVars()->thread_ptr = &g_mainThread;
 }
 
+static bool _stackPoolTake(size_t size, void** stack_mem_out, void** stack_mirror_out)
+{
+    StackPoolEntry* e = NULL;
+
+    mutexLock(&g_stackPoolMutex);
+    for (u32 i = 0; i < STACK_POOL_NUM_CLASSES; i ++) {
+        StackPoolClass* c = &g_stackPoolClasses[i];
+        if (c->size == size && c->head) {
+            e = c->head;
+            c->head = e->next;
+            c->count --;
+            g_stackPoolStats.num_cached --;
+            g_stackPoolStats.cached_size -= size;
+            break;
+        }
+    }
+
+    if (e)
+        g_stackPoolStats.hits ++;
+    else
+        g_stackPoolStats.misses ++;
+    mutexUnlock(&g_stackPoolMutex);
+
+    if (!e)
+        return false;
+
+    *stack_mem_out = e->stack_mem;
+    *stack_mirror_out = e;
+    return true;
+}
+
+static bool _stackPoolPut(size_t size, void* stack_mem, void* stack_mirror)
+{
+    bool ret = false;
+
+    mutexLock(&g_stackPoolMutex);
+    if (g_stackPoolStats.num_cached < __nx_thread_stack_pool_max_entries &&
+        g_stackPoolStats.cached_size + size <= __nx_thread_stack_pool_max_size) {
+
+        // Use the class for this size, or claim an empty one.
+        StackPoolClass* c = NULL;
+        for (u32 i = 0; i < STACK_POOL_NUM_CLASSES; i ++) {
+            StackPoolClass* cur = &g_stackPoolClasses[i];
+            if (cur->size == size) {
+                c = cur;
+                break;
+            }
+            if (!c && !cur->count)
+                c = cur;
+        }
+
+        if (c) {
+            StackPoolEntry* e = (StackPoolEntry*)stack_mirror;
+            e->stack_mem = stack_mem;
+            e->next = c->head;
+            c->head = e;
+            c->size = size;
+            c->count ++;
+            g_stackPoolStats.num_cached ++;
+            g_stackPoolStats.cached_size += size;
+            ret = true;
+        }
+    }
+    mutexUnlock(&g_stackPoolMutex);
+
+    return ret;
+}
+
 Result threadCreate(
     Thread* t, ThreadFunc entry, void* arg, void* stack_mem, size_t stack_sz,
     int prio, int cpuid)
@@ -98,9 +189,13 @@ Result threadCreate(
     }
 
     bool owns_stack_mem;
+    void* stack_mirror = NULL;
     if (stack_mem == NULL) {
-        // Allocate new memory for the stack, tls and reent.
-        stack_mem = __libnx_aligned_alloc(0x1000, stack_sz + tls_sz + reent_sz);
+        // Reuse an already mapped stack if one of the right size is available,
+        // otherwise allocate new memory for the stack, tls and reent.
+        const size_t aligned_stack_sz = (stack_sz + tls_sz + reent_sz + 0xFFF) & ~0xFFF;
+        if (!_stackPoolTake(aligned_stack_sz, &stack_mem, &stack_mirror))
+            stack_mem = __libnx_aligned_alloc(0x1000, stack_sz + tls_sz + reent_sz);
 
         owns_stack_mem = true;
     } else {
@@ -126,11 +221,14 @@ Result threadCreate(
     }
 
     // Total allocation size may be unaligned in either case.
-    virtmemLock();
     const size_t aligned_stack_sz = (stack_sz + tls_sz + reent_sz + 0xFFF) & ~0xFFF;
-    void* stack_mirror = virtmemFindStack(aligned_stack_sz, 0x4000);
-    Result rc = svcMapMemory(stack_mirror, stack_mem, aligned_stack_sz);
-    virtmemUnlock();
+    Result rc = 0;
+    if (!stack_mirror) {
+        virtmemLock();
+        stack_mirror = virtmemFindStack(aligned_stack_sz, 0x4000);
+        rc = svcMapMemory(stack_mirror, stack_mem, aligned_stack_sz);
+        virtmemUnlock();
+    }
 
     if (R_SUCCEEDED(rc))
     {
@@ -181,6 +279,10 @@ Result threadCreate(
         }
 
         if (R_FAILED(rc)) {
+            // Hand the mapping back to the pool if possible, in which case the memory must not be freed.
+            if (owns_stack_mem && _stackPoolPut(aligned_stack_sz, stack_mem, stack_mirror))
+                return rc;
+
             svcUnmapMemory(stack_mirror, stack_mem, aligned_stack_sz);
         }
     }
@@ -220,6 +322,7 @@ void threadExit(void) {
     t->prev_next = NULL;
     mutexUnlock(&g_threadMutex);
 
+    __libnx_pool_thread_exit();
     svcExitThread();
 }
 
@@ -241,6 +344,12 @@ Result threadClose(Thread* t) {
     const size_t reent_sz = (sizeof(struct _reent)+0xF) &~ 0xF;
     const size_t aligned_stack_sz = (t->stack_sz + sizeof(ThreadEntryArgs) + tls_sz + reent_sz + 0xFFF) & ~0xFFF;
 
+    // Keep the mapping of automatically allocated stacks around for the next thread of the same size.
+    if (t->owns_stack_mem && _stackPoolPut(aligned_stack_sz, t->stack_mem, t->stack_mirror)) {
+        svcCloseHandle(t->handle);
+        return 0;
+    }
+
     rc = svcUnmapMemory(t->stack_mirror, t->stack_mem, aligned_stack_sz);
 
     if (R_SUCCEEDED(rc)) {
@@ -253,6 +362,31 @@ Result threadClose(Thread* t) {
     return rc;
 }
 
+void threadStackPoolFlush(void) {
+    mutexLock(&g_stackPoolMutex);
+    for (u32 i = 0; i < STACK_POOL_NUM_CLASSES; i ++) {
+        StackPoolClass* c = &g_stackPoolClasses[i];
+        while (c->head) {
+            StackPoolEntry* e = c->head;
+            c->head = e->next;
+
+            void* stack_mem = e->stack_mem;
+            if (R_SUCCEEDED(svcUnmapMemory(e, stack_mem, c->size)))
+                __libnx_free(stack_mem);
+        }
+        c->count = 0;
+    }
+    g_stackPoolStats.num_cached = 0;
+    g_stackPoolStats.cached_size = 0;
+    mutexUnlock(&g_stackPoolMutex);
+}
+
+void threadGetStackPoolStats(ThreadStackPoolStats* out) {
+    mutexLock(&g_stackPoolMutex);
+    *out = g_stackPoolStats;
+    mutexUnlock(&g_stackPoolMutex);
+}
+
 Result threadPause(Thread* t) {
     return svcSetThreadActivity(t->handle, ThreadActivity_Paused);
 }
@@ -0,0 +1,315 @@
+#include <string.h>
+#include "result.h"
+#include "arm/counter.h"
+#include "kernel/svc.h"
+#include "kernel/timerwheel.h"
+#include "wait.h"
+
+#define TIMERWHEEL_LEVEL_OVERFLOW TIMERWHEEL_LEVELS
+#define TIMERWHEEL_LEVEL_EXPIRED  (TIMERWHEEL_LEVELS+1)
+
+static bool _timerWheelBeginWait(Waitable* ww, WaiterNode* w, u64 cur_tick, u64* next_tick);
+static Result _timerWheelOnTimeout(Waitable* ww, u64 old_tick);
+static Result _timerWheelOnSignal(Waitable* ww);
+
+static const WaitableMethods g_timerWheelVt = {
+    .beginWait = _timerWheelBeginWait,
+    .onTimeout = _timerWheelOnTimeout,
+    .onSignal = _timerWheelOnSignal,
+};
+
+static inline u64 _timerWheelLevelMask(u32 level)
+{
+    return BITL(TIMERWHEEL_LEVEL_BITS*level) - 1;
+}
+
+static void _timerWheelLink(TimerWheelEntry** head, TimerWheelEntry* e)
+{
+    e->next = *head;
+    if (e->next)
+        e->next->pprev = &e->next;
+    e->pprev = head;
+    *head = e;
+}
+
+static void _timerWheelUnlink(TimerWheel* w, TimerWheelEntry* e)
+{
+    *e->pprev = e->next;
+    if (e->next)
+        e->next->pprev = e->pprev;
+
+    if (e->level < TIMERWHEEL_LEVELS && !w->slots[e->level][e->slot])
+        w->occupied[e->level] &= ~BITL(e->slot);
+
+    e->next = NULL;
+    e->pprev = NULL;
+}
+
+static void _timerWheelPlace(TimerWheel* w, TimerWheelEntry* e)
+{
+    if (e->expires < w->cur)
+        e->expires = w->cur;
+
+    u64 delta = e->expires - w->cur;
+
+    for (u32 level = 0; level < TIMERWHEEL_LEVELS; level ++) {
+        if (delta <= _timerWheelLevelMask(level+1)) {
+            u32 slot = (e->expires >> (TIMERWHEEL_LEVEL_BITS*level)) & (TIMERWHEEL_SLOTS-1);
+            e->level = level;
+            e->slot = slot;
+            _timerWheelLink(&w->slots[level][slot], e);
+            w->occupied[level] |= BITL(slot);
+            return;
+        }
+    }
+
+    // Too far in the future: parked until the top level wraps around.
+    e->level = TIMERWHEEL_LEVEL_OVERFLOW;
+    e->slot = 0;
+    _timerWheelLink(&w->overflow, e);
+}
+
+static void _timerWheelRelink(TimerWheel* w, TimerWheelEntry* list)
+{
+    while (list) {
+        TimerWheelEntry* e = list;
+        list = e->next;
+        _timerWheelPlace(w, e);
+    }
+}
+
+// Returns the next unit (>= cur) at which processing the wheel has any effect.
+static u64 _timerWheelNextUnit(TimerWheel* w)
+{
+    u64 next = UINT64_MAX;
+
+    for (u32 level = 0; level < TIMERWHEEL_LEVELS; level ++) {
+        u64 occupied = w->occupied[level];
+        if (!occupied)
+            continue;
+
+        u32 shift = TIMERWHEEL_LEVEL_BITS*level;
+        u64 block = w->cur >> shift;
+        u32 idx = block & (TIMERWHEEL_SLOTS-1);
+        u64 rot = idx ? (occupied >> idx) | (occupied << (TIMERWHEEL_SLOTS - idx)) : occupied;
+
+        // Unless we are exactly at the start of a block, the current slot has already
+        // been cascaded and only holds timers for the next time around.
+        if (w->cur & _timerWheelLevelMask(level))
+            rot &= ~1UL;
+
+        u64 rel = rot ? __builtin_ctzll(rot) : TIMERWHEEL_SLOTS;
+        u64 unit = (block + rel) << shift;
+        if (unit < next)
+            next = unit;
+    }
+
+    if (w->overflow) {
+        u32 shift = TIMERWHEEL_LEVEL_BITS*TIMERWHEEL_LEVELS;
+        u64 unit = (w->cur & _timerWheelLevelMask(TIMERWHEEL_LEVELS)) ? ((w->cur >> shift) + 1) << shift : w->cur;
+        if (unit < next)
+            next = unit;
+    }
+
+    return next;
+}
+
+static void _timerWheelProcessUnit(TimerWheel* w)
+{
+    // Cascade timers from the levels whose block starts at this unit.
+    for (u32 level = TIMERWHEEL_LEVELS; level > 0; level --) {
+        if (w->cur & _timerWheelLevelMask(level))
+            continue;
+
+        TimerWheelEntry* list;
+        if (level == TIMERWHEEL_LEVELS) {
+            list = w->overflow;
+            w->overflow = NULL;
+        } else {
+            u32 slot = (w->cur >> (TIMERWHEEL_LEVEL_BITS*level)) & (TIMERWHEEL_SLOTS-1);
+            list = w->slots[level][slot];
+            w->slots[level][slot] = NULL;
+            w->occupied[level] &= ~BITL(slot);
+        }
+
+        _timerWheelRelink(w, list);
+    }
+
+    // Move the timers expiring at this unit to the expired list.
+    u32 slot = w->cur & (TIMERWHEEL_SLOTS-1);
+    TimerWheelEntry* list = w->slots[0][slot];
+    w->slots[0][slot] = NULL;
+    w->occupied[0] &= ~BITL(slot);
+
+    while (list) {
+        TimerWheelEntry* e = list;
+        list = e->next;
+        e->level = TIMERWHEEL_LEVEL_EXPIRED;
+        _timerWheelLink(&w->expired, e);
+    }
+
+    w->cur ++;
+}
+
+static void _timerWheelAdvance(TimerWheel* w, u64 cur_tick)
+{
+    u64 now = (cur_tick - w->base_tick) / w->resolution;
+
+    // Skip straight over stretches of units in which nothing happens.
+    while (w->cur <= now) {
+        u64 next = _timerWheelNextUnit(w);
+        if (next > now) {
+            w->cur = now + 1;
+            break;
+        }
+
+        w->cur = next;
+        _timerWheelProcessUnit(w);
+    }
+}
+
+static void _timerWheelSchedule(TimerWheel* w, TimerWheelEntry* e)
+{
+    _timerWheelPlace(w, e);
+
+    // Only wake up the listeners if they would otherwise sleep past this timer.
+    if (e->expires < w->wake_unit) {
+        w->wake_unit = e->expires;
+        _waitableSignalAllListeners(&w->waitable);
+    }
+}
+
+void timerWheelCreate(TimerWheel* w, u64 resolution)
+{
+    memset(w, 0, sizeof(*w));
+    _waitableInitialize(&w->waitable, &g_timerWheelVt);
+
+    w->resolution = armNsToTicks(resolution);
+    if (!w->resolution)
+        w->resolution = 1;
+
+    w->base_tick = armGetSystemTick();
+    w->cur = 0;
+    w->wake_unit = UINT64_MAX;
+}
+
+void timerWheelAdd(TimerWheel* w, TimerWheelEntry* e, u64 interval, TimerType type, TimerWheelFunc func, void* userdata)
+{
+    mutexLock(&w->waitable.mutex);
+
+    if (e->active)
+        _timerWheelUnlink(w, e);
+
+    u64 ticks = armNsToTicks(interval);
+    u64 cur_tick = armGetSystemTick();
+
+    e->func = func;
+    e->userdata = userdata;
+    e->type = type;
+    e->interval = (ticks + w->resolution - 1) / w->resolution;
+    if (!e->interval)
+        e->interval = 1;
+    e->expires = (cur_tick - w->base_tick + ticks + w->resolution - 1) / w->resolution;
+    e->active = true;
+
+    _timerWheelSchedule(w, e);
+
+    mutexUnlock(&w->waitable.mutex);
+}
+
+void timerWheelCancel(TimerWheel* w, TimerWheelEntry* e)
+{
+    mutexLock(&w->waitable.mutex);
+
+    if (e->active) {
+        _timerWheelUnlink(w, e);
+        e->active = false;
+    }
+
+    mutexUnlock(&w->waitable.mutex);
+}
+
+u32 timerWheelDispatch(TimerWheel* w)
+{
+    u32 count = 0;
+    mutexLock(&w->waitable.mutex);
+
+    _timerWheelAdvance(w, armGetSystemTick());
+
+    while (w->expired) {
+        TimerWheelEntry* e = w->expired;
+        _timerWheelUnlink(w, e);
+
+        switch (e->type) {
+            case TimerType_OneShot:
+                e->active = false;
+                break;
+            case TimerType_Repeating: {
+                // Skip the periods that were missed.
+                u64 next = e->expires + e->interval;
+                if (next < w->cur)
+                    next += ((w->cur - next + e->interval - 1) / e->interval) * e->interval;
+                e->expires = next;
+                _timerWheelSchedule(w, e);
+                break;
+            }
+        }
+
+        TimerWheelFunc func = e->func;
+        void* userdata = e->userdata;
+
+        mutexUnlock(&w->waitable.mutex);
+        if (func)
+            func(e, userdata);
+        count ++;
+        mutexLock(&w->waitable.mutex);
+    }
+
+    mutexUnlock(&w->waitable.mutex);
+    return count;
+}
+
+static bool _timerWheelBeginWait(Waitable* ww, WaiterNode* w, u64 cur_tick, u64* next_tick)
+{
+    TimerWheel* t = (TimerWheel*)ww;
+    mutexLock(&t->waitable.mutex);
+
+    _timerWheelAdvance(t, cur_tick);
+
+    // If a timer has already expired, we're done.
+    bool do_wait = !t->expired;
+
+    if (do_wait) {
+        u64 unit = _timerWheelNextUnit(t);
+        t->wake_unit = unit;
+
+        if (unit != UINT64_MAX) {
+            u64 tick = t->base_tick + unit * t->resolution;
+            *next_tick = tick > cur_tick ? tick - cur_tick : 0;
+        }
+
+        _waiterNodeAdd(w);
+    }
+
+    mutexUnlock(&t->waitable.mutex);
+    return do_wait;
+}
+
+static Result _timerWheelOnTimeout(Waitable* ww, u64 old_tick)
+{
+    TimerWheel* t = (TimerWheel*)ww;
+    mutexLock(&t->waitable.mutex);
+
+    // The deadline may have only been a cascade point, in which case nothing expired yet.
+    _timerWheelAdvance(t, armGetSystemTick());
+    Result rc = t->expired ? 0 : KERNELRESULT(Cancelled);
+
+    mutexUnlock(&t->waitable.mutex);
+    return rc;
+}
+
+static Result _timerWheelOnSignal(Waitable* ww)
+{
+    // An earlier timer was scheduled, so we need to retry the wait.
+    return KERNELRESULT(Cancelled);
+}
@@ -1,3 +1,4 @@
+#include <string.h>
 #include "types.h"
 #include "result.h"
 #include "kernel/mutex.h"
@@ -9,18 +10,35 @@
 
 #define SEQUENTIAL_GUARD_REGION_SIZE 0x1000
 #define RANDOM_MAX_ATTEMPTS 0x200
+#define FREE_CACHE_MAX_AGE 0x40
+#define FREE_CACHE_INITIAL_CAPACITY 0x40
 
 typedef struct {
     uintptr_t start;
     uintptr_t end;
 } MemRegion;
 
+// Reservations are kept in an AVL tree ordered by start address, where each node
+// additionally tracks the largest end address within its subtree (interval tree).
 struct VirtmemReservation {
-    VirtmemReservation *next;
-    VirtmemReservation *prev;
+    VirtmemReservation *left;
+    VirtmemReservation *right;
     MemRegion region;
+    uintptr_t max_end;
+    int height;
 };
 
+// Sorted list of the unmapped ranges of a memory region that are outside of the alias/heap
+// regions and reservations. It is only a hint: it is refreshed from svcQueryMemory lazily,
+// and every address picked from it is still validated before being handed out.
+typedef struct {
+    MemRegion* ranges;
+    u32 count;
+    u32 capacity;
+    u32 age;
+    bool valid;
+} MemRegionFreeCache;
+
 static Mutex g_VirtmemMutex;
 
 static MemRegion g_AliasRegion;
@@ -30,6 +48,9 @@ static MemRegion g_StackRegion;
 
 static VirtmemReservation *g_Reservations;
 
+static MemRegionFreeCache g_AslrFreeCache;
+static MemRegionFreeCache g_StackFreeCache;
+
 static bool g_IsLegacyKernel;
 
 uintptr_t __attribute__((weak)) __libnx_virtmem_rng(void) {
@@ -93,18 +114,324 @@ NX_INLINE bool _memregionIsReserved(uintptr_t start, uintptr_t end, uintptr_t gu
     start -= guard;
     end += guard;
 
-    // Go through each reservation and check if any of them overlap the desired address range.
-    for (VirtmemReservation *rv = g_Reservations; rv; rv = rv->next) {
+    // Descend the reservation tree looking for any reservation overlapping the desired address range.
+    // If the left subtree reaches past the start of the range but contains no overlap, then neither does
+    // the right subtree (all of its reservations start after the end of the range).
+    for (VirtmemReservation *rv = g_Reservations; rv; ) {
         if (_memregionOverlaps(&rv->region, start, end)) {
             if (out_end) *out_end = rv->region.end + guard;
             return true;
         }
+
+        if (rv->left && rv->left->max_end > start)
+            rv = rv->left;
+        else
+            rv = rv->right;
     }
 
     return false;
 }
 
-static void* _memregionFindRandom(MemRegion* r, size_t size, size_t guard_size) {
+NX_INLINE int _reservationHeight(VirtmemReservation* rv) {
+    return rv ? rv->height : 0;
+}
+
+static void _reservationUpdate(VirtmemReservation* rv) {
+    int hl = _reservationHeight(rv->left);
+    int hr = _reservationHeight(rv->right);
+    rv->height = (hl > hr ? hl : hr) + 1;
+
+    rv->max_end = rv->region.end;
+    if (rv->left && rv->left->max_end > rv->max_end)
+        rv->max_end = rv->left->max_end;
+    if (rv->right && rv->right->max_end > rv->max_end)
+        rv->max_end = rv->right->max_end;
+}
+
+static VirtmemReservation* _reservationRotateRight(VirtmemReservation* rv) {
+    VirtmemReservation* l = rv->left;
+    rv->left = l->right;
+    l->right = rv;
+    _reservationUpdate(rv);
+    _reservationUpdate(l);
+    return l;
+}
+
+static VirtmemReservation* _reservationRotateLeft(VirtmemReservation* rv) {
+    VirtmemReservation* r = rv->right;
+    rv->right = r->left;
+    r->left = rv;
+    _reservationUpdate(rv);
+    _reservationUpdate(r);
+    return r;
+}
+
+static VirtmemReservation* _reservationBalance(VirtmemReservation* rv) {
+    _reservationUpdate(rv);
+
+    int balance = _reservationHeight(rv->left) - _reservationHeight(rv->right);
+    if (balance > 1) {
+        if (_reservationHeight(rv->left->left) < _reservationHeight(rv->left->right))
+            rv->left = _reservationRotateLeft(rv->left);
+        return _reservationRotateRight(rv);
+    }
+    if (balance < -1) {
+        if (_reservationHeight(rv->right->right) < _reservationHeight(rv->right->left))
+            rv->right = _reservationRotateRight(rv->right);
+        return _reservationRotateLeft(rv);
+    }
+
+    return rv;
+}
+
+NX_INLINE bool _reservationLess(VirtmemReservation* a, VirtmemReservation* b) {
+    // Reservations starting at the same address are ordered by object address.
+    if (a->region.start != b->region.start)
+        return a->region.start < b->region.start;
+    return (uintptr_t)a < (uintptr_t)b;
+}
+
+static VirtmemReservation* _reservationInsert(VirtmemReservation* root, VirtmemReservation* rv) {
+    if (!root) {
+        rv->left = NULL;
+        rv->right = NULL;
+        _reservationUpdate(rv);
+        return rv;
+    }
+
+    if (_reservationLess(rv, root))
+        root->left = _reservationInsert(root->left, rv);
+    else
+        root->right = _reservationInsert(root->right, rv);
+
+    return _reservationBalance(root);
+}
+
+static VirtmemReservation* _reservationRemoveMin(VirtmemReservation* root, VirtmemReservation** out_min) {
+    if (!root->left) {
+        *out_min = root;
+        return root->right;
+    }
+
+    root->left = _reservationRemoveMin(root->left, out_min);
+    return _reservationBalance(root);
+}
+
+static VirtmemReservation* _reservationRemove(VirtmemReservation* root, VirtmemReservation* rv) {
+    if (!root)
+        return NULL;
+
+    if (root == rv) {
+        if (!rv->left)
+            return rv->right;
+        if (!rv->right)
+            return rv->left;
+
+        VirtmemReservation* successor;
+        VirtmemReservation* right = _reservationRemoveMin(rv->right, &successor);
+        successor->left = rv->left;
+        successor->right = right;
+        return _reservationBalance(successor);
+    }
+
+    if (_reservationLess(rv, root))
+        root->left = _reservationRemove(root->left, rv);
+    else
+        root->right = _reservationRemove(root->right, rv);
+
+    return _reservationBalance(root);
+}
+
+static bool _freecacheInsertAt(MemRegionFreeCache* c, u32 pos, uintptr_t start, uintptr_t end) {
+    if (c->count == c->capacity) {
+        u32 new_capacity = c->capacity ? 2*c->capacity : FREE_CACHE_INITIAL_CAPACITY;
+        MemRegion* new_ranges = (MemRegion*)__libnx_alloc(new_capacity * sizeof(MemRegion));
+        if (!new_ranges)
+            return false;
+
+        if (c->ranges) {
+            memcpy(new_ranges, c->ranges, c->count * sizeof(MemRegion));
+            __libnx_free(c->ranges);
+        }
+
+        c->ranges = new_ranges;
+        c->capacity = new_capacity;
+    }
+
+    memmove(&c->ranges[pos+1], &c->ranges[pos], (c->count - pos) * sizeof(MemRegion));
+    c->ranges[pos].start = start;
+    c->ranges[pos].end = end;
+    c->count ++;
+    return true;
+}
+
+static void _freecacheCarve(MemRegionFreeCache* c, uintptr_t start, uintptr_t end) {
+    if (!c->valid)
+        return;
+
+    start &= ~0xFFF;
+    end = (end + 0xFFF) &~ 0xFFF;
+
+    // Find the first range ending past the start of the carved area.
+    u32 lo = 0, hi = c->count;
+    while (lo < hi) {
+        u32 mid = (lo + hi) / 2;
+        if (c->ranges[mid].end <= start)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    for (u32 i = lo; i < c->count && c->ranges[i].start < end; ) {
+        MemRegion* fr = &c->ranges[i];
+
+        if (fr->start < start && fr->end > end) {
+            // Split the range in two.
+            uintptr_t old_end = fr->end;
+            fr->end = start;
+            if (!_freecacheInsertAt(c, i+1, end, old_end))
+                c->valid = false;
+            return;
+        }
+
+        if (fr->start < start)
+            fr->end = start;
+        else if (fr->end > end)
+            fr->start = end;
+        else {
+            memmove(fr, fr+1, (c->count - i - 1) * sizeof(MemRegion));
+            c->count --;
+            continue;
+        }
+
+        i ++;
+    }
+}
+
+static void _freecacheCarveReservations(MemRegionFreeCache* c, VirtmemReservation* rv) {
+    for (; rv; rv = rv->right) {
+        _freecacheCarveReservations(c, rv->left);
+        _freecacheCarve(c, rv->region.start, rv->region.end);
+    }
+}
+
+static bool _freecacheRefresh(MemRegionFreeCache* c, MemRegion* r) {
+    c->count = 0;
+    c->age = 0;
+    c->valid = true;
+
+    // Collect the unmapped ranges overlapping the memory region.
+    uintptr_t addr = r->start;
+    while (addr < r->end) {
+        MemoryInfo meminfo;
+        u32 pageinfo;
+        Result rc = svcQueryMemory(&meminfo, &pageinfo, addr);
+        if (R_FAILED(rc))
+            diagAbortWithResult(MAKERESULT(Module_Libnx, LibnxError_BadQueryMemory));
+
+        // The last block of the address space may wrap around.
+        uintptr_t memend = meminfo.addr + meminfo.size;
+        if (memend <= addr)
+            memend = UINTPTR_MAX &~ 0xFFF;
+
+        if (meminfo.type == MemType_Unmapped) {
+            // Merge with the previous range if they are adjacent.
+            if (c->count && c->ranges[c->count-1].end == meminfo.addr)
+                c->ranges[c->count-1].end = memend;
+            else if (!_freecacheInsertAt(c, c->count, meminfo.addr, memend)) {
+                c->valid = false;
+                return false;
+            }
+        }
+
+        addr = memend;
+    }
+
+    // Remove the areas we must never hand out.
+    _freecacheCarve(c, g_AliasRegion.start, g_AliasRegion.end);
+    _freecacheCarve(c, g_HeapRegion.start, g_HeapRegion.end);
+    _freecacheCarveReservations(c, g_Reservations);
+
+    return c->valid;
+}
+
+static void* _memregionFindRandomCached(MemRegion* r, MemRegionFreeCache* c, size_t size, size_t guard_size, bool* out_ok) {
+    *out_ok = true;
+
+    for (;;) {
+        bool fresh = false;
+        if (!c->valid || c->age >= FREE_CACHE_MAX_AGE) {
+            if (!_freecacheRefresh(c, r)) {
+                *out_ok = false;
+                return NULL;
+            }
+            fresh = true;
+        }
+
+        // Count the suitable page-aligned addresses: the slice and its guard areas must fit inside
+        // a free range, and the slice itself must lie within the memory region.
+        u64 total = 0;
+        for (u32 i = 0; i < c->count; i ++) {
+            MemRegion* fr = &c->ranges[i];
+            if (fr->end - fr->start < size + 2*guard_size)
+                continue;
+
+            uintptr_t lo = fr->start + guard_size;
+            uintptr_t hi = fr->end - guard_size;
+            if (lo < r->start) lo = r->start;
+            if (hi > r->end) hi = r->end;
+            if (hi >= lo && hi - lo >= size)
+                total += ((hi - lo - size) >> 12) + 1;
+        }
+
+        if (!total) {
+            // The cache may be missing ranges that have been unmapped since it was built.
+            if (fresh)
+                return NULL;
+            c->valid = false;
+            continue;
+        }
+
+        // Pick one of them uniformly at random.
+        u64 page = __libnx_virtmem_rng() % total;
+        uintptr_t cur_addr = 0;
+        for (u32 i = 0; i < c->count; i ++) {
+            MemRegion* fr = &c->ranges[i];
+            if (fr->end - fr->start < size + 2*guard_size)
+                continue;
+
+            uintptr_t lo = fr->start + guard_size;
+            uintptr_t hi = fr->end - guard_size;
+            if (lo < r->start) lo = r->start;
+            if (hi > r->end) hi = r->end;
+            if (hi < lo || hi - lo < size)
+                continue;
+
+            u64 num_pages = ((hi - lo - size) >> 12) + 1;
+            if (page < num_pages) {
+                cur_addr = lo + (page << 12);
+                break;
+            }
+            page -= num_pages;
+        }
+
+        // Validate the address in case something was mapped behind our back.
+        if (_memregionIsMapped(cur_addr, cur_addr + size, guard_size, NULL) ||
+            _memregionIsReserved(cur_addr, cur_addr + size, guard_size, NULL)) {
+            if (fresh)
+                return NULL;
+            c->valid = false;
+            continue;
+        }
+
+        // The caller is about to map this slice.
+        _freecacheCarve(c, cur_addr, cur_addr + size);
+        c->age ++;
+        return (void*)cur_addr;
+    }
+}
+
+static void* _memregionFindRandom(MemRegion* r, MemRegionFreeCache* c, size_t size, size_t guard_size) {
     // Page align the sizes.
     size = (size + 0xFFF) &~ 0xFFF;
     guard_size = (guard_size + 0xFFF) &~ 0xFFF;
@@ -114,7 +441,13 @@ static void* _memregionFindRandom(MemRegion* r, size_t size, size_t guard_size)
     if (size > region_size)
         return NULL;
 
-    // Main allocation loop.
+    // Pick from the free range cache if possible.
+    bool cache_ok;
+    void* addr = _memregionFindRandomCached(r, c, size, guard_size, &cache_ok);
+    if (cache_ok)
+        return addr;
+
+    // Otherwise fall back to probing random addresses.
     uintptr_t aslr_max_page_offset = (region_size - size) >> 12;
     for (unsigned i = 0; i < RANDOM_MAX_ATTEMPTS; i ++) {
         // Calculate a random memory range outside reserved areas.
@@ -215,42 +548,42 @@ void virtmemUnlock(void) {
 
 void* virtmemFindAslr(size_t size, size_t guard_size) {
     if (!mutexIsLockedByCurrentThread(&g_VirtmemMutex)) return NULL;
-    return _memregionFindRandom(&g_AslrRegion, size, guard_size);
+    return _memregionFindRandom(&g_AslrRegion, &g_AslrFreeCache, size, guard_size);
 }
 
 void* virtmemFindStack(size_t size, size_t guard_size) {
     if (!mutexIsLockedByCurrentThread(&g_VirtmemMutex)) return NULL;
-    return _memregionFindRandom(&g_StackRegion, size, guard_size);
+    return _memregionFindRandom(&g_StackRegion, &g_StackFreeCache, size, guard_size);
 }
 
 void* virtmemFindCodeMemory(size_t size, size_t guard_size) {
     if (!mutexIsLockedByCurrentThread(&g_VirtmemMutex)) return NULL;
     // [1.0.0] requires CodeMemory to be mapped within the stack region.
-    return _memregionFindRandom(g_IsLegacyKernel ? &g_StackRegion : &g_AslrRegion, size, guard_size);
+    if (g_IsLegacyKernel)
+        return _memregionFindRandom(&g_StackRegion, &g_StackFreeCache, size, guard_size);
+    return _memregionFindRandom(&g_AslrRegion, &g_AslrFreeCache, size, guard_size);
 }
 
 VirtmemReservation* virtmemAddReservation(void* mem, size_t size) {
     if (!mutexIsLockedByCurrentThread(&g_VirtmemMutex)) return NULL;
-    VirtmemReservation* rv = (VirtmemReservation*)__libnx_alloc(sizeof(VirtmemReservation));
+    VirtmemReservation* rv = (VirtmemReservation*)__libnx_pool_alloc(sizeof(VirtmemReservation));
     if (rv) {
         rv->region.start = (uintptr_t)mem;
         rv->region.end   = rv->region.start + size;
-        rv->next         = g_Reservations;
-        rv->prev         = NULL;
-        g_Reservations   = rv;
-        if (rv->next)
-            rv->next->prev = rv;
+        g_Reservations   = _reservationInsert(g_Reservations, rv);
+
+        _freecacheCarve(&g_AslrFreeCache, rv->region.start, rv->region.end);
+        _freecacheCarve(&g_StackFreeCache, rv->region.start, rv->region.end);
     }
     return rv;
 }
 
 void virtmemRemoveReservation(VirtmemReservation* rv) {
     if (!mutexIsLockedByCurrentThread(&g_VirtmemMutex)) return;
-    if (rv->next)
-        rv->next->prev = rv->prev;
-    if (rv->prev)
-        rv->prev->next = rv->next;
-    else
-        g_Reservations = rv->next;
-    __libnx_free(rv);
+    g_Reservations = _reservationRemove(g_Reservations, rv);
+    __libnx_pool_free(rv);
+
+    // Let the freed range be picked up again on the next search.
+    g_AslrFreeCache.valid = false;
+    g_StackFreeCache.valid = false;
 }
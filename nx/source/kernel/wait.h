@@ -3,12 +3,14 @@
 #include "kernel/svc.h"
 #include "kernel/mutex.h"
 #include "kernel/wait.h"
+#include "kernel/waitset.h"
 
 typedef struct WaiterNode WaiterNode;
 
 struct WaiterNode {
     WaitableNode node;
     Waitable* parent;
+    WaitSet* set;
     Handle thread;
     s32* idx_out;
     s32 idx;
@@ -20,6 +22,8 @@ struct WaitableMethods {
     Result (* onSignal)(Waitable* ww);
 };
 
+void _waitSetNotify(WaitSet* s, s32 id);
+
 static inline void _waitableInitialize(Waitable* ww, const WaitableMethods* vt)
 {
     mutexInit(&ww->mutex);
@@ -37,6 +41,12 @@ static inline void _waitableSignalAllListeners(Waitable* ww)
         node = node->next;
         WaiterNode* w = (WaiterNode*) node;
 
+        // Listeners registered by a wait set forward the signal to the set instead.
+        if (w->set) {
+            _waitSetNotify(w->set, w->idx);
+            continue;
+        }
+
         // Try to swap -1 => idx on the waiter thread.
         // If another waitable signals simultaneously only one will win the race and insert its own idx.
         s32 minus_one = -1;
@@ -54,6 +64,7 @@ static inline void _waiterNodeInitialize(
 {
     // Initialize WaiterNode fields
     w->parent = parent;
+    w->set = NULL;
     w->thread = thread;
     w->idx = idx;
     w->idx_out = idx_out;
@@ -0,0 +1,594 @@
+#include <string.h>
+#include "result.h"
+#include "arm/counter.h"
+#include "kernel/svc.h"
+#include "kernel/thread.h"
+#include "kernel/waitset.h"
+#include "wait.h"
+#include "../internal.h"
+#include "../runtime/alloc.h"
+
+#define WAITSET_HELPER_STACK_SIZE 0x4000
+
+struct WaitSetEntry {
+    Waiter waiter;
+    WaiterNode node;
+    WaitSetHelper* helper;
+    u64 deadline;
+    Result error;
+    bool in_use;
+    bool armed;
+    bool fired;
+    bool pending;
+};
+
+struct WaitSetHelper {
+    Thread thread;
+    WaitSet* set;
+    s32 ids[MAX_WAIT_OBJECTS];
+    s32 count;
+    bool started;
+    bool exit;
+};
+
+void _waitSetNotify(WaitSet* s, s32 id)
+{
+    __atomic_fetch_or(&s->ready[id/64], 1UL << (id%64), __ATOMIC_SEQ_CST);
+
+    // Kick the waiting thread, if any. If the thread is not yet inside the syscall
+    // the cancellation is remembered by the kernel and the next wait returns immediately.
+    Handle thread = __atomic_load_n(&s->waiting_thread, __ATOMIC_SEQ_CST);
+    if (thread != INVALID_HANDLE)
+        svcCancelSynchronization(thread);
+}
+
+static void _waitSetKick(WaitSet* s)
+{
+    Handle thread = __atomic_load_n(&s->waiting_thread, __ATOMIC_SEQ_CST);
+    if (thread != INVALID_HANDLE)
+        svcCancelSynchronization(thread);
+}
+
+static bool _waitSetHasReady(WaitSet* s)
+{
+    s32 num_words = (s->capacity + 63) / 64;
+    for (s32 i = 0; i < num_words; i ++)
+        if (__atomic_load_n(&s->ready[i], __ATOMIC_SEQ_CST))
+            return true;
+    return false;
+}
+
+static s32 _waitSetPopReady(WaitSet* s)
+{
+    s32 num_words = (s->capacity + 63) / 64;
+    for (s32 i = 0; i < num_words; i ++) {
+        u64 bits = __atomic_load_n(&s->ready[i], __ATOMIC_SEQ_CST);
+        if (bits) {
+            __atomic_fetch_and(&s->ready[i], ~(bits & -bits), __ATOMIC_SEQ_CST);
+            return i*64 + __builtin_ctzll(bits);
+        }
+    }
+    return -1;
+}
+
+static void _waitSetScheduleRearm(WaitSet* s, s32 id)
+{
+    WaitSetEntry* e = &s->entries[id];
+    if (!e->pending) {
+        e->pending = true;
+        s->rearm[s->num_rearm++] = id;
+    }
+}
+
+static void _waitSetArm(WaitSet* s, s32 id, u64 cur_tick)
+{
+    WaitSetEntry* e = &s->entries[id];
+    u64 next_tick = UINT64_MAX;
+
+    switch (e->waiter.type) {
+        case WaiterType_Handle:
+        case WaiterType_HandleWithClear:
+            // Only handles owned by helper threads are ever disarmed.
+            if (e->helper && !e->armed) {
+                e->armed = true;
+                svcCancelSynchronization(e->helper->thread.handle);
+            }
+            break;
+
+        case WaiterType_Waitable:
+            if (e->armed || e->fired)
+                break;
+
+            if (e->waiter.waitable->vt->beginWait(e->waiter.waitable, &e->node, cur_tick, &next_tick)) {
+                e->armed = true;
+                e->deadline = next_tick != UINT64_MAX ? cur_tick + next_tick : UINT64_MAX;
+            } else {
+                // Already signalled; the signal has been consumed by beginWait.
+                e->fired = true;
+                __atomic_fetch_or(&s->ready[id/64], 1UL << (id%64), __ATOMIC_SEQ_CST);
+            }
+            break;
+    }
+}
+
+static void _waitSetDisarm(WaitSetEntry* e)
+{
+    if (e->waiter.type == WaiterType_Waitable && e->armed) {
+        _waiterNodeRemove(&e->node);
+        e->armed = false;
+        e->deadline = UINT64_MAX;
+    }
+}
+
+static void _waitSetRemoveDirect(WaitSet* s, s32 id)
+{
+    for (s32 i = 0; i < s->num_direct; i ++) {
+        if (s->direct_ids[i] == id) {
+            s->num_direct--;
+            s->direct_handles[i] = s->direct_handles[s->num_direct];
+            s->direct_ids[i] = s->direct_ids[s->num_direct];
+            s->direct_gen++;
+            break;
+        }
+    }
+}
+
+static Result _waitSetDeliver(WaitSet* s, s32 id)
+{
+    WaitSetEntry* e = &s->entries[id];
+    Result rc = 0;
+
+    if (!e->in_use)
+        return KERNELRESULT(Cancelled);
+
+    switch (e->waiter.type) {
+        case WaiterType_Handle:
+        case WaiterType_HandleWithClear:
+            // Ready bits for handles are only set after disarming the entry, by helper threads or
+            // for stale direct handles.
+            if (e->armed)
+                return KERNELRESULT(Cancelled);
+
+            // The handle is stale: leave it disarmed, so that it isn't waited on again until it is removed.
+            if (R_FAILED(e->error))
+                return e->error;
+
+            _waitSetScheduleRearm(s, id);
+            if (e->waiter.type == WaiterType_HandleWithClear) {
+                rc = svcResetSignal(e->waiter.handle);
+                if (R_VALUE(rc) == KERNELRESULT(InvalidState))
+                    rc = KERNELRESULT(Cancelled);
+            }
+            break;
+
+        case WaiterType_Waitable:
+            if (e->fired)
+                e->fired = false;
+            else if (e->armed) {
+                _waitSetDisarm(e);
+                rc = e->waiter.waitable->vt->onSignal(e->waiter.waitable);
+            } else
+                return KERNELRESULT(Cancelled);
+
+            _waitSetScheduleRearm(s, id);
+            break;
+    }
+
+    return rc;
+}
+
+static void _waitSetHelperThread(void* arg)
+{
+    WaitSetHelper* h = (WaitSetHelper*)arg;
+    WaitSet* s = h->set;
+    Handle handles[MAX_WAIT_OBJECTS];
+    s32 ids[MAX_WAIT_OBJECTS];
+
+    for (;;) {
+        s32 count = 0;
+
+        mutexLock(&s->mutex);
+        if (h->exit) {
+            mutexUnlock(&s->mutex);
+            break;
+        }
+
+        for (s32 i = 0; i < h->count; i ++) {
+            WaitSetEntry* e = &s->entries[h->ids[i]];
+            if (e->armed) {
+                handles[count] = e->waiter.handle;
+                ids[count++] = h->ids[i];
+            }
+        }
+        mutexUnlock(&s->mutex);
+
+        // The set cancels this wait whenever our list of handles changes.
+        s32 idx;
+        Result rc = svcWaitSynchronization(&idx, handles, count, UINT64_MAX);
+        if (R_VALUE(rc) == KERNELRESULT(Cancelled))
+            continue;
+
+        if (R_FAILED(rc)) {
+            // A handle was closed or is invalid, and would make every wait fail immediately.
+            // Find the culprits, disarm them and report the error to the waiting thread.
+            for (s32 i = 0; i < count; i ++) {
+                Result rc2 = svcWaitSynchronizationSingle(handles[i], 0);
+                if (R_SUCCEEDED(rc2) || R_VALUE(rc2) == KERNELRESULT(TimedOut))
+                    continue;
+
+                mutexLock(&s->mutex);
+                WaitSetEntry* e = &s->entries[ids[i]];
+                bool notify = e->in_use && e->helper == h && e->armed && e->waiter.handle == handles[i];
+                if (notify) {
+                    e->armed = false;
+                    e->error = rc2;
+                }
+                mutexUnlock(&s->mutex);
+
+                if (notify)
+                    _waitSetNotify(s, ids[i]);
+            }
+            continue;
+        }
+
+        // Stop waiting on the handle until the waiting thread has consumed the signal.
+        mutexLock(&s->mutex);
+        WaitSetEntry* e = &s->entries[ids[idx]];
+        bool notify = e->in_use && e->helper == h && e->armed && e->waiter.handle == handles[idx];
+        if (notify)
+            e->armed = false;
+        mutexUnlock(&s->mutex);
+
+        if (notify)
+            _waitSetNotify(s, ids[idx]);
+    }
+}
+
+static Result _waitSetHelperStart(WaitSetHelper* h)
+{
+    s32 prio = 0x2C;
+    svcGetThreadPriority(&prio, CUR_THREAD_HANDLE);
+
+    Result rc = threadCreate(&h->thread, _waitSetHelperThread, h, NULL, WAITSET_HELPER_STACK_SIZE, prio, -2);
+    if (R_SUCCEEDED(rc)) {
+        rc = threadStart(&h->thread);
+        if (R_FAILED(rc))
+            threadClose(&h->thread);
+    }
+
+    if (R_SUCCEEDED(rc))
+        h->started = true;
+
+    return rc;
+}
+
+Result waitSetCreate(WaitSet* s, s32 capacity)
+{
+    if (capacity <= 0)
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    memset(s, 0, sizeof(*s));
+    mutexInit(&s->mutex);
+    s->capacity = capacity;
+    s->waiting_thread = INVALID_HANDLE;
+    s->num_helpers = capacity > MAX_WAIT_OBJECTS ? (capacity - 1) / MAX_WAIT_OBJECTS : 0;
+
+    s->entries = (WaitSetEntry*)__libnx_alloc(capacity * sizeof(WaitSetEntry));
+    s->ready = (u64*)__libnx_alloc(((capacity + 63) / 64) * sizeof(u64));
+    s->rearm = (s32*)__libnx_alloc(capacity * sizeof(s32));
+    if (s->num_helpers)
+        s->helpers = (WaitSetHelper*)__libnx_alloc(s->num_helpers * sizeof(WaitSetHelper));
+
+    // Clear the arrays before anything can fail, since waitSetClose walks them.
+    if (s->entries)
+        memset(s->entries, 0, capacity * sizeof(WaitSetEntry));
+    if (s->ready)
+        memset(s->ready, 0, ((capacity + 63) / 64) * sizeof(u64));
+    if (s->helpers)
+        memset(s->helpers, 0, s->num_helpers * sizeof(WaitSetHelper));
+
+    if (!s->entries || !s->ready || !s->rearm || (s->num_helpers && !s->helpers)) {
+        waitSetClose(s);
+        return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+    }
+
+    for (s32 i = 0; i < s->num_helpers; i ++)
+        s->helpers[i].set = s;
+
+    return 0;
+}
+
+void waitSetClose(WaitSet* s)
+{
+    if (s->helpers) {
+        for (s32 i = 0; i < s->num_helpers; i ++) {
+            WaitSetHelper* h = &s->helpers[i];
+            if (!h->started)
+                continue;
+
+            mutexLock(&s->mutex);
+            h->exit = true;
+            mutexUnlock(&s->mutex);
+
+            svcCancelSynchronization(h->thread.handle);
+            threadWaitForExit(&h->thread);
+            threadClose(&h->thread);
+        }
+    }
+
+    if (s->entries) {
+        for (s32 i = 0; i < s->capacity; i ++)
+            if (s->entries[i].in_use)
+                _waitSetDisarm(&s->entries[i]);
+    }
+
+    __libnx_free(s->helpers);
+    __libnx_free(s->rearm);
+    __libnx_free(s->ready);
+    __libnx_free(s->entries);
+    memset(s, 0, sizeof(*s));
+    s->waiting_thread = INVALID_HANDLE;
+}
+
+Result waitSetAdd(WaitSet* s, Waiter w, s32* id_out)
+{
+    Result rc = 0;
+    s32 id;
+
+    mutexLock(&s->mutex);
+
+    for (id = 0; id < s->capacity; id ++)
+        if (!s->entries[id].in_use)
+            break;
+
+    if (id == s->capacity) {
+        mutexUnlock(&s->mutex);
+        return KERNELRESULT(OutOfRange);
+    }
+
+    WaitSetEntry* e = &s->entries[id];
+    WaitSetHelper* h = NULL;
+
+    switch (w.type) {
+        case WaiterType_Handle:
+        case WaiterType_HandleWithClear:
+            if (s->num_direct < MAX_WAIT_OBJECTS) {
+                s->direct_handles[s->num_direct] = w.handle;
+                s->direct_ids[s->num_direct++] = id;
+                s->direct_gen++;
+                break;
+            }
+
+            // The direct array is full; hand the handle over to a helper thread.
+            for (s32 i = 0; i < s->num_helpers; i ++) {
+                if (s->helpers[i].count < MAX_WAIT_OBJECTS) {
+                    h = &s->helpers[i];
+                    break;
+                }
+            }
+
+            if (!h)
+                rc = KERNELRESULT(OutOfRange);
+            else if (!h->started)
+                rc = _waitSetHelperStart(h);
+
+            if (R_SUCCEEDED(rc))
+                h->ids[h->count++] = id;
+            break;
+
+        case WaiterType_Waitable:
+            _waiterNodeInitialize(&e->node, w.waitable, INVALID_HANDLE, id, NULL);
+            e->node.set = s;
+            _waitSetScheduleRearm(s, id);
+            break;
+    }
+
+    if (R_SUCCEEDED(rc)) {
+        e->waiter = w;
+        e->helper = h;
+        e->deadline = UINT64_MAX;
+        e->error = 0;
+        e->in_use = true;
+        e->armed = w.type != WaiterType_Waitable;
+        e->fired = false;
+
+        if (h)
+            svcCancelSynchronization(h->thread.handle);
+        _waitSetKick(s);
+
+        if (id_out)
+            *id_out = id;
+    }
+
+    mutexUnlock(&s->mutex);
+    return rc;
+}
+
+void waitSetRemove(WaitSet* s, s32 id)
+{
+    if (id < 0 || id >= s->capacity)
+        return;
+
+    mutexLock(&s->mutex);
+
+    WaitSetEntry* e = &s->entries[id];
+    if (!e->in_use) {
+        mutexUnlock(&s->mutex);
+        return;
+    }
+
+    switch (e->waiter.type) {
+        case WaiterType_Handle:
+        case WaiterType_HandleWithClear:
+            if (e->helper) {
+                WaitSetHelper* h = e->helper;
+                for (s32 i = 0; i < h->count; i ++) {
+                    if (h->ids[i] == id) {
+                        h->ids[i] = h->ids[--h->count];
+                        break;
+                    }
+                }
+                svcCancelSynchronization(h->thread.handle);
+            } else
+                _waitSetRemoveDirect(s, id);
+            break;
+
+        case WaiterType_Waitable:
+            _waitSetDisarm(e);
+            break;
+    }
+
+    e->in_use = false;
+    e->armed = false;
+    e->fired = false;
+    e->helper = NULL;
+    __atomic_fetch_and(&s->ready[id/64], ~(1UL << (id%64)), __ATOMIC_SEQ_CST);
+    _waitSetKick(s);
+
+    mutexUnlock(&s->mutex);
+}
+
+Result waitSetWait(WaitSet* s, s32* id_out, u64 timeout)
+{
+    Handle own_thread_handle = getThreadVars()->handle;
+    u64 deadline = UINT64_MAX;
+    Result rc;
+
+    if (timeout != UINT64_MAX)
+        deadline = armGetSystemTick() + armNsToTicks(timeout); // timeout: ns->ticks
+
+    mutexLock(&s->mutex);
+
+    for (;;) {
+        u64 cur_tick = armGetSystemTick();
+        s32 id;
+
+        // Re-arm the objects that were returned by previous waits or newly added.
+        while (s->num_rearm) {
+            id = s->rearm[--s->num_rearm];
+            s->entries[id].pending = false;
+            if (s->entries[id].in_use)
+                _waitSetArm(s, id, cur_tick);
+        }
+
+        // Deliver objects that have already been signalled.
+        id = _waitSetPopReady(s);
+        if (id >= 0) {
+            rc = _waitSetDeliver(s, id);
+            if (R_SUCCEEDED(rc)) {
+                *id_out = id;
+                break;
+            }
+            if (R_VALUE(rc) != KERNELRESULT(Cancelled)) {
+                *id_out = id;
+                break;
+            }
+            continue;
+        }
+
+        // Override the user-supplied timeout if an object specified an earlier one.
+        u64 end_tick = deadline;
+        s32 end_tick_id = -1;
+        for (s32 i = 0; i < s->capacity; i ++) {
+            WaitSetEntry* e = &s->entries[i];
+            if (e->in_use && e->armed && e->deadline < end_tick) {
+                end_tick = e->deadline;
+                end_tick_id = i;
+            }
+        }
+
+        u64 this_timeout = UINT64_MAX;
+        if (end_tick != UINT64_MAX) {
+            s64 remaining = end_tick - cur_tick;
+            this_timeout = remaining > 0 ? armTicksToNs(remaining) : 0; // ticks->ns
+        }
+
+        // Publish ourselves as the waiting thread, then check again for signals that
+        // arrived before the publication, since those did not cancel our wait.
+        __atomic_store_n(&s->waiting_thread, own_thread_handle, __ATOMIC_SEQ_CST);
+        if (_waitSetHasReady(s)) {
+            __atomic_store_n(&s->waiting_thread, INVALID_HANDLE, __ATOMIC_SEQ_CST);
+            continue;
+        }
+
+        // Wait on a copy, the direct array may change as soon as the lock is released.
+        Handle handles[MAX_WAIT_OBJECTS];
+        s32 ids[MAX_WAIT_OBJECTS];
+        u32 gen = s->direct_gen;
+        s32 num_direct = s->num_direct;
+        s32 idx;
+
+        memcpy(handles, s->direct_handles, num_direct * sizeof(Handle));
+        memcpy(ids, s->direct_ids, num_direct * sizeof(s32));
+
+        mutexUnlock(&s->mutex);
+        rc = svcWaitSynchronization(&idx, handles, num_direct, this_timeout);
+        mutexLock(&s->mutex);
+
+        __atomic_store_n(&s->waiting_thread, INVALID_HANDLE, __ATOMIC_SEQ_CST);
+
+        if (R_SUCCEEDED(rc)) {
+            // If the direct array changed during the wait the index is meaningless; retry.
+            if (gen != s->direct_gen)
+                continue;
+
+            id = ids[idx];
+            if (s->entries[id].waiter.type == WaiterType_HandleWithClear) {
+                // Try to auto-clear the event. If it is not signalled, retry the wait.
+                rc = svcResetSignal(handles[idx]);
+                if (R_VALUE(rc) == KERNELRESULT(InvalidState))
+                    continue;
+                if (R_FAILED(rc))
+                    break;
+            }
+
+            *id_out = id;
+            break;
+        } else if (R_VALUE(rc) == KERNELRESULT(TimedOut)) {
+            // If we hit the user-supplied timeout, we return the timeout error back to caller.
+            if (end_tick_id == -1)
+                break;
+
+            // If not, it means an object triggered the timeout; handle it.
+            WaitSetEntry* e = &s->entries[end_tick_id];
+            if (!e->in_use || !e->armed || e->deadline != end_tick)
+                continue;
+
+            _waitSetDisarm(e);
+            _waitSetScheduleRearm(s, end_tick_id);
+
+            rc = e->waiter.waitable->vt->onTimeout(e->waiter.waitable, end_tick);
+            if (R_SUCCEEDED(rc)) {
+                *id_out = end_tick_id;
+                break;
+            }
+            if (R_VALUE(rc) != KERNELRESULT(Cancelled))
+                break;
+        } else if (R_VALUE(rc) != KERNELRESULT(Cancelled)) {
+            // A direct handle was closed or is invalid, and would make every wait fail immediately.
+            // Like the helper threads do, take the culprits out of the wait and report them as ready.
+            bool found = false;
+            for (s32 i = 0; i < num_direct; i ++) {
+                Result rc2 = svcWaitSynchronizationSingle(handles[i], 0);
+                if (R_SUCCEEDED(rc2) || R_VALUE(rc2) == KERNELRESULT(TimedOut))
+                    continue;
+
+                WaitSetEntry* e = &s->entries[ids[i]];
+                if (e->in_use && !e->helper && e->armed && e->waiter.handle == handles[i]) {
+                    _waitSetRemoveDirect(s, ids[i]);
+                    e->armed = false;
+                    e->error = rc2;
+                    __atomic_fetch_or(&s->ready[ids[i]/64], 1UL << (ids[i]%64), __ATOMIC_SEQ_CST);
+                }
+                found = true;
+            }
+
+            // Retry if the culprits were found (or removed meanwhile), they are delivered from the ready bits.
+            if (!found)
+                break;
+        }
+    }
+
+    mutexUnlock(&s->mutex);
+    return rc;
+}
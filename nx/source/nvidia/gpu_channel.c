@@ -1,5 +1,7 @@
 #include "types.h"
+#include <string.h>
 #include "result.h"
+#include "arm/counter.h"
 #include "kernel/svc.h"
 #include "runtime/hosversion.h"
 #include "services/nv.h"
@@ -19,6 +21,7 @@ Result nvGpuChannelCreate(NvGpuChannel* c, struct NvAddressSpace* as, NvChannelP
 
     c->fence_incr = 0;
     c->num_entries = 0;
+    memset(&c->stats, 0, sizeof(c->stats));
 
     res = nvioctlNvhostAsGpu_BindChannel(as->fd, c->base.fd);
 
@@ -92,29 +95,73 @@ static Result _nvGpuChannelKickoffRaw(NvGpuChannel* c, u32 flags)
         return nvioctlChannel_SubmitGpfifo(c->base.fd, c->entries, c->num_entries, flags, &fence);
 }
 
-Result nvGpuChannelKickoff(NvGpuChannel* c)
+static Result _nvGpuChannelKickoffOnce(NvGpuChannel* c)
 {
-    if (!c->num_entries)
-        return 0;
-
     u32 flags = BIT(2);
     if (c->fence_incr)
         flags |= BIT(8);
 
-    Result res;
-    for (;;)
-    {
-        res = _nvGpuChannelKickoffRaw(c, flags);
-        if (res != MAKERESULT(Module_LibnxNvidia, LibnxNvidiaError_Busy))
-            break;
-        svcSleepThread(100000000);
-    }
+    Result res = _nvGpuChannelKickoffRaw(c, flags);
 
     if (R_SUCCEEDED(res)) {
         c->fence.value += c->fence_incr;
         c->fence_incr = 0;
         c->num_entries = 0;
-    }
+        c->stats.num_kickoffs++;
+    } else if (res == MAKERESULT(Module_LibnxNvidia, LibnxNvidiaError_Busy))
+        c->stats.num_busy++;
+
+    return res;
+}
+
+Result nvGpuChannelTryKickoff(NvGpuChannel* c)
+{
+    if (!c->num_entries)
+        return 0;
+
+    return _nvGpuChannelKickoffOnce(c);
+}
+
+Result nvGpuChannelKickoff(NvGpuChannel* c)
+{
+    if (!c->num_entries)
+        return 0;
+
+    Result res = _nvGpuChannelKickoffOnce(c);
+    if (res != MAKERESULT(Module_LibnxNvidia, LibnxNvidiaError_Busy))
+        return res;
+
+    // The channel is full. Instead of sleeping for a fixed period, wait for previously
+    // submitted work to make progress, backing off exponentially up to the old 100ms bound.
+    u64 start_tick = armGetSystemTick();
+    s32 backoff_us = GPFIFO_BUSY_BACKOFF_MIN_US;
+    bool drained = false;
+
+    do {
+        NvFence fence = c->fence;
+        Result rc = nvFenceWait(&fence, backoff_us);
+
+        // Once all our previous work has completed, waiting on the fence no longer
+        // blocks; fall back to sleeping so that we don't spin on the driver.
+        if (R_SUCCEEDED(rc) && !drained)
+            drained = true;
+        else if (rc != MAKERESULT(Module_LibnxNvidia, LibnxNvidiaError_Timeout))
+            svcSleepThread((u64)1000*backoff_us);
+
+        if (backoff_us < GPFIFO_BUSY_BACKOFF_MAX_US) {
+            backoff_us *= 2;
+            if (backoff_us > GPFIFO_BUSY_BACKOFF_MAX_US)
+                backoff_us = GPFIFO_BUSY_BACKOFF_MAX_US;
+        }
+
+        res = _nvGpuChannelKickoffOnce(c);
+    } while (res == MAKERESULT(Module_LibnxNvidia, LibnxNvidiaError_Busy));
+
+    u64 stall_ticks = armGetSystemTick() - start_tick;
+    c->stats.num_stalls++;
+    c->stats.stall_ticks += stall_ticks;
+    if (stall_ticks > c->stats.max_stall_ticks)
+        c->stats.max_stall_ticks = stall_ticks;
 
     return res;
 }
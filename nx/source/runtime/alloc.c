@@ -1,5 +1,6 @@
 #include "alloc.h"
 #include <stdlib.h>
+#include "kernel/mutex.h"
 
 void* __attribute__((weak)) __libnx_alloc(size_t size) {
     return malloc(size);
@@ -13,3 +14,153 @@ void* __attribute__((weak)) __libnx_aligned_alloc(size_t alignment, size_t size)
 void __attribute__((weak)) __libnx_free(void* p) {
     free(p);
 }
+
+#define POOL_HEADER_SIZE  0x10
+#define POOL_MIN_SHIFT    5     // Smallest chunk is 0x20 bytes (including header).
+#define POOL_NUM_CLASSES  7     // Largest chunk is 0x800 bytes (including header).
+#define POOL_CLASS_LARGE  0xFF
+#define POOL_SLAB_SIZE    0x4000
+#define POOL_CACHE_MAX    16
+#define POOL_CACHE_BATCH  8
+
+typedef struct PoolChunk {
+    struct PoolChunk* next;
+} PoolChunk;
+
+// Stored in front of every allocation; keeps the payload 16-byte aligned.
+typedef struct {
+    u32 class_idx;
+    u32 padding[3];
+} PoolHeader;
+
+typedef struct {
+    PoolChunk* head[POOL_NUM_CLASSES];
+    u32 count[POOL_NUM_CLASSES];
+} PoolCache;
+
+static Mutex g_poolMutex;
+static PoolChunk* g_poolFree[POOL_NUM_CLASSES];
+static u8* g_poolSlabCur;
+static size_t g_poolSlabLeft;
+
+static __thread PoolCache g_poolCache;
+
+static inline size_t _poolChunkSize(u32 class_idx) {
+    return (size_t)1 << (POOL_MIN_SHIFT + class_idx);
+}
+
+static u32 _poolGetClass(size_t size) {
+    size += POOL_HEADER_SIZE;
+    for (u32 i = 0; i < POOL_NUM_CLASSES; i ++) {
+        if (size <= _poolChunkSize(i))
+            return i;
+    }
+    return POOL_CLASS_LARGE;
+}
+
+// Moves a batch of chunks from the shared free lists (or a fresh slab) into the thread cache.
+static bool _poolRefill(PoolCache* cache, u32 class_idx) {
+    size_t chunk_size = _poolChunkSize(class_idx);
+
+    mutexLock(&g_poolMutex);
+
+    for (u32 i = 0; i < POOL_CACHE_BATCH; i ++) {
+        PoolChunk* c = g_poolFree[class_idx];
+        if (c)
+            g_poolFree[class_idx] = c->next;
+        else {
+            if (g_poolSlabLeft < chunk_size) {
+                // Slabs are never given back; the pool only grows to the peak usage.
+                u8* slab = (u8*)__libnx_alloc(POOL_SLAB_SIZE);
+                if (!slab)
+                    break;
+                g_poolSlabCur = slab;
+                g_poolSlabLeft = POOL_SLAB_SIZE;
+            }
+
+            c = (PoolChunk*)g_poolSlabCur;
+            g_poolSlabCur += chunk_size;
+            g_poolSlabLeft -= chunk_size;
+        }
+
+        c->next = cache->head[class_idx];
+        cache->head[class_idx] = c;
+        cache->count[class_idx] ++;
+    }
+
+    mutexUnlock(&g_poolMutex);
+    return cache->head[class_idx] != NULL;
+}
+
+static void _poolDrain(PoolCache* cache, u32 class_idx, u32 count) {
+    mutexLock(&g_poolMutex);
+
+    while (count-- && cache->head[class_idx]) {
+        PoolChunk* c = cache->head[class_idx];
+        cache->head[class_idx] = c->next;
+        cache->count[class_idx] --;
+
+        c->next = g_poolFree[class_idx];
+        g_poolFree[class_idx] = c;
+    }
+
+    mutexUnlock(&g_poolMutex);
+}
+
+void* __libnx_pool_alloc(size_t size) {
+    // The header is added to the size below.
+    if (size > SIZE_MAX - POOL_HEADER_SIZE)
+        return NULL;
+
+    u32 class_idx = _poolGetClass(size);
+    PoolHeader* hdr;
+
+    if (class_idx == POOL_CLASS_LARGE) {
+        hdr = (PoolHeader*)__libnx_alloc(POOL_HEADER_SIZE + size);
+        if (!hdr)
+            return NULL;
+    }
+    else {
+        PoolCache* cache = &g_poolCache;
+        if (!cache->head[class_idx] && !_poolRefill(cache, class_idx))
+            return NULL;
+
+        PoolChunk* c = cache->head[class_idx];
+        cache->head[class_idx] = c->next;
+        cache->count[class_idx] --;
+        hdr = (PoolHeader*)c;
+    }
+
+    hdr->class_idx = class_idx;
+    return (u8*)hdr + POOL_HEADER_SIZE;
+}
+
+void __libnx_pool_free(void* p) {
+    if (!p)
+        return;
+
+    PoolHeader* hdr = (PoolHeader*)((u8*)p - POOL_HEADER_SIZE);
+    u32 class_idx = hdr->class_idx;
+
+    if (class_idx == POOL_CLASS_LARGE) {
+        __libnx_free(hdr);
+        return;
+    }
+
+    PoolCache* cache = &g_poolCache;
+    PoolChunk* c = (PoolChunk*)hdr;
+    c->next = cache->head[class_idx];
+    cache->head[class_idx] = c;
+    cache->count[class_idx] ++;
+
+    if (cache->count[class_idx] > POOL_CACHE_MAX)
+        _poolDrain(cache, class_idx, POOL_CACHE_BATCH);
+}
+
+void __libnx_pool_thread_exit(void) {
+    PoolCache* cache = &g_poolCache;
+    for (u32 i = 0; i < POOL_NUM_CLASSES; i ++) {
+        if (cache->count[i])
+            _poolDrain(cache, i, cache->count[i]);
+    }
+}
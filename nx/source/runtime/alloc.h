@@ -4,3 +4,9 @@
 void* __libnx_alloc(size_t size);
 void* __libnx_aligned_alloc(size_t alignment, size_t size);
 void __libnx_free(void* p);
+
+// Size-class pool for small, short-lived internal objects. Memory obtained from
+// __libnx_pool_alloc must be released with __libnx_pool_free (and vice versa).
+void* __libnx_pool_alloc(size_t size);
+void __libnx_pool_free(void* p);
+void __libnx_pool_thread_exit(void);
@@ -0,0 +1,74 @@
+#include "runtime/arena.h"
+#include "alloc.h"
+
+struct ArenaBlock {
+    ArenaBlock* next;
+    size_t size;
+    size_t used;
+    size_t padding;
+    u8 data[];
+};
+
+void arenaCreate(Arena* a, size_t block_size)
+{
+    a->head = NULL;
+    a->block_size = block_size;
+}
+
+void* arenaAlloc(Arena* a, size_t size, size_t alignment)
+{
+    if (alignment > 0x10)
+        return NULL;
+    if (!alignment)
+        alignment = 1;
+
+    ArenaBlock* b = a->head;
+    if (b) {
+        size_t offset = (b->used + alignment - 1) &~ (alignment - 1);
+        if (offset <= b->size && size <= b->size - offset) {
+            b->used = offset + size;
+            return &b->data[offset];
+        }
+    }
+
+    // Block data is always 16-byte aligned, so a new block never needs padding.
+    if (size > SIZE_MAX - sizeof(ArenaBlock))
+        return NULL;
+
+    size_t block_size = size > a->block_size ? size : a->block_size;
+    b = (ArenaBlock*)__libnx_alloc(sizeof(ArenaBlock) + block_size);
+    if (!b)
+        return NULL;
+
+    b->next = a->head;
+    b->size = block_size;
+    b->used = size;
+    a->head = b;
+    return &b->data[0];
+}
+
+ArenaMark arenaGetMark(Arena* a)
+{
+    ArenaMark m;
+    m.block = a->head;
+    m.used = a->head ? a->head->used : 0;
+    return m;
+}
+
+void arenaRewind(Arena* a, ArenaMark m)
+{
+    while (a->head && a->head != m.block) {
+        ArenaBlock* b = a->head;
+        a->head = b->next;
+        __libnx_free(b);
+    }
+
+    if (a->head)
+        a->head->used = m.used;
+}
+
+void arenaClose(Arena* a)
+{
+    ArenaMark m = { NULL, 0 };
+    arenaRewind(a, m);
+}
@@ -1,8 +1,46 @@
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
 #include <sys/iosupport.h>
 #include "runtime/devices/console.h"
+#include "runtime/hosversion.h"
 #include "kernel/svc.h"
+#include "kernel/levent.h"
+#include "kernel/mutex.h"
+#include "kernel/thread.h"
+#include "../alloc.h"
+
+#define DEBUG_LOG_SLOT_SIZE   0x80
+#define DEBUG_LOG_OUTPUT_SIZE 0x1000
+#define DEBUG_LOG_STACK_SIZE  0x4000
+
+// One record of the log ring. A write spans as many consecutive records as needed.
+// seq == position:   free for the producer claiming that position.
+// seq == position+1: filled, ready for the flusher.
+typedef struct {
+	u32 seq;
+	u32 len;
+	char data[DEBUG_LOG_SLOT_SIZE - 2*sizeof(u32)];
+} DebugLogSlot;
+
+__attribute__((weak)) u32 __nx_console_debug_buffer_size = 0x10000;
+__attribute__((weak)) u64 __nx_console_debug_flush_interval = 10000000; // ns
+
+static Mutex g_logMutex;
+static bool g_logRunning;
+static bool g_logAccepting; // cleared before the ring is freed
+static u32 g_logWriters;    // producers currently inside the ring
+static Thread g_logThread;
+static DebugLogSlot *g_logSlots;
+static u32 g_logNumSlots;
+static u32 g_logTail; // next position to claim, advanced by producers
+static u32 g_logHead; // next position to flush, advanced by the flusher only
+static LEvent g_logWakeEvent;
+static LEvent g_logFlushedEvent;
+static int g_logFd = -1;
+static char g_logOutput[DEBUG_LOG_OUTPUT_SIZE];
+static DebugLogStats g_logStats;
 
 //---------------------------------------------------------------------------------
 static ssize_t debug_write(struct _reent *r, void *fd, const char *ptr, size_t len) {
@@ -11,11 +49,162 @@ static ssize_t debug_write(struct _reent *r, void *fd, const char *ptr, size_t l
 	return len;
 }
 
+//---------------------------------------------------------------------------------
+static void debug_log_output(const char *ptr, size_t len) {
+//---------------------------------------------------------------------------------
+	int fd = __atomic_load_n(&g_logFd, __ATOMIC_ACQUIRE);
+
+	if (fd < 0) {
+		svcOutputDebugString(ptr, len);
+		return;
+	}
+
+	while (len) {
+		ssize_t ret = write(fd, ptr, len);
+		if (ret < 0) {
+			// The nxlink socket is non-blocking.
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				svcSleepThread(1000000);
+				continue;
+			}
+			__atomic_add_fetch(&g_logStats.bytes_dropped, len, __ATOMIC_RELAXED);
+			return;
+		}
+		ptr += ret;
+		len -= ret;
+	}
+}
+
+//---------------------------------------------------------------------------------
+static void debug_log_drain(void) {
+//---------------------------------------------------------------------------------
+	u32 mask = g_logNumSlots - 1;
+	size_t out_len = 0;
+
+	for (;;) {
+		DebugLogSlot *slot = &g_logSlots[g_logHead & mask];
+
+		// Pairs with the producer checking the head after publishing, see debug_log_put.
+		if (__atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST) != g_logHead + 1)
+			break;
+
+		if (out_len + slot->len > sizeof(g_logOutput)) {
+			debug_log_output(g_logOutput, out_len);
+			__atomic_add_fetch(&g_logStats.flushes, 1, __ATOMIC_RELAXED);
+			out_len = 0;
+		}
+
+		memcpy(&g_logOutput[out_len], slot->data, slot->len);
+		out_len += slot->len;
+
+		// Hand the record back to the producers.
+		__atomic_store_n(&slot->seq, g_logHead + g_logNumSlots, __ATOMIC_RELEASE);
+		__atomic_store_n(&g_logHead, g_logHead + 1, __ATOMIC_SEQ_CST);
+	}
+
+	if (out_len) {
+		debug_log_output(g_logOutput, out_len);
+		__atomic_add_fetch(&g_logStats.flushes, 1, __ATOMIC_RELAXED);
+	}
+}
+
+//---------------------------------------------------------------------------------
+static void debug_log_thread(void *arg) {
+//---------------------------------------------------------------------------------
+	while (__atomic_load_n(&g_logRunning, __ATOMIC_ACQUIRE)) {
+		// Sleep until a write lands in an empty ring, then give more writes the flush interval to be batched with it.
+		leventWait(&g_logWakeEvent, UINT64_MAX);
+		if (__atomic_load_n(&g_logRunning, __ATOMIC_ACQUIRE))
+			leventWait(&g_logWakeEvent, __nx_console_debug_flush_interval);
+		debug_log_drain();
+		leventSignal(&g_logFlushedEvent);
+	}
+
+	debug_log_drain();
+	leventSignal(&g_logFlushedEvent);
+}
+
+//---------------------------------------------------------------------------------
+static void debug_log_put(const char *ptr, size_t len) {
+//---------------------------------------------------------------------------------
+	const size_t slot_data = sizeof(((DebugLogSlot*)0)->data);
+	u32 mask = g_logNumSlots - 1;
+	u32 count = (len + slot_data - 1) / slot_data;
+	u32 pos;
+
+	// Writes are never split or blocked on: a write that doesn't fit is dropped as a whole.
+	if (count > g_logNumSlots) {
+		__atomic_add_fetch(&g_logStats.writes_dropped, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&g_logStats.bytes_dropped, len, __ATOMIC_RELAXED);
+		return;
+	}
+
+	pos = __atomic_load_n(&g_logTail, __ATOMIC_RELAXED);
+	for (;;) {
+		// Records are released in order, so if the last one is free, all of them are.
+		u32 last = pos + count - 1;
+		s32 diff = (s32)(__atomic_load_n(&g_logSlots[last & mask].seq, __ATOMIC_ACQUIRE) - last);
+
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&g_logTail, &pos, pos + count, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			__atomic_add_fetch(&g_logStats.writes_dropped, 1, __ATOMIC_RELAXED);
+			__atomic_add_fetch(&g_logStats.bytes_dropped, len, __ATOMIC_RELAXED);
+			__atomic_add_fetch(&g_logStats.overflows, 1, __ATOMIC_RELAXED);
+			leventSignal(&g_logWakeEvent);
+			return;
+		} else {
+			pos = __atomic_load_n(&g_logTail, __ATOMIC_RELAXED);
+		}
+	}
+
+	for (u32 i = 0; i < count; i++) {
+		DebugLogSlot *slot = &g_logSlots[(pos + i) & mask];
+		size_t chunk = len - i*slot_data;
+		if (chunk > slot_data) chunk = slot_data;
+
+		memcpy(slot->data, ptr + i*slot_data, chunk);
+		slot->len = chunk;
+		__atomic_store_n(&slot->seq, pos + i + 1, __ATOMIC_SEQ_CST);
+	}
+
+	__atomic_add_fetch(&g_logStats.bytes_written, len, __ATOMIC_RELAXED);
+
+	// Wake the flusher when it stopped inside this write (it may be sleeping on it), or early once the
+	// ring is half full. Otherwise it is still due to wake up for an earlier write.
+	u32 head = __atomic_load_n(&g_logHead, __ATOMIC_SEQ_CST);
+	if (head - pos < count || (s32)(pos + count - head) >= (s32)(g_logNumSlots/2))
+		leventSignal(&g_logWakeEvent);
+}
+
+//---------------------------------------------------------------------------------
+static ssize_t debug_buffered_write(struct _reent *r, void *fd, const char *ptr, size_t len) {
+//---------------------------------------------------------------------------------
+	if (!len) return 0;
+
+	// Raw writes to STDERR_FILENO don't take the stderr lock, so register as a writer before touching the ring:
+	// debug_log_stop waits for the writers to leave before freeing it. Late writers go straight to the debug output.
+	__atomic_add_fetch(&g_logWriters, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&g_logAccepting, __ATOMIC_SEQ_CST))
+		debug_log_put(ptr, len);
+	else
+		svcOutputDebugString(ptr, len);
+	__atomic_sub_fetch(&g_logWriters, 1, __ATOMIC_RELEASE);
+
+	return len;
+}
+
 static const devoptab_t dotab_svc = {
 	.name    = "svc",
 	.write_r = debug_write,
 };
 
+static const devoptab_t dotab_svc_buffered = {
+	.name    = "svcbuf",
+	.write_r = debug_buffered_write,
+};
+
 static const devoptab_t dotab_null = {
 	.name = "null",
 };
@@ -24,18 +213,92 @@ __attribute__((weak)) const devoptab_t* __nx_get_console_dotab(void) {
 	return &dotab_null;
 }
 
+//---------------------------------------------------------------------------------
+static bool debug_log_start(void) {
+//---------------------------------------------------------------------------------
+	if (g_logRunning) return true;
+
+	// The light events need [4.0.0+].
+	if (!hosversionAtLeast(4,0,0)) return false;
+
+	u32 num_slots = 1;
+	while (num_slots < __nx_console_debug_buffer_size / DEBUG_LOG_SLOT_SIZE)
+		num_slots <<= 1;
+
+	g_logSlots = (DebugLogSlot*)__libnx_alloc(num_slots * sizeof(DebugLogSlot));
+	if (!g_logSlots) return false;
+
+	for (u32 i = 0; i < num_slots; i++)
+		g_logSlots[i].seq = i;
+
+	g_logNumSlots = num_slots;
+	g_logTail = 0;
+	g_logHead = 0;
+	leventInit(&g_logWakeEvent, false, true);
+	leventInit(&g_logFlushedEvent, false, true);
+
+	s32 prio = 0x2C;
+	svcGetThreadPriority(&prio, CUR_THREAD_HANDLE);
+
+	g_logRunning = true;
+	if (R_FAILED(threadCreate(&g_logThread, debug_log_thread, NULL, NULL, DEBUG_LOG_STACK_SIZE, prio, -2)) ||
+		R_FAILED(threadStart(&g_logThread))) {
+		threadClose(&g_logThread);
+		g_logRunning = false;
+		__libnx_free(g_logSlots);
+		g_logSlots = NULL;
+		return false;
+	}
+
+	__atomic_store_n(&g_logAccepting, true, __ATOMIC_SEQ_CST);
+	return true;
+}
+
+//---------------------------------------------------------------------------------
+static void debug_log_stop(void) {
+//---------------------------------------------------------------------------------
+	if (!g_logRunning) return;
+
+	// Stop accepting writes, then wait for the producers still inside the ring.
+	__atomic_store_n(&g_logAccepting, false, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&g_logWriters, __ATOMIC_SEQ_CST))
+		svcSleepThread(YieldType_WithCoreMigration);
+
+	__atomic_store_n(&g_logRunning, false, __ATOMIC_RELEASE);
+	leventSignal(&g_logWakeEvent);
+	threadWaitForExit(&g_logThread);
+	threadClose(&g_logThread);
+
+	__libnx_free(g_logSlots);
+	g_logSlots = NULL;
+	g_logNumSlots = 0;
+}
+
 //---------------------------------------------------------------------------------
 void consoleDebugInit(debugDevice device) {
 //---------------------------------------------------------------------------------
 
 	int buffertype = _IONBF;
 
+	// The devoptab is swapped before the ring is stopped, debug_log_stop then waits for the writers still using it.
+	mutexLock(&g_logMutex);
+	flockfile(stderr);
+
+	if (device != debugDevice_SVCBuffered) {
+		devoptab_list[STD_ERR] = &dotab_null;
+		debug_log_stop();
+	}
+
 	switch(device) {
 
 	case debugDevice_SVC:
 		devoptab_list[STD_ERR] = &dotab_svc;
 		buffertype = _IOLBF;
 		break;
+	case debugDevice_SVCBuffered:
+		devoptab_list[STD_ERR] = debug_log_start() ? &dotab_svc_buffered : &dotab_svc;
+		buffertype = _IOLBF;
+		break;
 	case debugDevice_CONSOLE:
 		devoptab_list[STD_ERR] = __nx_get_console_dotab();
 		break;
@@ -43,6 +306,45 @@ void consoleDebugInit(debugDevice device) {
 		devoptab_list[STD_ERR] = &dotab_null;
 		break;
 	}
+	funlockfile(stderr);
 	setvbuf(stderr, NULL, buffertype, 0);
 
+	mutexUnlock(&g_logMutex);
+
+}
+
+//---------------------------------------------------------------------------------
+void consoleDebugFlush(void) {
+//---------------------------------------------------------------------------------
+	fflush(stderr);
+
+	mutexLock(&g_logMutex);
+
+	if (g_logRunning) {
+		u32 target = __atomic_load_n(&g_logTail, __ATOMIC_ACQUIRE);
+
+		leventSignal(&g_logWakeEvent);
+		while ((s32)(__atomic_load_n(&g_logHead, __ATOMIC_ACQUIRE) - target) < 0) {
+			leventWait(&g_logFlushedEvent, __nx_console_debug_flush_interval);
+			leventSignal(&g_logWakeEvent);
+		}
+	}
+
+	mutexUnlock(&g_logMutex);
+}
+
+//---------------------------------------------------------------------------------
+void consoleDebugSetOutputFd(int fd) {
+//---------------------------------------------------------------------------------
+	__atomic_store_n(&g_logFd, fd, __ATOMIC_RELEASE);
+}
+
+//---------------------------------------------------------------------------------
+void consoleDebugGetStats(DebugLogStats *stats) {
+//---------------------------------------------------------------------------------
+	stats->bytes_written  = __atomic_load_n(&g_logStats.bytes_written, __ATOMIC_RELAXED);
+	stats->bytes_dropped  = __atomic_load_n(&g_logStats.bytes_dropped, __ATOMIC_RELAXED);
+	stats->writes_dropped = __atomic_load_n(&g_logStats.writes_dropped, __ATOMIC_RELAXED);
+	stats->overflows      = __atomic_load_n(&g_logStats.overflows, __ATOMIC_RELAXED);
+	stats->flushes        = __atomic_load_n(&g_logStats.flushes, __ATOMIC_RELAXED);
 }
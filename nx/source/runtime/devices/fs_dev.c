@@ -13,6 +13,7 @@
 #include "runtime/util/utf.h"
 #include "runtime/env.h"
 #include "services/time.h"
+#include "kernel/mutex.h"
 
 #include "../alloc.h"
 #include "path_buf.h"
@@ -53,6 +54,41 @@ static int       fsdev_rmdir(struct _reent *r, const char *name);
 
 /*! @cond INTERNAL */
 
+/*! Cached type for a path which doesn't exist */
+#define FSDEV_STAT_NONE 0xFF
+/*! Number of entries per set of the stat cache */
+#define FSDEV_STAT_WAYS 4
+
+/*! Stat cache entry */
+typedef struct
+{
+  char *path;            /*! Cached FS path, NULL for an unused entry */
+  u32   hash;            /*! Hash of path */
+  u32   last_use;        /*! Clock value of the last lookup, for replacement */
+  u8    type;            /*! FsDirEntryType, or FSDEV_STAT_NONE */
+  bool  has_size;        /*! Whether size is valid */
+  bool  has_timestamps;  /*! Whether timestamps were fetched */
+  s64   size;
+  FsTimeStampRaw timestamps;
+} fsdev_stat_entry;
+
+typedef struct
+{
+  bool setup;
+  s32 id;
+  devoptab_t device;
+  FsFileSystem fs;
+  char *cwd;
+  char name[32];
+  Mutex stat_mutex;
+  fsdev_stat_entry *stat_cache;
+  u32 stat_sets;         /*! Number of sets in stat_cache, a power of two */
+  u32 stat_clock;
+  u32 stat_gen;          /*! Incremented by every invalidation */
+} fsdev_fsdevice;
+
+static int fsdev_stat_flags(struct _reent *r, fsdev_fsdevice *device, const char *file, struct stat *st, u32 flags);
+
 /*! Open file struct */
 typedef struct
 {
@@ -60,6 +96,9 @@ typedef struct
   int    flags;  /*! Flags used in open(2) */
   s64    offset; /*! Current file offset */
   FsTimeStampRaw timestamps;
+  bool   has_timestamps;   /*! Whether timestamps were fetched */
+  fsdev_fsdevice *device;  /*! Device the file was opened on */
+  char  *path;             /*! FS path, for timestamp fetch and stat cache invalidation */
 } fsdev_file_t;
 
 /*! fsdev devoptab */
@@ -95,16 +134,6 @@ fsdev_devoptab =
   .lstat_r      = fsdev_stat,
 };
 
-typedef struct
-{
-  bool setup;
-  s32 id;
-  devoptab_t device;
-  FsFileSystem fs;
-  char *cwd;
-  char name[32];
-} fsdev_fsdevice;
-
 static bool fsdev_initialised = false;
 static s32 fsdev_fsdevice_cwd;
 static __thread Result fsdev_last_result = 0;
@@ -115,7 +144,9 @@ static fsdev_fsdevice fsdev_fsdevices[32];
 _Static_assert((PATH_MAX+1) >= FS_MAX_PATH, "PATH_MAX is too small");
 
 __attribute__((weak)) u32 __nx_fsdev_direntry_cache_size = 32;
+__attribute__((weak)) u32 __nx_fsdev_direntry_max_batch_size = 256;
 __attribute__((weak)) bool __nx_fsdev_support_cwd = true;
+__attribute__((weak)) u32 __nx_fsdev_stat_cache_size = 0;
 
 static fsdev_fsdevice *fsdevFindDevice(const char *name)
 {
@@ -151,48 +182,30 @@ fsdev_fixpath(struct _reent *r,
              const char    *path,
              fsdev_fsdevice **device)
 {
-  ssize_t       units;
-  uint32_t      code;
-  const uint8_t *p = (const uint8_t*)path;
   const char *device_path = path;
 
-  // Move the path pointer to the start of the actual path
-  do
+  // Make sure the whole filename is valid UTF-8
+  ssize_t len = validate_utf8((const uint8_t*)path);
+  if(len < 0)
   {
-    units = decode_utf8(&code, p);
-    if(units < 0)
-    {
-      r->_errno = EILSEQ;
-      return NULL;
-    }
-
-    p += units;
-  } while(code != ':' && code != 0);
-
-  // We found a colon; p points to the actual path
-  if(code == ':')
-    path = (const char*)p;
+    r->_errno = EILSEQ;
+    return NULL;
+  }
 
-  // Make sure there are no more colons and that the
-  // remainder of the filename is valid UTF-8
-  p = (const uint8_t*)path;
-  do
+  // Move the path pointer to the start of the actual path. A colon can't
+  // be part of a multibyte sequence, so a plain byte search is enough.
+  const char *colon = memchr(path, ':', len);
+  if(colon != NULL)
   {
-    units = decode_utf8(&code, p);
-    if(units < 0)
-    {
-      r->_errno = EILSEQ;
-      return NULL;
-    }
+    path = colon + 1;
 
-    if(code == ':')
+    // Make sure there are no more colons
+    if(memchr(path, ':', len - (path - device_path)) != NULL)
     {
       r->_errno = EINVAL;
       return NULL;
     }
-
-    p += units;
-  } while(code != 0);
+  }
 
   fsdev_fsdevice *dev = NULL;
   if(device && *device != NULL)
@@ -278,6 +291,214 @@ static time_t fsdev_converttimetoutc(u64 timestamp)
   return posixtime;
 }
 
+static void fsdev_statcache_init(fsdev_fsdevice *device)
+{
+  u32 sets = __nx_fsdev_stat_cache_size / FSDEV_STAT_WAYS;
+
+  mutexInit(&device->stat_mutex);
+  device->stat_cache = NULL;
+  device->stat_sets  = 0;
+  device->stat_clock = 0;
+  device->stat_gen   = 0;
+
+  if(sets == 0)
+    return;
+
+  /* round down to a power of two */
+  while(sets & (sets-1))
+    sets &= sets-1;
+
+  device->stat_cache = __libnx_alloc(sizeof(fsdev_stat_entry)*sets*FSDEV_STAT_WAYS);
+  if(device->stat_cache != NULL)
+  {
+    memset(device->stat_cache, 0, sizeof(fsdev_stat_entry)*sets*FSDEV_STAT_WAYS);
+    device->stat_sets = sets;
+  }
+}
+
+static void fsdev_statcache_drop(fsdev_stat_entry *entry)
+{
+  __libnx_pool_free(entry->path);
+  entry->path = NULL;
+}
+
+static void fsdev_statcache_exit(fsdev_fsdevice *device)
+{
+  for(u32 i=0; i<device->stat_sets*FSDEV_STAT_WAYS; i++)
+  {
+    if(device->stat_cache[i].path)
+      fsdev_statcache_drop(&device->stat_cache[i]);
+  }
+
+  __libnx_free(device->stat_cache);
+  device->stat_cache = NULL;
+  device->stat_sets  = 0;
+}
+
+static u32 fsdev_statcache_hash(const char *path)
+{
+  /* FNV-1a */
+  u32 hash = 0x811c9dc5;
+  for(; *path; path++)
+    hash = (hash ^ (u8)*path) * 0x01000193;
+  return hash;
+}
+
+/*! Paths are cached as given, so only cache those with a single spelling */
+static bool fsdev_statcache_canonical(const char *path)
+{
+  size_t len = strlen(path);
+
+  if(len > 1 && path[len-1] == '/')
+    return false;
+
+  for(const char *p = strchr(path, '/'); p != NULL; p = strchr(p+1, '/'))
+  {
+    if(p[1] == '/')
+      return false;
+    if(p[1] == '.' && (p[2] == '\0' || p[2] == '/'))
+      return false;
+    if(p[1] == '.' && p[2] == '.' && (p[3] == '\0' || p[3] == '/'))
+      return false;
+  }
+
+  return true;
+}
+
+static fsdev_stat_entry* fsdev_statcache_find(fsdev_fsdevice *device, const char *path, u32 hash)
+{
+  fsdev_stat_entry *set = &device->stat_cache[(hash & (device->stat_sets-1))*FSDEV_STAT_WAYS];
+
+  for(u32 i=0; i<FSDEV_STAT_WAYS; i++)
+  {
+    if(set[i].path && set[i].hash == hash && strcmp(set[i].path, path) == 0)
+      return &set[i];
+  }
+
+  return NULL;
+}
+
+/*! Looks up a path, returns the cache generation to pass to fsdev_statcache_update */
+static u32 fsdev_statcache_lookup(fsdev_fsdevice *device, const char *path, u32 hash, fsdev_stat_entry *out)
+{
+  u32 gen;
+
+  out->path = NULL;
+  if(device->stat_cache == NULL)
+    return 0;
+
+  mutexLock(&device->stat_mutex);
+  fsdev_stat_entry *entry = fsdev_statcache_canonical(path) ? fsdev_statcache_find(device, path, hash) : NULL;
+  if(entry)
+  {
+    entry->last_use = ++device->stat_clock;
+    *out = *entry;
+  }
+  gen = device->stat_gen;
+  mutexUnlock(&device->stat_mutex);
+
+  return gen;
+}
+
+/*! Stores info for a path, unless the cache was invalidated since the lookup which returned gen */
+static void fsdev_statcache_update(fsdev_fsdevice *device, const char *path, u32 hash, u32 gen, const fsdev_stat_entry *info)
+{
+  if(device->stat_cache == NULL || !fsdev_statcache_canonical(path))
+    return;
+
+  mutexLock(&device->stat_mutex);
+  if(gen == device->stat_gen)
+  {
+    fsdev_stat_entry *entry = fsdev_statcache_find(device, path, hash);
+    if(entry == NULL)
+    {
+      fsdev_stat_entry *set = &device->stat_cache[(hash & (device->stat_sets-1))*FSDEV_STAT_WAYS];
+
+      /* pick a free entry, or evict the least recently used one */
+      entry = &set[0];
+      for(u32 i=0; i<FSDEV_STAT_WAYS && entry->path; i++)
+      {
+        if(!set[i].path || set[i].last_use < entry->last_use)
+          entry = &set[i];
+      }
+
+      char *copy = __libnx_pool_alloc(strlen(path)+1);
+      if(copy == NULL)
+        entry = NULL;
+      else
+      {
+        strcpy(copy, path);
+        if(entry->path)
+          fsdev_statcache_drop(entry);
+        entry->path = copy;
+        entry->hash = hash;
+      }
+    }
+
+    if(entry)
+    {
+      char *entry_path = entry->path;
+      *entry = *info;
+      entry->path     = entry_path;
+      entry->hash     = hash;
+      entry->last_use = ++device->stat_clock;
+    }
+  }
+  mutexUnlock(&device->stat_mutex);
+}
+
+/*! Returns the cache generation, for storing info obtained without a lookup */
+static u32 fsdev_statcache_generation(fsdev_fsdevice *device)
+{
+  u32 gen;
+
+  if(device->stat_cache == NULL)
+    return 0;
+
+  mutexLock(&device->stat_mutex);
+  gen = device->stat_gen;
+  mutexUnlock(&device->stat_mutex);
+
+  return gen;
+}
+
+/*! Drops all cached info of a device */
+static void fsdev_statcache_flush(fsdev_fsdevice *device)
+{
+  if(device->stat_cache == NULL)
+    return;
+
+  mutexLock(&device->stat_mutex);
+  for(u32 i=0; i<device->stat_sets*FSDEV_STAT_WAYS; i++)
+  {
+    if(device->stat_cache[i].path)
+      fsdev_statcache_drop(&device->stat_cache[i]);
+  }
+  device->stat_gen++;
+  mutexUnlock(&device->stat_mutex);
+}
+
+/*! Drops the cached info for a path */
+static void fsdev_statcache_invalidate(fsdev_fsdevice *device, const char *path)
+{
+  if(device->stat_cache == NULL)
+    return;
+
+  /* the entry could be cached under another spelling of the path */
+  if(!fsdev_statcache_canonical(path))
+  {
+    fsdev_statcache_flush(device);
+    return;
+  }
+
+  mutexLock(&device->stat_mutex);
+  fsdev_stat_entry *entry = fsdev_statcache_find(device, path, fsdev_statcache_hash(path));
+  if(entry)
+    fsdev_statcache_drop(entry);
+  device->stat_gen++;
+  mutexUnlock(&device->stat_mutex);
+}
+
 extern int __system_argc;
 extern char** __system_argv;
 
@@ -326,6 +547,7 @@ static int _fsdevMountDevice(const char *name, FsFileSystem fs, fsdev_fsdevice *
     goto _fail;
 
   device->setup = 1;
+  fsdev_statcache_init(device);
   device->cwd = __nx_fsdev_support_cwd ? __libnx_alloc(FS_MAX_PATH) : NULL;
   if(device->cwd!=NULL)
   {
@@ -368,6 +590,7 @@ static int _fsdevUnmountDeviceStruct(fsdev_fsdevice *device)
 
   RemoveDevice(name);
   __libnx_free(device->cwd);
+  fsdev_statcache_exit(device);
   fsFsClose(&device->fs);
 
   if(device->id == fsdev_fsdevice_cwd)
@@ -398,7 +621,9 @@ Result fsdevCommitDevice(const char *name)
   if(device==NULL)
     return MAKERESULT(Module_Libnx, LibnxError_NotFound);
 
-  return fsFsCommit(&device->fs);
+  Result rc = fsFsCommit(&device->fs);
+  fsdev_statcache_flush(device);
+  return rc;
 }
 
 Result fsdevSetConcatenationFileAttribute(const char *path) {
@@ -408,7 +633,9 @@ Result fsdevSetConcatenationFileAttribute(const char *path) {
   if(fsdev_getfspath(_REENT, path, &device, fs_path)==-1)
     return MAKERESULT(Module_Libnx, LibnxError_NotFound);
 
-  return fsFsSetConcatenationFileAttribute(&device->fs, fs_path);
+  Result rc = fsFsSetConcatenationFileAttribute(&device->fs, fs_path);
+  fsdev_statcache_invalidate(device, fs_path);
+  return rc;
 }
 
 Result fsdevIsValidSignedSystemPartitionOnSdCard(const char *name, bool *out) {
@@ -421,6 +648,21 @@ Result fsdevIsValidSignedSystemPartitionOnSdCard(const char *name, bool *out) {
   return fsFsIsValidSignedSystemPartitionOnSdCard(&device->fs, out);
 }
 
+int fsdevStat(const char *path, struct stat *st, u32 flags) {
+  return fsdev_stat_flags(_REENT, NULL, path, st, flags);
+}
+
+Result fsdevInvalidateStatCache(const char *name) {
+  fsdev_fsdevice *device;
+
+  device = fsdevFindDevice(name);
+  if(device==NULL && fsdev_fixpath(_REENT, name, &device)==NULL)
+    return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+
+  fsdev_statcache_flush(device);
+  return 0;
+}
+
 Result fsdevCreateFile(const char* path, size_t size, u32 flags) {
   char           *fs_path = __nx_dev_path_buf;
   fsdev_fsdevice *device = NULL;
@@ -428,7 +670,9 @@ Result fsdevCreateFile(const char* path, size_t size, u32 flags) {
   if(fsdev_getfspath(_REENT, path, &device, fs_path)==-1)
     return MAKERESULT(Module_Libnx, LibnxError_NotFound);
 
-  return fsFsCreateFile(&device->fs, fs_path, size, flags);
+  Result rc = fsFsCreateFile(&device->fs, fs_path, size, flags);
+  fsdev_statcache_invalidate(device, fs_path);
+  return rc;
 }
 
 Result fsdevDeleteDirectoryRecursively(const char *path) {
@@ -438,7 +682,9 @@ Result fsdevDeleteDirectoryRecursively(const char *path) {
   if(fsdev_getfspath(_REENT, path, &device, fs_path)==-1)
     return MAKERESULT(Module_Libnx, LibnxError_NotFound);
 
-  return fsFsDeleteDirectoryRecursively(&device->fs, fs_path);
+  Result rc = fsFsDeleteDirectoryRecursively(&device->fs, fs_path);
+  fsdev_statcache_flush(device);
+  return rc;
 }
 
 /*! Initialize SDMC device */
@@ -632,6 +878,13 @@ int fsdevTranslatePath(const char *path, FsFileSystem** device, char *outpath)
   return ret;
 }
 
+/*! Drops the cached stat info of an open file after it was modified */
+static void fsdev_file_modified(fsdev_file_t *file)
+{
+  if(file->path != NULL)
+    fsdev_statcache_invalidate(file->device, file->path);
+}
+
 /*! Open a file
  *
  *  @param[in,out] r          newlib reentrancy struct
@@ -695,14 +948,23 @@ fsdev_open(struct _reent *r,
   /* Test O_EXCL. */
   if((flags & O_CREAT))
   {
-    rc = fsFsCreateFile(&device->fs, fs_path, 0, attributes);
-    if(flags & O_EXCL)
+    /* skip the create when the file is already known to exist */
+    fsdev_stat_entry cached;
+    fsdev_statcache_lookup(device, fs_path, fsdev_statcache_hash(fs_path), &cached);
+    if((flags & O_EXCL) || cached.path == NULL || cached.type != FsDirEntryType_File)
     {
-      if(R_FAILED(rc))
+      rc = fsFsCreateFile(&device->fs, fs_path, 0, attributes);
+      if(flags & O_EXCL)
       {
-        r->_errno = fsdev_translate_error(rc);
-        return -1;
+        if(R_FAILED(rc))
+        {
+          r->_errno = fsdev_translate_error(rc);
+          return -1;
+        }
       }
+
+      if(R_SUCCEEDED(rc))
+        fsdev_statcache_invalidate(device, fs_path);
     }
   }
 
@@ -728,9 +990,22 @@ fsdev_open(struct _reent *r,
     file->fd     = fd;
     file->flags  = (flags & (O_ACCMODE|O_APPEND|O_SYNC));
     file->offset = 0;
+    file->device = device;
 
+    /* timestamps are only fetched by the first fstat */
     memset(&file->timestamps, 0, sizeof(file->timestamps));
-    rc = fsFsGetFileTimeStampRaw(&device->fs, fs_path, &file->timestamps);//Result can be ignored since output is only set on success, etc.
+    file->has_timestamps = false;
+    file->path = __libnx_pool_alloc(strlen(fs_path)+1);
+    if(file->path != NULL)
+      strcpy(file->path, fs_path);
+    else
+    {
+      rc = fsFsGetFileTimeStampRaw(&device->fs, fs_path, &file->timestamps);//Result can be ignored since output is only set on success, etc.
+      file->has_timestamps = true;
+    }
+
+    if((flags & O_ACCMODE) != O_RDONLY)
+      fsdev_statcache_invalidate(device, fs_path);
 
     return 0;
   }
@@ -757,6 +1032,11 @@ fsdev_close(struct _reent *r,
   fsdev_file_t *file = (fsdev_file_t*)fd;
 
   fsFileClose(&file->fd);
+  if((file->flags & O_ACCMODE) != O_RDONLY)
+    fsdev_file_modified(file);
+  __libnx_pool_free(file->path);
+  file->path = NULL;
+
   if(R_SUCCEEDED(rc))
     return 0;
 
@@ -813,6 +1093,7 @@ fsdev_write(struct _reent *r,
   }
 
   file->offset += len;
+  fsdev_file_modified(file);
 
   /* check if this is synchronous or not */
   if(file->flags & O_SYNC)
@@ -869,6 +1150,8 @@ fsdev_write_safe(struct _reent *r,
       return -1;
     }
 
+    fsdev_file_modified(file);
+
     /* check if this is synchronous or not */
     if(file->flags & O_SYNC)
       fsFileFlush(&file->fd);
@@ -1071,6 +1354,12 @@ fsdev_fstat(struct _reent *r,
   rc = fsFileGetSize(&file->fd, &size);
   if(R_SUCCEEDED(rc))
   {
+    if(!file->has_timestamps && file->path != NULL)
+    {
+      fsFsGetFileTimeStampRaw(&file->device->fs, file->path, &file->timestamps);
+      file->has_timestamps = true;
+    }
+
     memset(st, 0, sizeof(struct stat));
     st->st_size = (off_t)size;
     st->st_nlink = 1;
@@ -1092,75 +1381,137 @@ fsdev_fstat(struct _reent *r,
 
 /*! Get file stats
  *
- *  @param[in,out] r    newlib reentrancy struct
- *  @param[in]     file Path to file
- *  @param[out]    st   Pointer to file stats to fill
+ *  @param[in,out] r      newlib reentrancy struct
+ *  @param[in]     device Device, or NULL to use the one from the path
+ *  @param[in]     file   Path to file
+ *  @param[out]    st     Pointer to file stats to fill
+ *  @param[in]     flags  Bitmask of FsdevStatFlag, selecting the info beyond the entry type
  *
  *  @returns 0 for success
  *  @returns -1 for error
  */
 static int
-fsdev_stat(struct _reent *r,
-          const char    *file,
-          struct stat   *st)
+fsdev_stat_flags(struct _reent  *r,
+                fsdev_fsdevice *device,
+                const char     *file,
+                struct stat    *st,
+                u32            flags)
 {
   FsFile  fd;
-  FsDir   fdir;
   Result  rc;
-  int     ret=0;
   char   *fs_path = __nx_dev_path_buf;
-  fsdev_fsdevice *device = r->deviceData;
-  FsTimeStampRaw timestamps = {0};
+  fsdev_stat_entry info;
   FsDirEntryType type;
+  bool    update = false;
 
   if(fsdev_getfspath(r, file, &device, fs_path)==-1)
     return -1;
 
-  rc = fsFsGetEntryType(&device->fs, fs_path, &type);
-  if(R_SUCCEEDED(rc))
+  u32 hash = fsdev_statcache_hash(fs_path);
+  u32 gen = fsdev_statcache_lookup(device, fs_path, hash, &info);
+
+  if(info.path == NULL)
   {
-    if(type == FsDirEntryType_Dir)
+    memset(&info, 0, sizeof(info));
+
+    rc = fsFsGetEntryType(&device->fs, fs_path, &type);
+    if(R_FAILED(rc))
     {
-      if(R_SUCCEEDED(rc = fsFsOpenDirectory(&device->fs, fs_path, FsDirOpenMode_ReadDirs | FsDirOpenMode_ReadFiles, &fdir)))
+      r->_errno = fsdev_translate_error(rc);
+
+      /* remember that the path doesn't exist */
+      if(r->_errno == ENOENT)
       {
-        memset(st, 0, sizeof(struct stat));
-        st->st_nlink = 1;
-        st->st_mode = S_IFDIR | S_IRWXU | S_IRWXG | S_IRWXO;
-        fsDirClose(&fdir);
-        return 0;
+        info.type = FSDEV_STAT_NONE;
+        fsdev_statcache_update(device, fs_path, hash, gen, &info);
       }
+
+      return -1;
     }
-    else if(type == FsDirEntryType_File)
+
+    info.type = type;
+    update = true;
+  }
+
+  if(info.type == FSDEV_STAT_NONE)
+  {
+    r->_errno = ENOENT;
+    return -1;
+  }
+
+  if(info.type == FsDirEntryType_File)
+  {
+    if((flags & FsdevStatFlag_Size) && !info.has_size)
     {
       if(R_SUCCEEDED(rc = fsFsOpenFile(&device->fs, fs_path, FsOpenMode_Read, &fd)))
       {
-        fsdev_file_t tmpfd = { .fd = fd };
-        ret = fsdev_fstat(r, &tmpfd, st);
+        rc = fsFileGetSize(&fd, &info.size);
         fsFileClose(&fd);
+      }
 
-        if(ret==0)
-        {
-          rc = fsFsGetFileTimeStampRaw(&device->fs, fs_path, &timestamps);
-          if(R_SUCCEEDED(rc) && timestamps.is_valid)
-          {
-            st->st_ctime = fsdev_converttimetoutc(timestamps.created);
-            st->st_mtime = fsdev_converttimetoutc(timestamps.modified);
-            st->st_atime = fsdev_converttimetoutc(timestamps.accessed);
-          }
-        }
-
-        return ret;
+      if(R_FAILED(rc))
+      {
+        r->_errno = fsdev_translate_error(rc);
+        return -1;
       }
+
+      info.has_size = true;
+      update = true;
     }
-    else
+
+    if((flags & FsdevStatFlag_TimeStamps) && !info.has_timestamps)
     {
-      r->_errno = EINVAL;
-      return -1;
+      fsFsGetFileTimeStampRaw(&device->fs, fs_path, &info.timestamps);//Result can be ignored since output is only set on success, etc.
+      info.has_timestamps = true;
+      update = true;
+    }
+  }
+  else if(info.type != FsDirEntryType_Dir)
+  {
+    r->_errno = EINVAL;
+    return -1;
+  }
+
+  if(update)
+    fsdev_statcache_update(device, fs_path, hash, gen, &info);
+
+  memset(st, 0, sizeof(struct stat));
+  st->st_nlink = 1;
+
+  if(info.type == FsDirEntryType_Dir)
+    st->st_mode = S_IFDIR | S_IRWXU | S_IRWXG | S_IRWXO;
+  else
+  {
+    st->st_mode = S_IFREG | S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
+    if(info.has_size)
+      st->st_size = (off_t)info.size;
+
+    if(info.has_timestamps && info.timestamps.is_valid)
+    {
+      st->st_ctime = fsdev_converttimetoutc(info.timestamps.created);
+      st->st_mtime = fsdev_converttimetoutc(info.timestamps.modified);
+      st->st_atime = fsdev_converttimetoutc(info.timestamps.accessed);
     }
   }
 
-  r->_errno = fsdev_translate_error(rc);
-  return -1;
+  return 0;
+}
+
+/*! Get file stats
+ *
+ *  @param[in,out] r    newlib reentrancy struct
+ *  @param[in]     file Path to file
+ *  @param[out]    st   Pointer to file stats to fill
+ *
+ *  @returns 0 for success
+ *  @returns -1 for error
+ */
+static int
+fsdev_stat(struct _reent *r,
+          const char    *file,
+          struct stat   *st)
+{
+  return fsdev_stat_flags(r, r->deviceData, file, st, FsdevStatFlag_Size | FsdevStatFlag_TimeStamps);
 }
 
 /*! Hard link a file
@@ -1201,6 +1552,7 @@ fsdev_unlink(struct _reent *r,
     return -1;
 
   rc = fsFsDeleteFile(&device->fs, fs_path);
+  fsdev_statcache_invalidate(device, fs_path);
   if(R_SUCCEEDED(rc))
     return 0;
 
@@ -1287,12 +1639,16 @@ fsdev_rename(struct _reent *r,
     if(type == FsDirEntryType_Dir)
     {
       rc = fsFsRenameDirectory(&device->fs, fs_path_old, fs_path_new);
+      /* every path below the directory changes */
+      fsdev_statcache_flush(device);
       if(R_SUCCEEDED(rc))
       return 0;
     }
     else if(type == FsDirEntryType_File)
     {
       rc = fsFsRenameFile(&device->fs, fs_path_old, fs_path_new);
+      fsdev_statcache_invalidate(device, fs_path_old);
+      fsdev_statcache_invalidate(device, fs_path_new);
       if(R_SUCCEEDED(rc))
       return 0;
     }
@@ -1329,6 +1685,7 @@ fsdev_mkdir(struct _reent *r,
     return -1;
 
   rc = fsFsCreateDirectory(&device->fs, fs_path);
+  fsdev_statcache_invalidate(device, fs_path);
   if(R_SUCCEEDED(rc))
     return 0;
 
@@ -1365,11 +1722,16 @@ fsdev_diropen(struct _reent *r,
   rc = fsFsOpenDirectory(&device->fs, fs_path, FsDirOpenMode_ReadDirs | FsDirOpenMode_ReadFiles, &fd);
   if(R_SUCCEEDED(rc))
   {
-    dir->magic = FSDEV_DIRITER_MAGIC;
-    dir->fd    = fd;
-    dir->index = -1;
-    dir->size  = 0;
-    memset(fsdevDirGetEntries(dir), 0, sizeof(FsDirectoryEntry)*__nx_fsdev_direntry_cache_size);
+    dir->magic    = FSDEV_DIRITER_MAGIC;
+    dir->fd       = fd;
+    dir->index    = -1;
+    dir->size     = 0;
+    dir->entries  = (FsDirectoryEntry*)(void*)(dir+1);
+    dir->capacity = __nx_fsdev_direntry_cache_size;
+    dir->device   = device;
+    dir->path     = __libnx_pool_alloc(strlen(fs_path)+1);
+    if(dir->path != NULL)
+      strcpy(dir->path, fs_path);
     return dirState;
   }
 
@@ -1393,6 +1755,46 @@ fsdev_dirreset(struct _reent *r,
   return -1;
 }
 
+/*! Fetches the next batch of entries of an open directory into its batch buffer
+ *
+ *  The buffer grows each time a full batch is returned, up to
+ *  __nx_fsdev_direntry_max_batch_size entries, so that large directories
+ *  take fewer IPCs without costing small ones any memory.
+ */
+static Result
+fsdev_dir_fill(fsdev_dir_t *dir,
+              s64         *entries)
+{
+  Result rc;
+  bool   full = dir->size == dir->capacity;
+
+  /* reset batch info */
+  dir->index = -1;
+  dir->size  = 0;
+
+  if(full && dir->capacity < __nx_fsdev_direntry_max_batch_size)
+  {
+    size_t capacity = MIN(dir->capacity*2, __nx_fsdev_direntry_max_batch_size);
+    FsDirectoryEntry *buf = __libnx_alloc(sizeof(FsDirectoryEntry)*capacity);
+    if(buf != NULL)
+    {
+      if(dir->entries != (FsDirectoryEntry*)(void*)(dir+1))
+        __libnx_free(dir->entries);
+      dir->entries  = buf;
+      dir->capacity = capacity;
+    }
+  }
+
+  rc = fsDirRead(&dir->fd, entries, dir->capacity, dir->entries);
+  if(R_SUCCEEDED(rc) && *entries > 0)
+  {
+    dir->index = 0;
+    dir->size  = *entries;
+  }
+
+  return rc;
+}
+
 /*! Fetch the next entry of an open directory
  *
  *  @param[in,out] r        newlib reentrancy struct
@@ -1417,9 +1819,6 @@ fsdev_dirnext(struct _reent *r,
   /* get pointer to our data */
   fsdev_dir_t *dir = (fsdev_dir_t*)(dirState->dirStruct);
 
-  const size_t max_entries = __nx_fsdev_direntry_cache_size;
-  FsDirectoryEntry *entry_data = fsdevDirGetEntries(dir);
-
   /* check if it's in the batch already */
   if(++dir->index < dir->size)
   {
@@ -1427,30 +1826,19 @@ fsdev_dirnext(struct _reent *r,
   }
   else
   {
-    /* reset batch info */
-    dir->index = -1;
-    dir->size  = 0;
-
     /* fetch the next batch */
-    memset(entry_data, 0, sizeof(FsDirectoryEntry)*max_entries);
-    rc = fsDirRead(&dir->fd, &entries, max_entries, entry_data);
-    if(R_SUCCEEDED(rc))
+    rc = fsdev_dir_fill(dir, &entries);
+    if(R_SUCCEEDED(rc) && entries == 0)
     {
-      if(entries == 0)
-      {
-        /* there are no more entries; ENOENT signals end-of-directory */
-        r->_errno = ENOENT;
-        return -1;
-      }
-
-      dir->index = 0;
-      dir->size  = entries;
+      /* there are no more entries; ENOENT signals end-of-directory */
+      r->_errno = ENOENT;
+      return -1;
     }
   }
 
   if(R_SUCCEEDED(rc))
   {
-    entry = &entry_data[dir->index];
+    entry = &dir->entries[dir->index];
 
     /* fill in the stat info */
     filestat->st_ino = 0;
@@ -1508,6 +1896,11 @@ fsdev_dirclose(struct _reent *r,
 
   /* close the directory */
   fsDirClose(&dir->fd);
+  if(dir->entries != (FsDirectoryEntry*)(void*)(dir+1))
+    __libnx_free(dir->entries);
+  __libnx_pool_free(dir->path);
+  dir->entries = NULL;
+  dir->path    = NULL;
   if(R_SUCCEEDED(rc))
     return 0;
 
@@ -1515,6 +1908,116 @@ fsdev_dirclose(struct _reent *r,
   return -1;
 }
 
+/*! Fills in a bulk directory entry, and adds it to the stat cache */
+static void
+fsdev_dir_output(fsdev_dir_t            *dir,
+                FsdevDirEntry          *out,
+                const FsDirectoryEntry *entry,
+                u32                    flags,
+                u32                    gen)
+{
+  fsdev_fsdevice  *device = dir->device;
+  fsdev_stat_entry info = {0};
+  char             path[FS_MAX_PATH];
+  size_t           namelen = strnlen(entry->name, FS_MAX_PATH-1);
+
+  memcpy(out->name, entry->name, namelen);
+  out->name[namelen] = '\0';
+  out->type      = entry->type;
+  out->file_size = entry->type == FsDirEntryType_File ? entry->file_size : 0;
+  memset(&out->timestamps, 0, sizeof(out->timestamps));
+
+  if(dir->path == NULL || (!(flags & FsdevReadDirFlag_TimeStamps) && device->stat_cache == NULL))
+    return;
+
+  size_t dirlen = strlen(dir->path);
+  bool   slash  = dirlen == 0 || dir->path[dirlen-1] != '/';
+  if(dirlen + slash + namelen >= FS_MAX_PATH)
+    return;
+
+  memcpy(path, dir->path, dirlen);
+  if(slash)
+    path[dirlen++] = '/';
+  memcpy(&path[dirlen], out->name, namelen+1);
+
+  info.type = out->type;
+  if(out->type == FsDirEntryType_File)
+  {
+    info.has_size = true;
+    info.size     = out->file_size;
+
+    if(flags & FsdevReadDirFlag_TimeStamps)
+    {
+      fsFsGetFileTimeStampRaw(&device->fs, path, &out->timestamps);//Result can be ignored since output is only set on success, etc.
+      info.has_timestamps = true;
+      info.timestamps     = out->timestamps;
+    }
+  }
+
+  fsdev_statcache_update(device, path, fsdev_statcache_hash(path), gen, &info);
+}
+
+ssize_t fsdevReadDirectoryBulk(DIR *dirp, FsdevDirEntry *out, size_t n, u32 flags)
+{
+  struct _reent *r = _REENT;
+  fsdev_dir_t   *dir = NULL;
+  Result         rc = 0;
+  s64            entries = 0;
+  size_t         count = 0;
+
+  if(dirp != NULL && dirp->dirData != NULL)
+    dir = (fsdev_dir_t*)(dirp->dirData->dirStruct);
+  if(dir == NULL || dir->magic != FSDEV_DIRITER_MAGIC)
+  {
+    r->_errno = EBADF;
+    return -1;
+  }
+
+  u32 gen = fsdev_statcache_generation(dir->device);
+
+  /* hand out what is left of the current batch first */
+  while(count < n && dir->index+1 < (ssize_t)dir->size)
+    fsdev_dir_output(dir, &out[count++], &dir->entries[++dir->index], flags, gen);
+
+  if(count < n)
+  {
+    /* Read the rest straight into the output. The raw entries are smaller,
+     * so converting them from the last one backwards never overwrites one
+     * which wasn't converted yet.
+     */
+    _Static_assert(sizeof(FsdevDirEntry) >= sizeof(FsDirectoryEntry), "FsdevDirEntry is too small");
+    FsDirectoryEntry *raw = (FsDirectoryEntry*)(void*)&out[count];
+
+    rc = fsDirRead(&dir->fd, &entries, n - count, raw);
+    if(R_SUCCEEDED(rc))
+    {
+      for(s64 i=entries-1; i>=0; i--)
+      {
+        FsDirectoryEntry tmp = raw[i];
+        fsdev_dir_output(dir, &out[count+i], &tmp, flags, gen);
+      }
+      count += entries;
+    }
+    else if(R_VALUE(rc) == 0xD401)
+    {
+      /* You cannot use FS read/write with certain memory, go through the batch buffer instead. */
+      rc = fsdev_dir_fill(dir, &entries);
+      dir->index = -1;
+      while(R_SUCCEEDED(rc) && count < n && dir->index+1 < (ssize_t)dir->size)
+        fsdev_dir_output(dir, &out[count++], &dir->entries[++dir->index], flags, gen);
+    }
+  }
+
+  /* return partial transfer */
+  if(R_FAILED(rc) && count == 0)
+  {
+    r->_errno = fsdev_translate_error(rc);
+    return -1;
+  }
+
+  return count;
+}
+
 /*! Get filesystem statistics
  *
  *  @param[in,out] r    newlib reentrancy struct
@@ -1592,7 +2095,10 @@ fsdev_ftruncate(struct _reent *r,
   /* set the new file size */
   rc = fsFileSetSize(&file->fd, len);
   if(R_SUCCEEDED(rc))
+  {
+    fsdev_file_modified(file);
     return 0;
+  }
 
   r->_errno = fsdev_translate_error(rc);
   return -1;
@@ -1679,6 +2185,7 @@ fsdev_rmdir(struct _reent *r,
     return -1;
 
   rc = fsFsDeleteDirectory(&device->fs, fs_path);
+  fsdev_statcache_invalidate(device, fs_path);
   if(R_SUCCEEDED(rc))
     return 0;
 
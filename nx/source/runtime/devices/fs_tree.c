@@ -0,0 +1,439 @@
+#include <string.h>
+#include "result.h"
+#include "arm/counter.h"
+#include "kernel/svc.h"
+#include "kernel/mutex.h"
+#include "kernel/condvar.h"
+#include "kernel/thread.h"
+#include "services/fs.h"
+#include "runtime/devices/fs_dev.h"
+#include "../alloc.h"
+
+#define FSDEV_TREE_STACK_SIZE 0x8000
+#define FSDEV_TREE_DIR_BATCH  64
+
+extern u32 __nx_fs_num_sessions;
+
+__attribute__((weak)) u32 __nx_fsdev_copy_chunk_size = 0x80000;
+
+typedef struct FsdevTreeNode FsdevTreeNode;
+
+// Directory waiting to be read.
+struct FsdevTreeNode {
+    FsdevTreeNode* next;
+    u32 depth;
+    char path[];
+};
+
+typedef struct {
+    Mutex mutex;
+    CondVar condvar;
+    FsdevTreeNode* head;
+    FsdevTreeNode* tail;
+    u32 active;             // Directories queued or being read.
+    Result rc;              // First failure.
+
+    FsFileSystem* src_fs;
+    FsFileSystem* dst_fs;   // NULL when walking.
+    char src_root[FS_MAX_PATH];
+    char dst_root[FS_MAX_PATH];
+    size_t src_root_len;
+    FsdevWalkCallback callback;
+    void* userdata;
+
+    u64 num_dirs;
+    u64 num_files;
+    u64 total_size;
+} FsdevTreeCtx;
+
+static void _fsdevTreeFail(FsdevTreeCtx* ctx, Result rc) {
+    mutexLock(&ctx->mutex);
+    if (R_SUCCEEDED(ctx->rc))
+        ctx->rc = rc;
+    condvarWakeAll(&ctx->condvar);
+    mutexUnlock(&ctx->mutex);
+}
+
+static bool _fsdevTreeFailed(FsdevTreeCtx* ctx) {
+    return R_FAILED(__atomic_load_n(&ctx->rc, __ATOMIC_RELAXED));
+}
+
+static Result _fsdevTreePush(FsdevTreeCtx* ctx, const char* path, u32 depth) {
+    size_t len = strlen(path);
+    FsdevTreeNode* node = __libnx_alloc(sizeof(FsdevTreeNode) + len + 1);
+    if (!node)
+        return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+
+    node->next = NULL;
+    node->depth = depth;
+    memcpy(node->path, path, len + 1);
+
+    mutexLock(&ctx->mutex);
+    if (ctx->tail)
+        ctx->tail->next = node;
+    else
+        ctx->head = node;
+    ctx->tail = node;
+    ctx->active++;
+    condvarWakeOne(&ctx->condvar);
+    mutexUnlock(&ctx->mutex);
+
+    return 0;
+}
+
+// Joins a directory path and an entry name. Returns false if the result is too long.
+static bool _fsdevTreeJoin(char* out, const char* dir, const char* name) {
+    size_t dir_len = strlen(dir);
+    size_t name_len = strnlen(name, FS_MAX_PATH);
+    bool slash = dir_len == 0 || dir[dir_len-1] != '/';
+
+    if (dir_len + slash + name_len >= FS_MAX_PATH)
+        return false;
+
+    memcpy(out, dir, dir_len);
+    if (slash)
+        out[dir_len++] = '/';
+    memcpy(&out[dir_len], name, name_len);
+    out[dir_len + name_len] = '\0';
+    return true;
+}
+
+// Maps a source path to the destination tree.
+static bool _fsdevTreeDstPath(FsdevTreeCtx* ctx, char* out, const char* src_path) {
+    const char* rel = src_path + ctx->src_root_len;
+    while (*rel == '/')
+        rel++;
+
+    if (!*rel) {
+        strcpy(out, ctx->dst_root);
+        return true;
+    }
+
+    return _fsdevTreeJoin(out, ctx->dst_root, rel);
+}
+
+static Result _fsdevTreeCopyFile(FsdevTreeCtx* ctx, const char* src_path, const char* dst_path, s64 size, u8* buf) {
+    FsFile src, dst;
+    u64 chunk = __nx_fsdev_copy_chunk_size;
+    u8* bufs[2] = { buf, buf + chunk };
+
+    Result rc = fsFsOpenFile(ctx->src_fs, src_path, FsOpenMode_Read, &src);
+    if (R_FAILED(rc))
+        return rc;
+
+    // Preallocate the destination, or resize it when it already exists.
+    bool exists = false;
+    rc = fsFsCreateFile(ctx->dst_fs, dst_path, size, size >= 0x100000000LL ? FsCreateOption_BigFile : 0);
+    if (R_VALUE(rc) == 0x402) {
+        exists = true;
+        rc = 0;
+    }
+
+    if (R_SUCCEEDED(rc))
+        rc = fsFsOpenFile(ctx->dst_fs, dst_path, FsOpenMode_Write, &dst);
+    if (R_FAILED(rc)) {
+        fsFileClose(&src);
+        return rc;
+    }
+
+    if (exists)
+        rc = fsFileSetSize(&dst, size);
+
+    // Read the first chunk, then read each following chunk while the previous one is written.
+    s64 off = 0;
+    u32 cur = 0;
+    u64 len = size < chunk ? size : chunk;
+    u64 bytes_read = 0;
+
+    if (R_SUCCEEDED(rc) && len) {
+        rc = fsFileRead(&src, 0, bufs[0], len, FsReadOption_None, &bytes_read);
+        if (R_SUCCEEDED(rc) && bytes_read != len)
+            rc = MAKERESULT(Module_Libnx, LibnxError_IoError);
+    }
+
+    while (R_SUCCEEDED(rc) && off < size && !_fsdevTreeFailed(ctx)) {
+        s64 next_off = off + len;
+        u64 next_len = size - next_off < chunk ? size - next_off : chunk;
+        FsAsyncRequest req;
+        bool async = false;
+
+        if (next_len)
+            async = R_SUCCEEDED(fsFileReadAsync(&src, next_off, bufs[cur^1], next_len, FsReadOption_None, &req));
+
+        rc = fsFileWrite(&dst, off, bufs[cur], len, FsWriteOption_None);
+
+        if (async) {
+            Result rc2 = fsAsyncRequestWait(&req, &bytes_read);
+            if (R_SUCCEEDED(rc))
+                rc = rc2;
+        }
+        else if (next_len && R_SUCCEEDED(rc))
+            rc = fsFileRead(&src, next_off, bufs[cur^1], next_len, FsReadOption_None, &bytes_read);
+
+        if (R_SUCCEEDED(rc) && next_len && bytes_read != next_len)
+            rc = MAKERESULT(Module_Libnx, LibnxError_IoError);
+
+        off = next_off;
+        len = next_len;
+        cur ^= 1;
+    }
+
+    if (R_SUCCEEDED(rc))
+        rc = fsFileFlush(&dst);
+
+    fsFileClose(&dst);
+    fsFileClose(&src);
+    return rc;
+}
+
+static Result _fsdevTreeVisit(FsdevTreeCtx* ctx, const char* path, FsDirEntryType type, s64 size, u32 depth, u8* buf) {
+    Result rc = 0;
+    char dst_path[FS_MAX_PATH];
+
+    if (ctx->callback) {
+        FsdevWalkEntry entry = { path, type, type == FsDirEntryType_File ? size : 0, depth };
+        if (!ctx->callback(&entry, ctx->userdata))
+            return 0;
+    }
+
+    if (ctx->dst_fs && !_fsdevTreeDstPath(ctx, dst_path, path))
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    if (type == FsDirEntryType_Dir) {
+        __atomic_add_fetch(&ctx->num_dirs, 1, __ATOMIC_RELAXED);
+
+        // Children are only queued once their parent exists in the destination.
+        if (ctx->dst_fs) {
+            rc = fsFsCreateDirectory(ctx->dst_fs, dst_path);
+            if (R_VALUE(rc) == 0x402)
+                rc = 0;
+        }
+
+        if (R_SUCCEEDED(rc))
+            rc = _fsdevTreePush(ctx, path, depth);
+    }
+    else {
+        __atomic_add_fetch(&ctx->num_files, 1, __ATOMIC_RELAXED);
+
+        if (ctx->dst_fs)
+            rc = _fsdevTreeCopyFile(ctx, path, dst_path, size, buf);
+
+        if (R_SUCCEEDED(rc))
+            __atomic_add_fetch(&ctx->total_size, size, __ATOMIC_RELAXED);
+    }
+
+    return rc;
+}
+
+static Result _fsdevTreeReadDir(FsdevTreeCtx* ctx, FsdevTreeNode* node, FsDirectoryEntry* entries, u8* buf) {
+    FsDir dir;
+    s64 count = 0;
+    char path[FS_MAX_PATH];
+
+    Result rc = fsFsOpenDirectory(ctx->src_fs, node->path, FsDirOpenMode_ReadDirs | FsDirOpenMode_ReadFiles, &dir);
+    if (R_FAILED(rc))
+        return rc;
+
+    do {
+        rc = fsDirRead(&dir, &count, FSDEV_TREE_DIR_BATCH, entries);
+
+        for (s64 i = 0; R_SUCCEEDED(rc) && i < count && !_fsdevTreeFailed(ctx); i++) {
+            if (!_fsdevTreeJoin(path, node->path, entries[i].name))
+                rc = MAKERESULT(Module_Libnx, LibnxError_BadInput);
+            else
+                rc = _fsdevTreeVisit(ctx, path, entries[i].type, entries[i].file_size, node->depth + 1, buf);
+        }
+    } while (R_SUCCEEDED(rc) && count > 0 && !_fsdevTreeFailed(ctx));
+
+    fsDirClose(&dir);
+    return rc;
+}
+
+static void _fsdevTreeWorker(void* arg) {
+    FsdevTreeCtx* ctx = (FsdevTreeCtx*)arg;
+    FsDirectoryEntry* entries = __libnx_alloc(sizeof(FsDirectoryEntry)*FSDEV_TREE_DIR_BATCH);
+    u8* buf = ctx->dst_fs ? __libnx_aligned_alloc(0x1000, 2*(size_t)__nx_fsdev_copy_chunk_size) : NULL;
+
+    if (!entries || (ctx->dst_fs && !buf))
+        _fsdevTreeFail(ctx, MAKERESULT(Module_Libnx, LibnxError_OutOfMemory));
+
+    for (;;) {
+        mutexLock(&ctx->mutex);
+        while (!ctx->head && ctx->active && R_SUCCEEDED(ctx->rc))
+            condvarWait(&ctx->condvar, &ctx->mutex);
+
+        // Done once nothing is queued or being read anymore, since no more directories can show up.
+        FsdevTreeNode* node = ctx->head;
+        if (!node || R_FAILED(ctx->rc)) {
+            mutexUnlock(&ctx->mutex);
+            break;
+        }
+
+        ctx->head = node->next;
+        if (!ctx->head)
+            ctx->tail = NULL;
+        mutexUnlock(&ctx->mutex);
+
+        Result rc = _fsdevTreeReadDir(ctx, node, entries, buf);
+        __libnx_free(node);
+        if (R_FAILED(rc))
+            _fsdevTreeFail(ctx, rc);
+
+        mutexLock(&ctx->mutex);
+        if (--ctx->active == 0)
+            condvarWakeAll(&ctx->condvar);
+        mutexUnlock(&ctx->mutex);
+    }
+
+    __libnx_free(buf);
+    __libnx_free(entries);
+}
+
+static Result _fsdevTreeRun(FsdevTreeCtx* ctx, const char* src, u32 num_threads, FsdevTreeStats* stats) {
+    Thread threads[FSDEV_TREE_MAX_THREADS-1];
+    u32 num_helpers = 0;
+    FsDirEntryType type;
+    u64 start_tick = armGetSystemTick();
+
+    if (num_threads == 0)
+        num_threads = __nx_fs_num_sessions;
+    if (num_threads == 0 || num_threads > FSDEV_TREE_MAX_THREADS)
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    if (fsdevTranslatePath(src, &ctx->src_fs, ctx->src_root)==-1)
+        return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+
+    mutexInit(&ctx->mutex);
+    condvarInit(&ctx->condvar);
+    ctx->src_root_len = strlen(ctx->src_root);
+
+    Result rc = fsFsGetEntryType(ctx->src_fs, ctx->src_root, &type);
+    if (R_SUCCEEDED(rc) && type == FsDirEntryType_File) {
+        // A single file: there is nothing to parallelize.
+        s64 size = 0;
+        FsFile f;
+        rc = fsFsOpenFile(ctx->src_fs, ctx->src_root, FsOpenMode_Read, &f);
+        if (R_SUCCEEDED(rc)) {
+            rc = fsFileGetSize(&f, &size);
+            fsFileClose(&f);
+        }
+
+        u8* buf = NULL;
+        if (R_SUCCEEDED(rc) && ctx->dst_fs) {
+            buf = __libnx_aligned_alloc(0x1000, 2*(size_t)__nx_fsdev_copy_chunk_size);
+            if (!buf)
+                rc = MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+        }
+
+        if (R_SUCCEEDED(rc)) {
+            ctx->callback = NULL;
+            rc = _fsdevTreeVisit(ctx, ctx->src_root, type, size, 0, buf);
+        }
+
+        __libnx_free(buf);
+    }
+    else if (R_SUCCEEDED(rc)) {
+        if (ctx->dst_fs) {
+            rc = fsFsCreateDirectory(ctx->dst_fs, ctx->dst_root);
+            if (R_VALUE(rc) == 0x402)
+                rc = 0;
+        }
+
+        if (R_SUCCEEDED(rc))
+            rc = _fsdevTreePush(ctx, ctx->src_root, 0);
+
+        if (R_SUCCEEDED(rc)) {
+            s32 prio = 0x2C;
+            svcGetThreadPriority(&prio, CUR_THREAD_HANDLE);
+
+            // The calling thread is one of the workers, so failing to create helpers only costs parallelism.
+            for (u32 i = 0; i < num_threads-1; i++) {
+                Thread* t = &threads[num_helpers];
+                if (R_FAILED(threadCreate(t, _fsdevTreeWorker, ctx, NULL, FSDEV_TREE_STACK_SIZE, prio, -2)))
+                    break;
+                if (R_FAILED(threadStart(t))) {
+                    threadClose(t);
+                    break;
+                }
+                num_helpers++;
+            }
+
+            _fsdevTreeWorker(ctx);
+
+            for (u32 i = 0; i < num_helpers; i++) {
+                threadWaitForExit(&threads[i]);
+                threadClose(&threads[i]);
+            }
+
+            // Directories left over after a failure.
+            while (ctx->head) {
+                FsdevTreeNode* node = ctx->head;
+                ctx->head = node->next;
+                __libnx_free(node);
+            }
+
+            rc = ctx->rc;
+        }
+    }
+
+    if (stats) {
+        stats->num_dirs = ctx->num_dirs;
+        stats->num_files = ctx->num_files;
+        stats->total_size = ctx->total_size;
+        stats->elapsed_ns = armTicksToNs(armGetSystemTick() - start_tick);
+        stats->bytes_per_second = stats->elapsed_ns ? (u64)((double)ctx->total_size * 1000000000.0 / stats->elapsed_ns) : 0;
+    }
+
+    return rc;
+}
+
+Result fsdevWalk(const char *path, u32 num_threads, FsdevWalkCallback callback, void *userdata, FsdevTreeStats *stats) {
+    FsdevTreeCtx* ctx = __libnx_alloc(sizeof(FsdevTreeCtx));
+    if (!ctx)
+        return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->callback = callback;
+    ctx->userdata = userdata;
+
+    Result rc = _fsdevTreeRun(ctx, path, num_threads, stats);
+    __libnx_free(ctx);
+    return rc;
+}
+
+static bool _fsdevTreeIsWithin(const char* path, const char* root) {
+    size_t len = strlen(root);
+    while (len && root[len-1] == '/')
+        len--;
+    return strncmp(path, root, len)==0 && (path[len] == '\0' || path[len] == '/');
+}
+
+Result fsdevCopyTree(const char *src, const char *dst, u32 num_threads, FsdevWalkCallback callback, void *userdata, FsdevTreeStats *stats) {
+    if (!__nx_fsdev_copy_chunk_size)
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    FsdevTreeCtx* ctx = __libnx_alloc(sizeof(FsdevTreeCtx));
+    if (!ctx)
+        return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->callback = callback;
+    ctx->userdata = userdata;
+
+    Result rc = 0;
+    if (fsdevTranslatePath(dst, &ctx->dst_fs, ctx->dst_root)==-1 || fsdevTranslatePath(src, &ctx->src_fs, ctx->src_root)==-1)
+        rc = MAKERESULT(Module_Libnx, LibnxError_NotFound);
+
+    // Copying a tree into itself would never end.
+    if (R_SUCCEEDED(rc) && ctx->dst_fs == ctx->src_fs && _fsdevTreeIsWithin(ctx->dst_root, ctx->src_root))
+        rc = MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    if (R_SUCCEEDED(rc))
+        rc = _fsdevTreeRun(ctx, src, num_threads, stats);
+
+    // The copy bypassed fsdev, so drop whatever it cached about the destination.
+    fsdevInvalidateStatCache(dst);
+
+    __libnx_free(ctx);
+    return rc;
+}
@@ -394,7 +394,7 @@ int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struc
     if(numfds <= __nx_pollfd_sb_max_fds)
         pollinfo = (struct pollfd *)alloca(numfds * sizeof(struct pollfd));
     else
-        pollinfo = (struct pollfd *)__libnx_alloc(numfds * sizeof(struct pollfd));
+        pollinfo = (struct pollfd *)__libnx_pool_alloc(numfds * sizeof(struct pollfd));
     if(pollinfo == NULL) {
         errno = ENOMEM;
         return -1;
@@ -465,7 +465,7 @@ int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struc
 
 cleanup:
     if(numfds > __nx_pollfd_sb_max_fds)
-        __libnx_free(pollinfo);
+        __libnx_pool_free(pollinfo);
     return rc;
 }
 
@@ -482,7 +482,7 @@ int poll(struct pollfd *fds, nfds_t nfds, int timeout) {
     if(nfds <= __nx_pollfd_sb_max_fds)
         fds2 = (struct pollfd *)alloca(nfds * sizeof(struct pollfd));
     else
-        fds2 = (struct pollfd *)__libnx_alloc(nfds * sizeof(struct pollfd));
+        fds2 = (struct pollfd *)__libnx_pool_alloc(nfds * sizeof(struct pollfd));
     if(fds2 == NULL) {
         errno = ENOMEM;
         return -1;
@@ -512,7 +512,7 @@ int poll(struct pollfd *fds, nfds_t nfds, int timeout) {
     }
 
     if(nfds > __nx_pollfd_sb_max_fds)
-        __libnx_free(fds2);
+        __libnx_pool_free(fds2);
     return ret;
 }
 
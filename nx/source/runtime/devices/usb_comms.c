@@ -10,6 +10,26 @@
 
 #define TOTAL_INTERFACES 4
 
+// The endpoint report data only covers the last 8 URBs.
+#define PIPELINE_MAX_DEPTH 8
+
+typedef struct {
+    u8 *buffer;
+    u32 depth, urb_size;
+
+    // Ring of posted URBs, oldest first.
+    u32 head, count;
+    u32 urbIds[PIPELINE_MAX_DEPTH];
+    u32 requested[PIPELINE_MAX_DEPTH];
+    u32 sizes[PIPELINE_MAX_DEPTH];
+    bool done[PIPELINE_MAX_DEPTH];
+
+    // Bytes of the oldest completed read URB already returned to the user.
+    u32 offset;
+
+    UsbDsReportData reportdata;
+} usbCommsPipeline;
+
 typedef struct {
     RwLock lock, lock_in, lock_out;
     bool initialized;
@@ -18,8 +38,13 @@ typedef struct {
     UsbDsEndpoint *endpoint_in, *endpoint_out;
 
     u8 *endpoint_in_buffer, *endpoint_out_buffer;
+
+    usbCommsPipeline pipeline_in, pipeline_out;
 } usbCommsInterface;
 
+__attribute__((weak)) u32 __nx_usb_comms_pipeline_depth = 4;
+__attribute__((weak)) u32 __nx_usb_comms_pipeline_urb_size = 0x20000;
+
 static bool g_usbCommsInitialized = false;
 
 static usbCommsInterface g_usbCommsInterfaces[TOTAL_INTERFACES];
@@ -182,6 +207,11 @@ static void _usbCommsInterfaceFree(usbCommsInterface *interface)
     interface->endpoint_in_buffer = NULL;
     interface->endpoint_out_buffer = NULL;
 
+    __libnx_free(interface->pipeline_in.buffer);
+    __libnx_free(interface->pipeline_out.buffer);
+    memset(&interface->pipeline_in, 0, sizeof(interface->pipeline_in));
+    memset(&interface->pipeline_out, 0, sizeof(interface->pipeline_out));
+
     rwlockWriteUnlock(&interface->lock_out);
     rwlockWriteUnlock(&interface->lock_in);
 
@@ -417,7 +447,6 @@ static Result _usbCommsRead(usbCommsInterface *interface, void* buffer, size_t s
         if(((u64)bufptr) & 0xfff)//When bufptr isn't page-aligned copy the data into g_usbComms_endpoint_in_buffer and transfer that, otherwise use the bufptr directly.
         {
             transfer_buffer = interface->endpoint_out_buffer;
-            memset(interface->endpoint_out_buffer, 0, 0x1000);
 
             chunksize = 0x1000;
             chunksize-= ((u64)bufptr) & 0xfff;//After this transfer, bufptr will be page-aligned(if size is large enough for another transfer).
@@ -504,7 +533,6 @@ static Result _usbCommsWrite(usbCommsInterface *interface, const void* buffer, s
         if(((u64)bufptr) & 0xfff)//When bufptr isn't page-aligned copy the data into g_usbComms_endpoint_in_buffer and transfer that, otherwise use the bufptr directly.
         {
             transfer_buffer = interface->endpoint_in_buffer;
-            memset(interface->endpoint_in_buffer, 0, 0x1000);
 
             chunksize = 0x1000;
             chunksize-= ((u64)bufptr) & 0xfff;//After this transfer, bufptr will be page-aligned(if size is large enough for another transfer).
@@ -569,6 +597,235 @@ static Result _usbCommsGetWriteResult(usbCommsInterface *interface, u32 urbId, u
     return usbDsParseReportData(&reportdata, urbId, NULL, transferredSize);
 }
 
+static Result _usbCommsPipelineInit(usbCommsPipeline *pipe)
+{
+    if (pipe->buffer) return 0;
+
+    u32 depth = __nx_usb_comms_pipeline_depth;
+    u32 urb_size = (__nx_usb_comms_pipeline_urb_size + 0xfff) & ~0xfff;
+    if (depth < 1) depth = 1;
+    if (depth > PIPELINE_MAX_DEPTH) depth = PIPELINE_MAX_DEPTH;
+    if (!urb_size) urb_size = 0x1000;
+
+    //The buffers for PostBufferAsync commands must be 0x1000-byte aligned.
+    pipe->buffer = __libnx_aligned_alloc(0x1000, (size_t)depth * urb_size);
+    if (pipe->buffer==NULL) return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+
+    pipe->depth = depth;
+    pipe->urb_size = urb_size;
+    pipe->head = 0;
+    pipe->count = 0;
+    pipe->offset = 0;
+    pipe->reportdata.report_count = 0;
+
+    return 0;
+}
+
+static void _usbCommsPipelineReset(UsbDsEndpoint *endpoint, usbCommsPipeline *pipe)
+{
+    //Drop whatever is still in flight, so that the next transfer starts from a clean ring.
+    if (pipe->count) usbDsEndpoint_Cancel(endpoint);
+
+    pipe->head = 0;
+    pipe->count = 0;
+    pipe->offset = 0;
+    pipe->reportdata.report_count = 0;
+}
+
+static Result _usbCommsPipelinePost(UsbDsEndpoint *endpoint, usbCommsPipeline *pipe, void *buffer, u32 size)
+{
+    u32 slot = (pipe->head + pipe->count) % pipe->depth;
+
+    Result rc = usbDsEndpoint_PostBufferAsync(endpoint, buffer, size, &pipe->urbIds[slot]);
+    if (R_FAILED(rc)) return rc;
+
+    pipe->requested[slot] = size;
+    pipe->sizes[slot] = size;
+    pipe->done[slot] = false;
+    pipe->count++;
+
+    return rc;
+}
+
+static Result _usbCommsPipelineComplete(UsbDsEndpoint *endpoint, usbCommsPipeline *pipe)
+{
+    Result rc=0;
+    u32 slot = pipe->head;
+    u32 tmp_transferredSize = 0;
+
+    if (pipe->done[slot]) return 0;
+
+    for (;;) {
+        //One report covers every URB which completed since it was fetched, so only go back to the service once the oldest one is still pending there.
+        UsbDsReportEntry *entry = NULL;
+        u32 count = pipe->reportdata.report_count;
+        if (count>8) count = 8;
+
+        for (u32 pos=0; pos<count; pos++) {
+            if (pipe->reportdata.report[pos].id == pipe->urbIds[slot]) {
+                entry = &pipe->reportdata.report[pos];
+                break;
+            }
+        }
+
+        //Status 0x3 and above means the URB finished, was cancelled or failed.
+        if (entry && entry->urb_status >= 0x3) break;
+
+        //The event is cleared before fetching the report, so a completion after the fetch always wakes us up again.
+        eventWait(&endpoint->CompletionEvent, UINT64_MAX);
+        eventClear(&endpoint->CompletionEvent);
+
+        rc = usbDsEndpoint_GetReportData(endpoint, &pipe->reportdata);
+        if (R_FAILED(rc)) return rc;
+    }
+
+    rc = usbDsParseReportData(&pipe->reportdata, pipe->urbIds[slot], NULL, &tmp_transferredSize);
+    if (R_FAILED(rc)) return rc;
+
+    if (tmp_transferredSize > pipe->sizes[slot]) tmp_transferredSize = pipe->sizes[slot];
+    pipe->sizes[slot] = tmp_transferredSize;
+    pipe->done[slot] = true;
+
+    return rc;
+}
+
+static void _usbCommsPipelinePop(usbCommsPipeline *pipe)
+{
+    pipe->head = (pipe->head + 1) % pipe->depth;
+    pipe->count--;
+    pipe->offset = 0;
+}
+
+static size_t _usbCommsPipelinePending(usbCommsPipeline *pipe)
+{
+    //Bytes which the ring will still return: the unread part of completed URBs, and the full posted size of pending ones.
+    size_t pending = 0;
+
+    for (u32 i=0; i<pipe->count; i++) {
+        u32 slot = (pipe->head + i) % pipe->depth;
+        pending+= pipe->sizes[slot];
+    }
+
+    return pending - pipe->offset;
+}
+
+static Result _usbCommsReadPipelined(usbCommsInterface *interface, void* buffer, size_t size, size_t *transferredSize)
+{
+    Result rc=0;
+    u8 *bufptr = (u8*)buffer;
+    size_t total_transferredSize=0;
+    usbCommsPipeline *pipe = &interface->pipeline_out;
+    UsbDsEndpoint *endpoint = interface->endpoint_out;
+
+    //Makes sure endpoints are ready for data-transfer / wait for init if needed.
+    rc = usbDsWaitReady(UINT64_MAX);
+    if (R_SUCCEEDED(rc)) rc = _usbCommsPipelineInit(pipe);
+    if (R_FAILED(rc)) return rc;
+
+    while(size)
+    {
+        //Post URBs until the ring covers the rest of the request. URBs only complete once full or on a short packet, so they
+        //are sized from what is left (rounded up to the smallest max packet size), otherwise a transfer which is an exact
+        //multiple of the max packet size without a trailing ZLP would never complete the last one.
+        //URBs left over when returning keep receiving data for the next call.
+        size_t pending = _usbCommsPipelinePending(pipe);
+        while (pipe->count < pipe->depth && pending < size) {
+            u32 slot = (pipe->head + pipe->count) % pipe->depth;
+            u32 chunksize = pipe->urb_size;
+            if (size - pending < chunksize) chunksize = (size - pending + 0x3f) & ~0x3f;
+
+            rc = _usbCommsPipelinePost(endpoint, pipe, pipe->buffer + (size_t)slot * pipe->urb_size, chunksize);
+            if (R_FAILED(rc)) break;
+            pending+= chunksize;
+        }
+        if (R_FAILED(rc)) break;
+
+        //Wait for the oldest transfer to finish.
+        rc = _usbCommsPipelineComplete(endpoint, pipe);
+        if (R_FAILED(rc)) break;
+
+        u32 slot = pipe->head;
+        u32 chunksize = pipe->sizes[slot] - pipe->offset;
+        if (size<chunksize) chunksize = size;
+
+        memcpy(bufptr, pipe->buffer + (size_t)slot * pipe->urb_size + pipe->offset, chunksize);
+        pipe->offset+= chunksize;
+        bufptr+= chunksize;
+        size-= chunksize;
+        total_transferredSize+= chunksize;
+
+        if (pipe->offset == pipe->sizes[slot]) {
+            bool short_transfer = pipe->sizes[slot] < pipe->requested[slot];
+            _usbCommsPipelinePop(pipe);
+            if (short_transfer) break;
+        }
+    }
+
+    if (R_FAILED(rc)) _usbCommsPipelineReset(endpoint, pipe);
+
+    if (transferredSize) *transferredSize = total_transferredSize;
+
+    return rc;
+}
+
+static Result _usbCommsWritePipelined(usbCommsInterface *interface, const void* buffer, size_t size, size_t *transferredSize)
+{
+    Result rc=0;
+    u8 *bufptr = (u8*)buffer;
+    size_t total_transferredSize=0;
+    usbCommsPipeline *pipe = &interface->pipeline_in;
+    UsbDsEndpoint *endpoint = interface->endpoint_in;
+
+    //Makes sure endpoints are ready for data-transfer / wait for init if needed.
+    rc = usbDsWaitReady(UINT64_MAX);
+    if (R_SUCCEEDED(rc)) rc = _usbCommsPipelineInit(pipe);
+    if (R_FAILED(rc)) return rc;
+
+    while(size || pipe->count)
+    {
+        if (size && pipe->count < pipe->depth)
+        {
+            u32 slot = (pipe->head + pipe->count) % pipe->depth;
+            u8 *transfer_buffer = bufptr;
+            u32 chunksize = pipe->urb_size;
+            if (size<chunksize) chunksize = size;
+
+            //Page-aligned data is posted directly, anything else goes through the ring. Either way the data must stay valid until the URB completes, which is guaranteed by draining the ring before returning.
+            if(((u64)bufptr) & 0xfff)
+            {
+                transfer_buffer = pipe->buffer + (size_t)slot * pipe->urb_size;
+                memcpy(transfer_buffer, bufptr, chunksize);
+            }
+
+            //Start a device->host transfer.
+            rc = _usbCommsPipelinePost(endpoint, pipe, transfer_buffer, chunksize);
+            if (R_FAILED(rc)) break;
+
+            bufptr+= chunksize;
+            size-= chunksize;
+            continue;
+        }
+
+        //Wait for the oldest transfer to finish.
+        rc = _usbCommsPipelineComplete(endpoint, pipe);
+        if (R_FAILED(rc)) break;
+
+        u32 tmp_transferredSize = pipe->sizes[pipe->head];
+        bool short_transfer = tmp_transferredSize < pipe->requested[pipe->head];
+        total_transferredSize+= (size_t)tmp_transferredSize;
+        _usbCommsPipelinePop(pipe);
+
+        //Stop queueing after a short transfer, but still collect the ones already in flight.
+        if (short_transfer) size = 0;
+    }
+
+    if (R_FAILED(rc)) _usbCommsPipelineReset(endpoint, pipe);
+
+    if (transferredSize) *transferredSize = total_transferredSize;
+
+    return rc;
+}
+
 size_t usbCommsReadEx(void* buffer, size_t size, u32 interface)
 {
     size_t transferredSize=0;
@@ -756,3 +1013,77 @@ Result usbCommsGetWriteResult(u32 urbId, u32 *transferredSize, u32 interface)
 
     return rc;
 }
+
+size_t usbCommsReadPipelinedEx(void* buffer, size_t size, u32 interface)
+{
+    size_t transferredSize=0;
+    u32 state=0;
+    Result rc, rc2;
+    usbCommsInterface *inter = &g_usbCommsInterfaces[interface];
+    bool initialized;
+
+    if (interface>=TOTAL_INTERFACES) return 0;
+
+    rwlockReadLock(&inter->lock);
+    initialized = inter->initialized;
+    rwlockReadUnlock(&inter->lock);
+    if (!initialized) return 0;
+
+    rwlockWriteLock(&inter->lock_out);
+    rc = _usbCommsReadPipelined(inter, buffer, size, &transferredSize);
+    rwlockWriteUnlock(&inter->lock_out);
+    if (R_FAILED(rc)) {
+        rc2 = usbDsGetState(&state);
+        if (R_SUCCEEDED(rc2)) {
+            if (state!=5) {
+                rwlockWriteLock(&inter->lock_out);
+                rc = _usbCommsReadPipelined(inter, buffer, size, &transferredSize); //If state changed during transfer, try again. usbDsWaitReady() will be called from this.
+                rwlockWriteUnlock(&inter->lock_out);
+            }
+        }
+        if (R_FAILED(rc) && g_usbCommsErrorHandling) diagAbortWithResult(MAKERESULT(Module_Libnx, LibnxError_BadUsbCommsRead));
+    }
+    return transferredSize;
+}
+
+size_t usbCommsReadPipelined(void* buffer, size_t size)
+{
+    return usbCommsReadPipelinedEx(buffer, size, 0);
+}
+
+size_t usbCommsWritePipelinedEx(const void* buffer, size_t size, u32 interface)
+{
+    size_t transferredSize=0;
+    u32 state=0;
+    Result rc, rc2;
+    usbCommsInterface *inter = &g_usbCommsInterfaces[interface];
+    bool initialized;
+
+    if (interface>=TOTAL_INTERFACES) return 0;
+
+    rwlockReadLock(&inter->lock);
+    initialized = inter->initialized;
+    rwlockReadUnlock(&inter->lock);
+    if (!initialized) return 0;
+
+    rwlockWriteLock(&inter->lock_in);
+    rc = _usbCommsWritePipelined(inter, buffer, size, &transferredSize);
+    rwlockWriteUnlock(&inter->lock_in);
+    if (R_FAILED(rc)) {
+        rc2 = usbDsGetState(&state);
+        if (R_SUCCEEDED(rc2)) {
+            if (state!=5) {
+                rwlockWriteLock(&inter->lock_in);
+                rc = _usbCommsWritePipelined(inter, buffer, size, &transferredSize); //If state changed during transfer, try again. usbDsWaitReady() will be called from this.
+                rwlockWriteUnlock(&inter->lock_in);
+            }
+        }
+        if (R_FAILED(rc) && g_usbCommsErrorHandling) diagAbortWithResult(MAKERESULT(Module_Libnx, LibnxError_BadUsbCommsWrite));
+    }
+    return transferredSize;
+}
+
+size_t usbCommsWritePipelined(const void* buffer, size_t size)
+{
+    return usbCommsWritePipelinedEx(buffer, size, 0);
+}
@@ -8,7 +8,10 @@
 #include "services/applet.h"
 #include "services/set.h"
 #include "runtime/diag.h"
+#include "runtime/init.h"
 #include "runtime/devices/fs_dev.h"
+#include "arm/counter.h"
+#include "kernel/thread.h"
 
 void NX_NORETURN __nx_exit(Result rc, LoaderReturnFn retaddr);
 
@@ -101,16 +104,111 @@ void __attribute__((weak)) __libnx_initheap(void)
 void __attribute__((weak)) __nx_win_init(void);
 void __attribute__((weak)) userAppInit(void);
 
+/// Set this to true to initialize independent default services concurrently in \ref __appInit. See \ref initGetTimeline.
+__attribute__((weak)) bool __nx_init_parallel = false;
+
+static InitTimeline g_initTimeline;
+
+const InitTimeline* initGetTimeline(void)
+{
+    return &g_initTimeline;
+}
+
+static inline void _initPhaseBegin(InitPhase phase)
+{
+    g_initTimeline.begin[phase] = armGetSystemTick();
+}
+
+static inline void _initPhaseEnd(InitPhase phase)
+{
+    g_initTimeline.end[phase] = armGetSystemTick();
+}
+
+static Result _initTime(void)
+{
+    _initPhaseBegin(InitPhase_Time);
+    Result rc = timeInitialize();
+    if (R_SUCCEEDED(rc))
+        __libnx_init_time();
+    _initPhaseEnd(InitPhase_Time);
+    return rc;
+}
+
+static Result _initFs(void)
+{
+    _initPhaseBegin(InitPhase_Fs);
+    Result rc = fsInitialize();
+    _initPhaseEnd(InitPhase_Fs);
+
+    if (R_SUCCEEDED(rc)) {
+        _initPhaseBegin(InitPhase_Sdmc);
+        fsdevMountSdmc();
+        _initPhaseEnd(InitPhase_Sdmc);
+    }
+    return rc;
+}
+
+typedef struct {
+    Thread thread;
+    Result (*func)(void);
+    Result rc;
+    bool started;
+} InitHelper;
+
+static void _initHelperEntry(void* arg)
+{
+    InitHelper* h = (InitHelper*)arg;
+    h->rc = h->func();
+}
+
+static void _initHelperStart(InitHelper* h, Result (*func)(void))
+{
+    s32 prio = 0x2C;
+    svcGetThreadPriority(&prio, CUR_THREAD_HANDLE);
+
+    h->func = func;
+    h->rc = 0;
+    h->started = false;
+
+    Result rc = threadCreate(&h->thread, _initHelperEntry, h, NULL, 0x10000, prio, -2);
+    if (R_SUCCEEDED(rc)) {
+        rc = threadStart(&h->thread);
+        if (R_SUCCEEDED(rc))
+            h->started = true;
+        else
+            threadClose(&h->thread);
+    }
+}
+
+static Result _initHelperJoin(InitHelper* h)
+{
+    if (h->started) {
+        threadWaitForExit(&h->thread);
+        threadClose(&h->thread);
+        return h->rc;
+    }
+
+    // Thread creation failed: do the work here instead.
+    return h->func();
+}
+
 void __attribute__((weak)) __appInit(void)
 {
     Result rc;
+    InitHelper time_helper, fs_helper;
+
+    g_initTimeline.start_tick = armGetSystemTick();
+    g_initTimeline.parallel = __nx_init_parallel;
 
     // Initialize default services.
+    _initPhaseBegin(InitPhase_Sm);
     rc = smInitialize();
     if (R_FAILED(rc))
         diagAbortWithResult(MAKERESULT(Module_Libnx, LibnxError_InitFail_SM));
+    _initPhaseEnd(InitPhase_Sm);
 
     if (hosversionGet() == 0) {
+        _initPhaseBegin(InitPhase_HosVersion);
         rc = setsysInitialize();
         if (R_SUCCEEDED(rc)) {
             SetSysFirmwareVersion fw;
@@ -119,33 +217,52 @@ void __attribute__((weak)) __appInit(void)
                 hosversionSet(MAKEHOSVERSION(fw.major, fw.minor, fw.micro));
             setsysExit();
         }
+        _initPhaseEnd(InitPhase_HosVersion);
     }
 
+    // time and fs only depend on sm, so they can be brought up while applet/hid are being initialized.
+    if (g_initTimeline.parallel) {
+        _initHelperStart(&time_helper, _initTime);
+        _initHelperStart(&fs_helper, _initFs);
+    }
+
+    _initPhaseBegin(InitPhase_Applet);
     rc = appletInitialize();
     if (R_FAILED(rc))
         diagAbortWithResult(MAKERESULT(Module_Libnx, LibnxError_InitFail_AM));
+    _initPhaseEnd(InitPhase_Applet);
 
     if (__nx_applet_type != AppletType_None) {
+        _initPhaseBegin(InitPhase_Hid);
         rc = hidInitialize();
         if (R_FAILED(rc))
             diagAbortWithResult(MAKERESULT(Module_Libnx, LibnxError_InitFail_HID));
+        _initPhaseEnd(InitPhase_Hid);
     }
 
-    rc = timeInitialize();
+    rc = g_initTimeline.parallel ? _initHelperJoin(&time_helper) : _initTime();
     if (R_FAILED(rc))
         diagAbortWithResult(MAKERESULT(Module_Libnx, LibnxError_InitFail_Time));
 
-    __libnx_init_time();
-
-    rc = fsInitialize();
+    rc = g_initTimeline.parallel ? _initHelperJoin(&fs_helper) : _initFs();
     if (R_FAILED(rc))
         diagAbortWithResult(MAKERESULT(Module_Libnx, LibnxError_InitFail_FS));
 
-    fsdevMountSdmc();
     __libnx_init_cwd();
 
-    if (&__nx_win_init) __nx_win_init();
-    if (&userAppInit) userAppInit();
+    if (&__nx_win_init) {
+        _initPhaseBegin(InitPhase_Win);
+        __nx_win_init();
+        _initPhaseEnd(InitPhase_Win);
+    }
+
+    if (&userAppInit) {
+        _initPhaseBegin(InitPhase_UserAppInit);
+        userAppInit();
+        _initPhaseEnd(InitPhase_UserAppInit);
+    }
+
+    g_initTimeline.end_tick = armGetSystemTick();
 }
 
 void __attribute__((weak)) userAppExit(void);
@@ -192,6 +309,9 @@ void __attribute__((weak)) NX_NORETURN __libnx_exit(int rc)
     // Clean up services.
     __appExit();
 
+    // Unmap stacks still held by the thread stack pool.
+    threadStackPoolFlush();
+
     __nx_exit(0, envGetExitFuncPtr());
 }
 
@@ -0,0 +1,385 @@
+#include <string.h>
+#include <arm_neon.h>
+#include "result.h"
+#include "kernel/svc.h"
+#include "arm/counter.h"
+#include "runtime/irimage.h"
+#include "alloc.h"
+
+#define IRIMAGE_DEFAULT_POLL_INTERVAL 5000000ULL
+
+typedef struct {
+    u64 sum_x;
+    u64 sum_y;
+    u32 count;
+    u32 sum_intensity;
+    u16 min_x, min_y;
+    u16 max_x, max_y;
+} IrImageClusterAccum;
+
+void irImageThreshold(const u8* src, u8* dst, size_t size, u8 threshold) {
+    uint8x16_t t = vdupq_n_u8(threshold);
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16)
+        vst1q_u8(dst + i, vcgeq_u8(vld1q_u8(src + i), t));
+
+    for (; i < size; i ++)
+        dst[i] = src[i] >= threshold ? 0xFF : 0;
+}
+
+void irImageDownscale2x(const u8* src, u8* dst, u32 width, u32 height) {
+    for (u32 y = 0; y < height/2; y ++) {
+        const u8* row0 = src + (2*y)*width;
+        const u8* row1 = row0 + width;
+        u8* out = dst + y*(width/2);
+        u32 x = 0;
+
+        for (; x + 16 <= width; x += 16) {
+            uint16x8_t sum = vaddq_u16(vpaddlq_u8(vld1q_u8(row0 + x)), vpaddlq_u8(vld1q_u8(row1 + x)));
+            vst1_u8(out + x/2, vrshrn_n_u16(sum, 2));
+        }
+
+        for (; x + 2 <= width; x += 2)
+            out[x/2] = (row0[x] + row0[x+1] + row1[x] + row1[x+1] + 2) >> 2;
+    }
+}
+
+// Sums the intensity and the x-weighted intensity of row[x0..x1).
+static void _irImageRowMoments(const u8* row, u32 x0, u32 x1, u32* out_sum, u32* out_wx) {
+    static const u16 lane_offsets[8] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+    uint32x4_t vsum = vdupq_n_u32(0);
+    uint32x4_t vwx = vdupq_n_u32(0);
+    uint16x8_t idx = vaddq_u16(vld1q_u16(lane_offsets), vdupq_n_u16(x0));
+    uint16x8_t step = vdupq_n_u16(8);
+    u32 x = x0;
+
+    for (; x + 8 <= x1; x += 8) {
+        uint16x8_t p = vmovl_u8(vld1_u8(row + x));
+        vsum = vpadalq_u16(vsum, p);
+        vwx = vmlal_u16(vwx, vget_low_u16(p), vget_low_u16(idx));
+        vwx = vmlal_u16(vwx, vget_high_u16(p), vget_high_u16(idx));
+        idx = vaddq_u16(idx, step);
+    }
+
+    u32 sum = vaddvq_u32(vsum);
+    u32 wx = vaddvq_u32(vwx);
+    for (; x < x1; x ++) {
+        sum += row[x];
+        wx += row[x] * x;
+    }
+
+    *out_sum = sum;
+    *out_wx = wx;
+}
+
+void irImageComputeMoments(const u8* image, u32 width, u32 height, u32 blocks_x, u32 blocks_y, IrsMomentStatistic *out) {
+    for (u32 by = 0; by < blocks_y; by ++) {
+        u32 y0 = by*height/blocks_y, y1 = (by+1)*height/blocks_y;
+
+        for (u32 bx = 0; bx < blocks_x; bx ++) {
+            u32 x0 = bx*width/blocks_x, x1 = (bx+1)*width/blocks_x;
+            u64 sum = 0, sum_x = 0, sum_y = 0;
+
+            for (u32 y = y0; y < y1; y ++) {
+                u32 row_sum, row_wx;
+                _irImageRowMoments(image + y*width, x0, x1, &row_sum, &row_wx);
+                sum += row_sum;
+                sum_x += row_wx;
+                sum_y += (u64)row_sum * y;
+            }
+
+            IrsMomentStatistic *stat = &out[by*blocks_x + bx];
+            u32 pixels = (x1-x0)*(y1-y0);
+            stat->average_intensity = pixels ? (float)sum / pixels : 0.0f;
+            if (sum) {
+                stat->centroid_x = (float)sum_x / sum;
+                stat->centroid_y = (float)sum_y / sum;
+            }
+            else {
+                stat->centroid_x = (x0 + x1) * 0.5f;
+                stat->centroid_y = (y0 + y1) * 0.5f;
+            }
+        }
+    }
+}
+
+// New labels are only created at pixels with no labelled W/NW/N/NE neighbour, so no two of them
+// are adjacent: this bounds the number of provisional labels.
+static u32 _irImageGetMaxLabels(u32 width, u32 height) {
+    u32 max_labels = ((width+1)/2) * ((height+1)/2) + 1;
+    return max_labels > 0xFFFF ? 0xFFFF : max_labels;
+}
+
+size_t irImageGetClusterWorkSize(u32 width, u32 height) {
+    u32 max_labels = _irImageGetMaxLabels(width, height);
+    size_t size = (2*width*sizeof(u16) + 7) &~ 7;
+    size += (max_labels*sizeof(u16) + 7) &~ 7;
+    size += max_labels*sizeof(IrImageClusterAccum);
+    return size;
+}
+
+static u16 _irImageFind(u16* parent, u16 l) {
+    while (parent[l] != l) {
+        parent[l] = parent[parent[l]];
+        l = parent[l];
+    }
+    return l;
+}
+
+static u16 _irImageUnion(u16* parent, u16 a, u16 b) {
+    a = _irImageFind(parent, a);
+    b = _irImageFind(parent, b);
+    if (a < b) {
+        parent[b] = a;
+        return a;
+    }
+    parent[a] = b;
+    return b;
+}
+
+size_t irImageFindClusters(const u8* image, u32 width, u32 height, u8 threshold, u32 min_pixels, IrsClusteringData *out, size_t max_clusters, void* workbuf) {
+    u32 max_labels = _irImageGetMaxLabels(width, height);
+    u16* rows = (u16*)workbuf;
+    u16* parent = (u16*)((u8*)workbuf + ((2*width*sizeof(u16) + 7) &~ 7));
+    IrImageClusterAccum* accum = (IrImageClusterAccum*)((u8*)parent + ((max_labels*sizeof(u16) + 7) &~ 7));
+    u32 num_labels = 1;
+
+    // Only the labels of the previous row are needed, as statistics are accumulated per provisional label.
+    memset(rows, 0, width*sizeof(u16));
+
+    for (u32 y = 0; y < height; y ++) {
+        const u8* row = image + y*width;
+        u16* prev = &rows[((y+1)&1)*width];
+        u16* cur = &rows[(y&1)*width];
+        u32 x = 0;
+
+        while (x < width) {
+            // Skip over runs of background quickly.
+            if (x + 16 <= width && vmaxvq_u8(vld1q_u8(row + x)) < threshold) {
+                memset(&cur[x], 0, 16*sizeof(u16));
+                x += 16;
+                continue;
+            }
+
+            u8 intensity = row[x];
+            u16 label = 0;
+
+            if (intensity >= threshold) {
+                u16 neighbours[4] = {
+                    x > 0 ? cur[x-1] : 0,
+                    x > 0 && y > 0 ? prev[x-1] : 0,
+                    y > 0 ? prev[x] : 0,
+                    x+1 < width && y > 0 ? prev[x+1] : 0,
+                };
+
+                for (u32 i = 0; i < 4; i ++) {
+                    if (!neighbours[i])
+                        continue;
+                    label = label ? _irImageUnion(parent, label, neighbours[i]) : neighbours[i];
+                }
+
+                if (!label && num_labels < max_labels) {
+                    label = num_labels++;
+                    parent[label] = label;
+                    IrImageClusterAccum* a = &accum[label];
+                    memset(a, 0, sizeof(*a));
+                    a->min_x = a->max_x = x;
+                    a->min_y = a->max_y = y;
+                }
+
+                if (label) {
+                    IrImageClusterAccum* a = &accum[label];
+                    a->count ++;
+                    a->sum_intensity += intensity;
+                    a->sum_x += (u64)intensity * x;
+                    a->sum_y += (u64)intensity * y;
+                    if (x < a->min_x) a->min_x = x;
+                    if (x > a->max_x) a->max_x = x;
+                    if (y < a->min_y) a->min_y = y;
+                    if (y > a->max_y) a->max_y = y;
+                }
+            }
+
+            cur[x++] = label;
+        }
+    }
+
+    // Merge the statistics of every provisional label into its root.
+    for (u32 l = num_labels; l-- > 1; ) {
+        u16 root = _irImageFind(parent, l);
+        if (root == l)
+            continue;
+
+        IrImageClusterAccum* a = &accum[root];
+        IrImageClusterAccum* b = &accum[l];
+        a->count += b->count;
+        a->sum_intensity += b->sum_intensity;
+        a->sum_x += b->sum_x;
+        a->sum_y += b->sum_y;
+        if (b->min_x < a->min_x) a->min_x = b->min_x;
+        if (b->max_x > a->max_x) a->max_x = b->max_x;
+        if (b->min_y < a->min_y) a->min_y = b->min_y;
+        if (b->max_y > a->max_y) a->max_y = b->max_y;
+    }
+
+    // Keep the largest clusters, sorted by decreasing pixel count.
+    size_t total = 0;
+    for (u32 l = 1; l < num_labels; l ++) {
+        IrImageClusterAccum* a = &accum[l];
+        if (parent[l] != l || a->count < min_pixels || !a->count)
+            continue;
+
+        size_t pos = total;
+        while (pos > 0 && out[pos-1].pixel_count < a->count)
+            pos --;
+        if (pos >= max_clusters)
+            continue;
+
+        size_t num_move = (total < max_clusters ? total : max_clusters-1) - pos;
+        memmove(&out[pos+1], &out[pos], num_move*sizeof(IrsClusteringData));
+        if (total < max_clusters)
+            total ++;
+
+        IrsClusteringData *c = &out[pos];
+        c->average_intensity = (float)a->sum_intensity / a->count;
+        if (a->sum_intensity) {
+            c->centroid_x = (float)a->sum_x / a->sum_intensity;
+            c->centroid_y = (float)a->sum_y / a->sum_intensity;
+        }
+        else {
+            c->centroid_x = (a->min_x + a->max_x) * 0.5f;
+            c->centroid_y = (a->min_y + a->max_y) * 0.5f;
+        }
+        c->pixel_count = a->count;
+        c->bound_x = a->min_x;
+        c->bound_y = a->min_y;
+        c->boundt_width = a->max_x - a->min_x + 1;
+        c->bound_height = a->max_y - a->min_y + 1;
+    }
+
+    return total;
+}
+
+static void _irImageStreamThreadFunc(void* arg) {
+    IrImageStream* s = (IrImageStream*)arg;
+    u64 last_sampling_number = UINT64_MAX;
+
+    while (!__atomic_load_n(&s->exit_requested, __ATOMIC_ACQUIRE)) {
+        u32 idx = s->writing;
+        Result rc = irsGetImageTransferProcessorState(s->handle, s->buffers[idx], s->size, &s->states[idx]);
+
+        if (R_SUCCEEDED(rc) && s->states[idx].sampling_number != last_sampling_number) {
+            last_sampling_number = s->states[idx].sampling_number;
+
+            // Publish the frame, and reuse the buffer holding the older unacquired one (if any).
+            mutexLock(&s->mutex);
+            s->writing = s->ready;
+            s->ready = idx;
+            s->ready_valid = true;
+            s->last_result = 0;
+            condvarWakeAll(&s->cond);
+            mutexUnlock(&s->mutex);
+            continue;
+        }
+
+        if (R_FAILED(rc)) {
+            mutexLock(&s->mutex);
+            s->last_result = rc;
+            mutexUnlock(&s->mutex);
+        }
+
+        svcSleepThread(s->poll_interval);
+    }
+}
+
+Result irImageStreamCreate(IrImageStream* s, IrsIrCameraHandle handle, size_t size, u64 poll_interval) {
+    memset(s, 0, sizeof(*s));
+    s->handle = handle;
+    s->size = size;
+    s->poll_interval = poll_interval ? poll_interval : IRIMAGE_DEFAULT_POLL_INTERVAL;
+    s->writing = 0;
+    s->ready = 1;
+    s->front = 2;
+    mutexInit(&s->mutex);
+    condvarInit(&s->cond);
+
+    for (u32 i = 0; i < 3; i ++) {
+        s->buffers[i] = (u8*)__libnx_alloc(size);
+        if (!s->buffers[i]) {
+            irImageStreamClose(s);
+            return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+        }
+    }
+
+    s32 prio = 0x2C;
+    svcGetThreadPriority(&prio, CUR_THREAD_HANDLE);
+
+    Result rc = threadCreate(&s->thread, _irImageStreamThreadFunc, s, NULL, 0x4000, prio, -2);
+    if (R_SUCCEEDED(rc)) {
+        rc = threadStart(&s->thread);
+        if (R_FAILED(rc))
+            threadClose(&s->thread);
+    }
+
+    if (R_FAILED(rc)) {
+        s->thread.handle = INVALID_HANDLE;
+        irImageStreamClose(s);
+    }
+
+    return rc;
+}
+
+Result irImageStreamAcquire(IrImageStream* s, const u8** image, IrsImageTransferProcessorState *state, u64 timeout) {
+    Result rc = 0;
+    const bool has_timeout = timeout != UINT64_MAX;
+    u64 deadline = 0;
+
+    if (has_timeout)
+        deadline = armGetSystemTick() + armNsToTicks(timeout); // timeout: ns->ticks
+
+    mutexLock(&s->mutex);
+
+    while (!s->ready_valid && R_SUCCEEDED(rc)) {
+        // Wakeups which didn't produce an image must not extend the total wait.
+        u64 this_timeout = UINT64_MAX;
+        if (has_timeout) {
+            s64 remaining = deadline - armGetSystemTick();
+            if (remaining <= 0) {
+                rc = KERNELRESULT(TimedOut);
+                break;
+            }
+            this_timeout = armTicksToNs(remaining); // ticks->ns
+        }
+
+        rc = condvarWaitTimeout(&s->cond, &s->mutex, this_timeout);
+    }
+
+    if (s->ready_valid) {
+        u32 idx = s->ready;
+        s->ready = s->front;
+        s->front = idx;
+        s->ready_valid = false;
+
+        *image = s->buffers[idx];
+        if (state) *state = s->states[idx];
+        rc = 0;
+    }
+
+    mutexUnlock(&s->mutex);
+    return rc;
+}
+
+void irImageStreamClose(IrImageStream* s) {
+    if (s->thread.handle != INVALID_HANDLE) {
+        __atomic_store_n(&s->exit_requested, true, __ATOMIC_RELEASE);
+        threadWaitForExit(&s->thread);
+        threadClose(&s->thread);
+        s->thread.handle = INVALID_HANDLE;
+    }
+
+    for (u32 i = 0; i < 3; i ++) {
+        __libnx_free(s->buffers[i]);
+        s->buffers[i] = NULL;
+    }
+}
@@ -0,0 +1,209 @@
+#include <string.h>
+#include <math.h>
+#include <arm_neon.h>
+#include "result.h"
+#include "kernel/svc.h"
+#include "runtime/motion.h"
+#include "alloc.h"
+
+#define MOTION_DEFAULT_POLL_INTERVAL 5000000ULL
+#define MOTION_MAX_DELTA_TIME 0.1f
+#define MOTION_TWO_PI 6.28318530717958647692f
+
+static inline float32x4_t _motionNormalize(float32x4_t v) {
+    float norm2 = vaddvq_f32(vmulq_f32(v, v));
+    if (norm2 <= 0.0f)
+        return v;
+    return vmulq_n_f32(v, 1.0f / sqrtf(norm2));
+}
+
+void motionFusionInit(MotionFusion* f, float beta) {
+    f->q[0] = 1.0f;
+    f->q[1] = f->q[2] = f->q[3] = 0.0f;
+    f->beta = beta;
+}
+
+static float32x4_t _motionFusionStep(float32x4_t q, float beta, const HidSixAxisSensorState* st) {
+    float dt = (float)st->delta_time * 1e-9f;
+    if (dt <= 0.0f || dt > MOTION_MAX_DELTA_TIME)
+        return q;
+
+    // Angular velocity is reported in revolutions per second.
+    float gx = st->angular_velocity.x * MOTION_TWO_PI;
+    float gy = st->angular_velocity.y * MOTION_TWO_PI;
+    float gz = st->angular_velocity.z * MOTION_TWO_PI;
+
+    float q0 = vgetq_lane_f32(q, 0);
+    float q1 = vgetq_lane_f32(q, 1);
+    float q2 = vgetq_lane_f32(q, 2);
+    float q3 = vgetq_lane_f32(q, 3);
+
+    // Rate of change of the quaternion from the gyroscope: 0.5 * q * (0, g).
+    const float cw[4] = {  0.0f,  gx,  gy,  gz };
+    const float cx[4] = { -gx,  0.0f, -gz,  gy };
+    const float cy[4] = { -gy,  gz,  0.0f, -gx };
+    const float cz[4] = { -gz, -gy,  gx,  0.0f };
+    float32x4_t qdot = vmulq_n_f32(vld1q_f32(cw), q0);
+    qdot = vmlaq_n_f32(qdot, vld1q_f32(cx), q1);
+    qdot = vmlaq_n_f32(qdot, vld1q_f32(cy), q2);
+    qdot = vmlaq_n_f32(qdot, vld1q_f32(cz), q3);
+    qdot = vmulq_n_f32(qdot, 0.5f);
+
+    float ax = st->acceleration.x;
+    float ay = st->acceleration.y;
+    float az = st->acceleration.z;
+    float anorm2 = ax*ax + ay*ay + az*az;
+
+    // Gradient descent step towards aligning the measured gravity with the estimated one.
+    if (anorm2 > 0.0f) {
+        float recip = 1.0f / sqrtf(anorm2);
+        ax *= recip;
+        ay *= recip;
+        az *= recip;
+
+        float _2q0 = 2.0f*q0, _2q1 = 2.0f*q1, _2q2 = 2.0f*q2, _2q3 = 2.0f*q3;
+        float _4q0 = 4.0f*q0, _4q1 = 4.0f*q1, _4q2 = 4.0f*q2;
+        float _8q1 = 8.0f*q1, _8q2 = 8.0f*q2;
+        float q0q0 = q0*q0, q1q1 = q1*q1, q2q2 = q2*q2, q3q3 = q3*q3;
+
+        const float grad[4] = {
+            _4q0*q2q2 + _2q2*ax + _4q0*q1q1 - _2q1*ay,
+            _4q1*q3q3 - _2q3*ax + 4.0f*q0q0*q1 - _2q0*ay - _4q1 + _8q1*q1q1 + _8q1*q2q2 + _4q1*az,
+            4.0f*q0q0*q2 + _2q0*ax + _4q2*q3q3 - _2q3*ay - _4q2 + _8q2*q1q1 + _8q2*q2q2 + _4q2*az,
+            4.0f*q1q1*q3 - _2q1*ax + 4.0f*q2q2*q3 - _2q2*ay,
+        };
+
+        qdot = vmlsq_n_f32(qdot, _motionNormalize(vld1q_f32(grad)), beta);
+    }
+
+    return _motionNormalize(vmlaq_n_f32(q, qdot, dt));
+}
+
+void motionFusionUpdate(MotionFusion* f, const HidSixAxisSensorState* states, size_t count) {
+    float32x4_t q = vld1q_f32(f->q);
+    for (size_t i = 0; i < count; i ++)
+        q = _motionFusionStep(q, f->beta, &states[i]);
+    vst1q_f32(f->q, q);
+}
+
+static void _motionStreamPush(MotionStream* s, const HidSixAxisSensorState* state) {
+    MotionSample* sample;
+
+    if (s->count == s->capacity) {
+        sample = &s->ring[s->head];
+        s->head = (s->head + 1) % s->capacity;
+        s->total_overwritten ++;
+    }
+    else {
+        sample = &s->ring[(s->head + s->count) % s->capacity];
+        s->count ++;
+    }
+
+    sample->state = *state;
+    sample->gap = 0;
+    if (s->last_sampling_number && state->sampling_number > s->last_sampling_number + 1) {
+        sample->gap = state->sampling_number - s->last_sampling_number - 1;
+        s->total_gap += sample->gap;
+    }
+
+    if (s->use_fusion) {
+        motionFusionUpdate(&s->fusion, state, 1);
+        memcpy(sample->orientation, s->fusion.q, sizeof(sample->orientation));
+    }
+    else
+        memset(sample->orientation, 0, sizeof(sample->orientation));
+
+    s->last_sampling_number = state->sampling_number;
+}
+
+static void _motionStreamThreadFunc(void* arg) {
+    MotionStream* s = (MotionStream*)arg;
+    HidSixAxisSensorState states[17];
+
+    while (!__atomic_load_n(&s->exit_requested, __ATOMIC_ACQUIRE)) {
+        // States are returned newest first.
+        size_t total = hidGetSixAxisSensorStates(s->handle, states, 17);
+
+        mutexLock(&s->mutex);
+
+        // Sampling numbers start over when the controller is reconnected.
+        if (total && states[0].sampling_number < s->last_sampling_number)
+            s->last_sampling_number = 0;
+
+        size_t num_new = 0;
+        while (num_new < total && states[num_new].sampling_number > s->last_sampling_number)
+            num_new ++;
+
+        while (num_new--)
+            _motionStreamPush(s, &states[num_new]);
+
+        mutexUnlock(&s->mutex);
+
+        svcSleepThread(s->poll_interval);
+    }
+}
+
+Result motionStreamCreate(MotionStream* s, HidSixAxisSensorHandle handle, size_t capacity, u64 poll_interval, bool use_fusion) {
+    if (!capacity)
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    memset(s, 0, sizeof(*s));
+    s->handle = handle;
+    s->capacity = capacity;
+    s->poll_interval = poll_interval ? poll_interval : MOTION_DEFAULT_POLL_INTERVAL;
+    s->use_fusion = use_fusion;
+    motionFusionInit(&s->fusion, 0.1f);
+    mutexInit(&s->mutex);
+
+    s->ring = (MotionSample*)__libnx_alloc(capacity * sizeof(MotionSample));
+    if (!s->ring)
+        return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+
+    // Run slightly above the creating thread, so that a busy main loop can't starve the stream.
+    s32 prio = 0x2C;
+    svcGetThreadPriority(&prio, CUR_THREAD_HANDLE);
+    if (prio > 0x1C)
+        prio --;
+
+    Result rc = threadCreate(&s->thread, _motionStreamThreadFunc, s, NULL, 0x4000, prio, -2);
+    if (R_SUCCEEDED(rc)) {
+        rc = threadStart(&s->thread);
+        if (R_FAILED(rc))
+            threadClose(&s->thread);
+    }
+
+    if (R_FAILED(rc)) {
+        __libnx_free(s->ring);
+        s->ring = NULL;
+    }
+
+    return rc;
+}
+
+size_t motionStreamRead(MotionStream* s, MotionSample* samples, size_t count) {
+    mutexLock(&s->mutex);
+
+    if (count > s->count)
+        count = s->count;
+
+    for (size_t i = 0; i < count; i ++) {
+        samples[i] = s->ring[s->head];
+        s->head = (s->head + 1) % s->capacity;
+    }
+    s->count -= count;
+
+    mutexUnlock(&s->mutex);
+    return count;
+}
+
+void motionStreamClose(MotionStream* s) {
+    if (!s->ring)
+        return;
+
+    __atomic_store_n(&s->exit_requested, true, __ATOMIC_RELEASE);
+    threadWaitForExit(&s->thread);
+    threadClose(&s->thread);
+
+    __libnx_free(s->ring);
+    s->ring = NULL;
+}
@@ -9,6 +9,9 @@
 #include <sys/socket.h>
 
 #include "result.h"
+#include "arm/counter.h"
+#include "kernel/mutex.h"
+#include "kernel/condvar.h"
 //#include "kernel/random.h"
 #include "services/sfdnsres.h"
 #include "services/nifm.h"
@@ -64,18 +67,21 @@ Result resolverCancel(u32 handle) {
     return sfdnsresCancelRequest(handle);
 }
 
+static void _resolverCacheRemove(const char *hostname);
+
 Result resolverRemoveHostnameFromCache(const char* hostname) {
-    if (hosversionBefore(5,0,0))
-        return MAKERESULT(Module_Libnx, LibnxError_IncompatSysVer);
+    if (!hostname)
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
 
-    return MAKERESULT(Module_Libnx, LibnxError_NotInitialized); // not implemented
+    // Only the in-process cache, removing from the sfdnsres cache is not implemented.
+    _resolverCacheRemove(hostname);
+    return 0;
 }
 
 Result resolverRemoveIpAddressFromCache(u32 ip) {
-    if (hosversionBefore(5,0,0))
-        return MAKERESULT(Module_Libnx, LibnxError_IncompatSysVer);
-
-    return MAKERESULT(Module_Libnx, LibnxError_NotInitialized); // not implemented
+    // Only the in-process cache, which isn't indexed by address, so everything is dropped.
+    _resolverCacheRemove(NULL);
+    return 0;
 }
 
 static struct hostent *_resolverDeserializeHostent(const void *out_he_serialized) {
@@ -127,7 +133,7 @@ static struct hostent *_resolverDeserializeHostent(const void *out_he_serialized
     pos_addresses = pos;
     pos += addrlen * nb_addresses;
 
-    he = __libnx_alloc(
+    he = __libnx_pool_alloc(
         sizeof(struct hostent)
         + name_size
         + 8 * (nb_aliases + 1 + nb_addresses + 1)
@@ -269,7 +275,7 @@ static struct addrinfo *_resolverDeserializeAddrInfo(size_t *out_len, const stru
 
     size_t subsize1 = hdr->ai_addrlen ? ntohl(hdr->ai_addrlen) : 4;
     size_t subsize2 = strlen((const char *)hdr + sizeof(struct addrinfo_serialized_hdr) + subsize1) + 1;
-    struct addrinfo_node *node = __libnx_alloc(sizeof(struct addrinfo_node) + subsize2);
+    struct addrinfo_node *node = __libnx_pool_alloc(sizeof(struct addrinfo_node) + subsize2);
 
     *out_len = sizeof(struct addrinfo_serialized_hdr) + subsize1 + subsize2;
     if (!node)
@@ -348,14 +354,226 @@ static struct addrinfo *_resolverDeserializeAddrInfoList(struct addrinfo_seriali
     return first;
 }
 
+typedef enum {
+    ResolverCacheType_HostByName = 0,
+    ResolverCacheType_AddrInfo   = 1,
+} ResolverCacheType;
+
+typedef struct ResolverCacheEntry {
+    struct ResolverCacheEntry *next;
+    u32 hash;
+    size_t key_size;
+    void *key;           // type, service discovery flag, then the NUL-terminated hostname and type-specific data
+    bool pending;        // a lookup for this key is in progress, other threads wait for it instead of issuing their own
+    bool discard;        // removed while pending, don't keep the result
+    u64 expire_tick;
+    size_t data_size;
+    void *data;          // serialized sfdnsres output
+} ResolverCacheEntry;
+
+__attribute__((weak)) u64 __nx_resolver_cache_ttl = 0; // in nanoseconds, 0 disables the in-process cache
+__attribute__((weak)) u32 __nx_resolver_cache_max_entries = 32;
+
+static Mutex g_resolverCacheMutex;
+static CondVar g_resolverCacheCondVar;
+static ResolverCacheEntry *g_resolverCacheEntries;
+static u32 g_resolverCacheCount;
+
+static bool _resolverCacheEnabled(void) {
+    return __nx_resolver_cache_ttl && __nx_resolver_cache_max_entries && !g_resolverDisableDnsCache;
+}
+
+static u32 _resolverCacheHash(const void *key, size_t key_size) {
+    const u8 *p = (const u8 *)key;
+    u32 hash = 2166136261u;
+    for (size_t i = 0; i < key_size; i++)
+        hash = (hash ^ p[i]) * 16777619u;
+    return hash;
+}
+
+static void *_resolverCacheMakeKey(size_t *out_size, ResolverCacheType type, const char *name, const char *extra, const void *extra_data, size_t extra_data_size) {
+    size_t name_size = strlen(name) + 1;
+    size_t extra_size = extra ? strlen(extra) + 1 : 1;
+    size_t key_size = 2 + name_size + extra_size + extra_data_size;
+
+    u8 *key = __libnx_alloc(key_size);
+    if (!key)
+        return NULL;
+
+    key[0] = type;
+    key[1] = !g_resolverDisableServiceDiscovery;
+    memcpy(key + 2, name, name_size);
+    if (extra)
+        memcpy(key + 2 + name_size, extra, extra_size);
+    else
+        key[2 + name_size] = 0;
+    if (extra_data_size)
+        memcpy(key + 2 + name_size + extra_size, extra_data, extra_data_size);
+
+    *out_size = key_size;
+    return key;
+}
+
+static void _resolverCacheUnlink(ResolverCacheEntry *entry) {
+    for (ResolverCacheEntry **link = &g_resolverCacheEntries; *link; link = &(*link)->next) {
+        if (*link == entry) {
+            *link = entry->next;
+            g_resolverCacheCount--;
+            break;
+        }
+    }
+
+    __libnx_free(entry->key);
+    __libnx_free(entry->data);
+    __libnx_free(entry);
+}
+
+static bool _resolverCacheMakeRoom(u64 now) {
+    ResolverCacheEntry *victim = NULL;
+
+    while (g_resolverCacheCount >= __nx_resolver_cache_max_entries) {
+        victim = NULL;
+        for (ResolverCacheEntry *entry = g_resolverCacheEntries; entry; entry = entry->next) {
+            if (entry->pending)
+                continue;
+            if (!victim || entry->expire_tick < victim->expire_tick)
+                victim = entry;
+            if (victim->expire_tick <= now)
+                break;
+        }
+
+        // Every entry is being looked up.
+        if (!victim)
+            return false;
+
+        _resolverCacheUnlink(victim);
+    }
+
+    return true;
+}
+
+// Returns true if the result was copied from the cache into out_buf. Otherwise, *out_entry receives an
+// entry that must be completed with _resolverCacheEnd (or NULL if the result can't be cached).
+// The key is owned by the cache after this call.
+static bool _resolverCacheBegin(void *key, size_t key_size, void *out_buf, size_t out_size, ResolverCacheEntry **out_entry) {
+    u32 hash = _resolverCacheHash(key, key_size);
+    bool hit = false;
+
+    *out_entry = NULL;
+
+    mutexLock(&g_resolverCacheMutex);
+
+    for (;;) {
+        ResolverCacheEntry *entry = g_resolverCacheEntries;
+        for (; entry; entry = entry->next) {
+            if (entry->hash == hash && entry->key_size == key_size && !entry->discard && memcmp(entry->key, key, key_size) == 0)
+                break;
+        }
+
+        if (entry && entry->pending) {
+            // Single-flight: wait for the thread doing the same lookup.
+            condvarWait(&g_resolverCacheCondVar, &g_resolverCacheMutex);
+            continue;
+        }
+
+        u64 now = armGetSystemTick();
+        if (entry) {
+            if (entry->expire_tick > now && entry->data_size <= out_size) {
+                memcpy(out_buf, entry->data, entry->data_size);
+                hit = true;
+                break;
+            }
+            _resolverCacheUnlink(entry);
+        }
+
+        if (!_resolverCacheMakeRoom(now))
+            break;
+
+        entry = __libnx_alloc(sizeof(ResolverCacheEntry));
+        if (!entry)
+            break;
+
+        memset(entry, 0, sizeof(*entry));
+        entry->hash = hash;
+        entry->key_size = key_size;
+        entry->key = key;
+        entry->pending = true;
+        entry->next = g_resolverCacheEntries;
+        g_resolverCacheEntries = entry;
+        g_resolverCacheCount++;
+
+        key = NULL;
+        *out_entry = entry;
+        break;
+    }
+
+    mutexUnlock(&g_resolverCacheMutex);
+
+    __libnx_free(key);
+    return hit;
+}
+
+static void _resolverCacheEnd(ResolverCacheEntry *entry, const void *data, size_t data_size) {
+    if (!entry)
+        return;
+
+    mutexLock(&g_resolverCacheMutex);
+
+    entry->pending = false;
+    if (data && !entry->discard)
+        entry->data = __libnx_alloc(data_size);
+
+    if (entry->data) {
+        memcpy(entry->data, data, data_size);
+        entry->data_size = data_size;
+        entry->expire_tick = armGetSystemTick() + armNsToTicks(__nx_resolver_cache_ttl);
+    } else {
+        // Failed lookups aren't cached, the waiting threads will issue their own.
+        _resolverCacheUnlink(entry);
+    }
+
+    condvarWakeAll(&g_resolverCacheCondVar);
+    mutexUnlock(&g_resolverCacheMutex);
+}
+
+static void _resolverCacheRemove(const char *hostname) {
+    mutexLock(&g_resolverCacheMutex);
+
+    for (ResolverCacheEntry *entry = g_resolverCacheEntries, *next; entry; entry = next) {
+        next = entry->next;
+        if (hostname && strcmp((const char *)entry->key + 2, hostname) != 0)
+            continue;
+
+        if (entry->pending)
+            entry->discard = true;
+        else
+            _resolverCacheUnlink(entry);
+    }
+
+    mutexUnlock(&g_resolverCacheMutex);
+}
+
+static size_t _resolverAddrInfoListSize(const struct addrinfo_serialized_hdr *hdr, size_t max_size) {
+    const u8 *start = (const u8 *)hdr;
+
+    while (hdr->magic == htonl(0xBEEFCAFE)) {
+        size_t subsize1 = hdr->ai_addrlen ? ntohl(hdr->ai_addrlen) : 4;
+        const char *canonname = (const char *)hdr + sizeof(struct addrinfo_serialized_hdr) + subsize1;
+        hdr = (const struct addrinfo_serialized_hdr *)(canonname + strlen(canonname) + 1);
+    }
+
+    size_t size = (const u8 *)hdr - start + 4; // Sentinel value
+    return size <= max_size ? size : max_size;
+}
+
 void freehostent(struct hostent *he) {
-    __libnx_free(he);
+    __libnx_pool_free(he);
 }
 
 void freeaddrinfo(struct addrinfo *ai) {
     for (struct addrinfo *node = ai, *next; node; node = next) {
         next = node->ai_next;
-        __libnx_free(node);
+        __libnx_pool_free(node);
     }
 }
 
@@ -379,6 +597,21 @@ struct hostent *gethostbyname(const char *name) {
         return NULL;
     }
 
+    ResolverCacheEntry *cache_entry = NULL;
+    if (_resolverCacheEnabled()) {
+        size_t key_size = 0;
+        void *key = _resolverCacheMakeKey(&key_size, ResolverCacheType_HostByName, name, NULL, NULL, 0);
+        if (key && _resolverCacheBegin(key, key_size, out_serialized, g_resolverHostByNameBufferSize, &cache_entry)) {
+            g_resolverCancelHandle = 0;
+            g_resolverResult = 0;
+            h_errno = NETDB_SUCCESS;
+
+            struct hostent *ret = _resolverDeserializeHostent(out_serialized);
+            __libnx_free(out_serialized);
+            return ret;
+        }
+    }
+
     Result rc = sfdnsresGetHostByNameRequest(
         g_resolverCancelHandle,
         !g_resolverDisableServiceDiscovery,
@@ -400,6 +633,8 @@ struct hostent *gethostbyname(const char *name) {
         h_errno = NETDB_INTERNAL;
     }
 
+    _resolverCacheEnd(cache_entry, h_errno == NETDB_SUCCESS ? out_serialized : NULL, g_resolverHostByNameBufferSize);
+
     struct hostent *ret = NULL;
     if (h_errno == NETDB_SUCCESS)
         ret = _resolverDeserializeHostent(out_serialized);
@@ -517,6 +752,26 @@ int getaddrinfo(const char *node, const char *service, const struct addrinfo *hi
     }
 
     s32 ret = 0;
+    ResolverCacheEntry *cache_entry = NULL;
+    if (_resolverCacheEnabled()) {
+        size_t key_size = 0;
+        void *key = _resolverCacheMakeKey(&key_size, ResolverCacheType_AddrInfo, node ? node : "", service, hints_serialized, hints_sz);
+        if (key && _resolverCacheBegin(key, key_size, out_serialized, g_resolverAddrInfoBufferSize, &cache_entry)) {
+            g_resolverCancelHandle = 0;
+            g_resolverResult = 0;
+            __libnx_free(hints_serialized);
+
+            *res = _resolverDeserializeAddrInfoList(out_serialized);
+            if (!*res) {
+                errno = ENOMEM;
+                ret = EAI_MEMORY;
+            }
+
+            __libnx_free(out_serialized);
+            return ret;
+        }
+    }
+
     Result rc = sfdnsresGetAddrInfoRequest(
         g_resolverCancelHandle,
         !g_resolverDisableServiceDiscovery,
@@ -541,6 +796,9 @@ int getaddrinfo(const char *node, const char *service, const struct addrinfo *hi
         ret = EAI_SYSTEM;
     }
 
+    _resolverCacheEnd(cache_entry, ret == 0 ? out_serialized : NULL,
+        ret == 0 ? _resolverAddrInfoListSize(out_serialized, g_resolverAddrInfoBufferSize) : 0);
+
     if (ret == 0) {
         *res = _resolverDeserializeAddrInfoList(out_serialized);
         if (!*res) {
@@ -1,4 +1,5 @@
 #include "runtime/util/utf.h"
+#include "utf_ascii.h"
 
 ssize_t
 utf16_to_utf8(uint8_t        *out,
@@ -12,6 +13,24 @@ utf16_to_utf8(uint8_t        *out,
 
   do
   {
+    if(utf_is_block_aligned(in) && utf_ascii_block_u16(in))
+    {
+      if(SSIZE_MAX - UTF_ASCII_BLOCK/2 < rc)
+        return -1;
+
+      if(out != NULL && rc < len)
+      {
+        size_t n = len - rc < UTF_ASCII_BLOCK/2 ? len - rc : UTF_ASCII_BLOCK/2;
+        utf_ascii_narrow(out, in, n);
+        out += n;
+      }
+
+      in += UTF_ASCII_BLOCK/2;
+      rc += UTF_ASCII_BLOCK/2;
+      code = 1;
+      continue;
+    }
+
     units = decode_utf16(&code, in);
     if(units == -1)
       return -1;
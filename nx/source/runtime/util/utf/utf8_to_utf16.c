@@ -1,4 +1,5 @@
 #include "runtime/util/utf.h"
+#include "utf_ascii.h"
 
 ssize_t
 utf8_to_utf16(uint16_t      *out,
@@ -12,6 +13,24 @@ utf8_to_utf16(uint16_t      *out,
 
   do
   {
+    if(utf_is_block_aligned(in) && utf_ascii_block_u8(in))
+    {
+      if(SSIZE_MAX - UTF_ASCII_BLOCK < rc)
+        return -1;
+
+      if(out != NULL && rc < len)
+      {
+        size_t n = len - rc < UTF_ASCII_BLOCK ? len - rc : UTF_ASCII_BLOCK;
+        utf_ascii_widen(out, in, n);
+        out += n;
+      }
+
+      in += UTF_ASCII_BLOCK;
+      rc += UTF_ASCII_BLOCK;
+      code = 1;
+      continue;
+    }
+
     units = decode_utf8(&code, in);
     if(units == -1)
       return -1;
@@ -0,0 +1,86 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+/* ASCII fast paths shared by the UTF conversion functions.
+ *
+ * The input is null-terminated, so blocks are only loaded from 16-byte
+ * aligned addresses: such a load never crosses into the next page, even
+ * when it reads past the terminator.
+ */
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define UTF_ASCII_NEON
+#endif
+
+#define UTF_ASCII_BLOCK 16
+
+static inline bool utf_is_block_aligned(const void *p)
+{
+  return ((uintptr_t)p & (UTF_ASCII_BLOCK-1)) == 0;
+}
+
+/* Whether the 16 bytes at p are all in 0x01..0x7F */
+static inline bool utf_ascii_block_u8(const uint8_t *p)
+{
+#ifdef UTF_ASCII_NEON
+  uint8x16_t v = vld1q_u8(p);
+  /* v-1 wraps 0x00 to 0xFF, so a single unsigned compare catches both NUL and non-ASCII */
+  uint8x16_t bad = vcgeq_u8(vsubq_u8(v, vdupq_n_u8(1)), vdupq_n_u8(0x7F));
+  return vmaxvq_u8(bad) == 0;
+#else
+  uint64_t w[2];
+  memcpy(w, p, sizeof(w));
+  const uint64_t ones = 0x0101010101010101ULL, highs = 0x8080808080808080ULL;
+  uint64_t bad = ((w[0] - ones) | w[0]) | ((w[1] - ones) | w[1]);
+  return (bad & highs) == 0;
+#endif
+}
+
+/* Whether the 8 units at p are all in 0x0001..0x007F */
+static inline bool utf_ascii_block_u16(const uint16_t *p)
+{
+#ifdef UTF_ASCII_NEON
+  uint16x8_t v = vld1q_u16(p);
+  uint16x8_t bad = vcgeq_u16(vsubq_u16(v, vdupq_n_u16(1)), vdupq_n_u16(0x7F));
+  return vmaxvq_u16(bad) == 0;
+#else
+  uint64_t w[2];
+  memcpy(w, p, sizeof(w));
+  const uint64_t ones = 0x0001000100010001ULL, highs = 0xFF80FF80FF80FF80ULL;
+  uint64_t bad = ((w[0] - ones) | w[0]) | ((w[1] - ones) | w[1]);
+  return (bad & highs) == 0;
+#endif
+}
+
+/* Widens n (at most 16) ASCII bytes to UTF-16 */
+static inline void utf_ascii_widen(uint16_t *out, const uint8_t *in, size_t n)
+{
+#ifdef UTF_ASCII_NEON
+  if(n == UTF_ASCII_BLOCK)
+  {
+    uint8x16_t v = vld1q_u8(in);
+    vst1q_u16(out, vmovl_u8(vget_low_u8(v)));
+    vst1q_u16(out+8, vmovl_u8(vget_high_u8(v)));
+    return;
+  }
+#endif
+  for(size_t i = 0; i < n; ++i)
+    out[i] = in[i];
+}
+
+/* Narrows n (at most 8) ASCII UTF-16 units to bytes */
+static inline void utf_ascii_narrow(uint8_t *out, const uint16_t *in, size_t n)
+{
+#ifdef UTF_ASCII_NEON
+  if(n == UTF_ASCII_BLOCK/2)
+  {
+    vst1_u8(out, vmovn_u16(vld1q_u16(in)));
+    return;
+  }
+#endif
+  for(size_t i = 0; i < n; ++i)
+    out[i] = in[i];
+}
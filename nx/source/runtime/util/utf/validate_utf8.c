@@ -0,0 +1,31 @@
+#include "runtime/util/utf.h"
+#include "utf_ascii.h"
+
+ssize_t
+validate_utf8(const uint8_t *in)
+{
+  ssize_t  rc = 0;
+  ssize_t  units;
+  uint32_t code;
+
+  do
+  {
+    if(utf_is_block_aligned(in) && utf_ascii_block_u8(in))
+    {
+      in += UTF_ASCII_BLOCK;
+      rc += UTF_ASCII_BLOCK;
+      code = 1;
+      continue;
+    }
+
+    units = decode_utf8(&code, in);
+    if(units == -1)
+      return -1;
+
+    in += units;
+    if(code > 0)
+      rc += units;
+  } while(code > 0);
+
+  return rc;
+}
@@ -1,6 +1,8 @@
 // Copyright 2017 plutoo
 #include <string.h>
 #include "service_guard.h"
+#include "kernel/condvar.h"
+#include "kernel/thread.h"
 #include "sf/sessionmgr.h"
 #include "runtime/hosversion.h"
 #include "services/fs.h"
@@ -12,6 +14,8 @@ static SessionMgr g_fsSessionMgr;
 
 static __thread u32 g_fsPriority = FsPriority_Normal;
 
+static void _fsAsyncCleanup(void);
+
 NX_INLINE bool _fsObjectIsChild(Service* s)
 {
     return s->session == g_fsSrv.session;
@@ -94,6 +98,9 @@ Result _fsInitialize(void) {
 }
 
 void _fsCleanup(void) {
+    // Stop the async workers, which use the sessions below
+    _fsAsyncCleanup();
+
     // Close extra sessions
     sessionmgrClose(&g_fsSessionMgr);
 
@@ -1106,6 +1113,232 @@ void fsStorageClose(FsStorage* s) {
     _fsObjectClose(&s->s);
 }
 
+//-----------------------------------------------------------------------------
+// Asynchronous I/O
+//-----------------------------------------------------------------------------
+
+#define FS_ASYNC_STACK_SIZE        0x4000
+#define FS_ASYNC_MAX_COALESCE      16
+#define FS_ASYNC_MAX_COALESCE_SIZE 0x400000
+
+static struct {
+    Mutex mutex;
+    CondVar work_cv;
+    CondVar space_cv;
+    FsAsyncRequest* head;
+    FsAsyncRequest* tail;
+    u32 num_queued;
+    u32 queue_depth;
+    Thread threads[NX_SESSION_MGR_MAX_SESSIONS];
+    u32 num_threads;
+    bool exit;
+} g_fsAsync;
+
+// Pops the first queued request, plus the queued requests continuing it both on disk and in memory.
+static u32 _fsAsyncPopBatch(FsAsyncRequest** batch) {
+    FsAsyncRequest* req = g_fsAsync.head;
+    g_fsAsync.head = req->next;
+    if (!g_fsAsync.head)
+        g_fsAsync.tail = NULL;
+
+    batch[0] = req;
+    u32 count = 1;
+    s64 end_offset = req->offset + req->size;
+    u8* end_buf = (u8*)req->buf + req->size;
+    u64 total_size = req->size;
+
+    bool found = true;
+    while (found && count < FS_ASYNC_MAX_COALESCE) {
+        found = false;
+        FsAsyncRequest* prev = NULL;
+        for (FsAsyncRequest* cur = g_fsAsync.head; cur; prev = cur, cur = cur->next) {
+            if (cur->s->session != req->s->session || cur->s->object_id != req->s->object_id ||
+                cur->is_storage != req->is_storage || cur->option != req->option || cur->priority != req->priority ||
+                cur->offset != end_offset || cur->buf != end_buf || total_size + cur->size > FS_ASYNC_MAX_COALESCE_SIZE)
+                continue;
+
+            if (prev)
+                prev->next = cur->next;
+            else
+                g_fsAsync.head = cur->next;
+            if (g_fsAsync.tail == cur)
+                g_fsAsync.tail = prev;
+
+            batch[count++] = cur;
+            end_offset += cur->size;
+            end_buf += cur->size;
+            total_size += cur->size;
+            found = true;
+            break;
+        }
+    }
+
+    g_fsAsync.num_queued -= count;
+    return count;
+}
+
+static void _fsAsyncWorker(void* arg) {
+    FsAsyncRequest* batch[FS_ASYNC_MAX_COALESCE];
+
+    for (;;) {
+        mutexLock(&g_fsAsync.mutex);
+        while (!g_fsAsync.head && !g_fsAsync.exit)
+            condvarWait(&g_fsAsync.work_cv, &g_fsAsync.mutex);
+
+        // Exit only once the queue has been drained.
+        if (!g_fsAsync.head) {
+            mutexUnlock(&g_fsAsync.mutex);
+            break;
+        }
+
+        u32 count = _fsAsyncPopBatch(batch);
+        condvarWakeAll(&g_fsAsync.space_cv);
+        mutexUnlock(&g_fsAsync.mutex);
+
+        FsAsyncRequest* first = batch[0];
+        FsAsyncRequest* last = batch[count-1];
+        u64 size = last->offset + last->size - first->offset;
+        u64 bytes_read = size;
+        Result rc;
+
+        g_fsPriority = first->priority;
+        if (first->is_storage)
+            rc = fsStorageRead((FsStorage*)first->s, first->offset, first->buf, size);
+        else
+            rc = fsFileRead((FsFile*)first->s, first->offset, first->buf, size, first->option, &bytes_read);
+
+        // Split the result between the coalesced requests.
+        for (u32 i = 0; i < count; i ++) {
+            FsAsyncRequest* req = batch[i];
+            u64 start = req->offset - first->offset;
+
+            req->result = rc;
+            req->bytes_read = 0;
+            if (R_SUCCEEDED(rc) && bytes_read > start)
+                req->bytes_read = bytes_read - start < req->size ? bytes_read - start : req->size;
+
+            ueventSignal(&req->event);
+        }
+    }
+}
+
+Result fsAsyncInitialize(u32 queue_depth) {
+    if (!serviceIsActive(&g_fsSrv))
+        return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+    if (!queue_depth)
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    mutexLock(&g_fsAsync.mutex);
+    bool initialized = g_fsAsync.num_threads != 0;
+    if (!initialized) {
+        g_fsAsync.queue_depth = queue_depth;
+        g_fsAsync.exit = false;
+    }
+    mutexUnlock(&g_fsAsync.mutex);
+
+    if (initialized)
+        return MAKERESULT(Module_Libnx, LibnxError_AlreadyInitialized);
+
+    s32 prio = 0x2C;
+    svcGetThreadPriority(&prio, CUR_THREAD_HANDLE);
+
+    Result rc = 0;
+    for (u32 i = 0; R_SUCCEEDED(rc) && i < g_fsSessionMgr.num_sessions; i ++) {
+        Thread* t = &g_fsAsync.threads[i];
+        rc = threadCreate(t, _fsAsyncWorker, NULL, NULL, FS_ASYNC_STACK_SIZE, prio, -2);
+        if (R_SUCCEEDED(rc)) {
+            rc = threadStart(t);
+            if (R_FAILED(rc))
+                threadClose(t);
+        }
+        if (R_SUCCEEDED(rc))
+            g_fsAsync.num_threads++;
+    }
+
+    if (R_FAILED(rc))
+        fsAsyncExit();
+
+    return rc;
+}
+
+void fsAsyncExit(void) {
+    mutexLock(&g_fsAsync.mutex);
+    g_fsAsync.exit = true;
+    condvarWakeAll(&g_fsAsync.work_cv);
+    condvarWakeAll(&g_fsAsync.space_cv);
+    mutexUnlock(&g_fsAsync.mutex);
+
+    for (u32 i = 0; i < g_fsAsync.num_threads; i ++) {
+        threadWaitForExit(&g_fsAsync.threads[i]);
+        threadClose(&g_fsAsync.threads[i]);
+    }
+
+    g_fsAsync.num_threads = 0;
+}
+
+static void _fsAsyncCleanup(void) {
+    if (g_fsAsync.num_threads)
+        fsAsyncExit();
+}
+
+static Result _fsAsyncSubmit(FsAsyncRequest* req) {
+    ueventCreate(&req->event, false);
+    req->result = 0;
+    req->bytes_read = 0;
+    req->next = NULL;
+    req->priority = g_fsPriority;
+
+    mutexLock(&g_fsAsync.mutex);
+
+    while (!g_fsAsync.exit && g_fsAsync.num_threads && g_fsAsync.num_queued >= g_fsAsync.queue_depth)
+        condvarWait(&g_fsAsync.space_cv, &g_fsAsync.mutex);
+
+    if (g_fsAsync.exit || !g_fsAsync.num_threads) {
+        mutexUnlock(&g_fsAsync.mutex);
+        return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+    }
+
+    if (g_fsAsync.tail)
+        g_fsAsync.tail->next = req;
+    else
+        g_fsAsync.head = req;
+    g_fsAsync.tail = req;
+    g_fsAsync.num_queued++;
+
+    condvarWakeOne(&g_fsAsync.work_cv);
+    mutexUnlock(&g_fsAsync.mutex);
+    return 0;
+}
+
+Result fsFileReadAsync(FsFile* f, s64 off, void* buf, u64 read_size, u32 option, FsAsyncRequest* req) {
+    req->s = &f->s;
+    req->is_storage = false;
+    req->option = option;
+    req->offset = off;
+    req->buf = buf;
+    req->size = read_size;
+    return _fsAsyncSubmit(req);
+}
+
+Result fsStorageReadAsync(FsStorage* s, s64 off, void* buf, u64 read_size, FsAsyncRequest* req) {
+    req->s = &s->s;
+    req->is_storage = true;
+    req->option = 0;
+    req->offset = off;
+    req->buf = buf;
+    req->size = read_size;
+    return _fsAsyncSubmit(req);
+}
+
+Result fsAsyncRequestWait(FsAsyncRequest* req, u64* bytes_read) {
+    Result rc = waitSingle(waiterForFsAsyncRequest(req), UINT64_MAX);
+    if (R_SUCCEEDED(rc))
+        rc = req->result;
+    if (R_SUCCEEDED(rc) && bytes_read)
+        *bytes_read = req->bytes_read;
+    return rc;
+}
+
 //-----------------------------------------------------------------------------
 // ISaveDataInfoReader
 //-----------------------------------------------------------------------------
@@ -6,6 +6,7 @@
 #include "kernel/shmem.h"
 #include "kernel/mutex.h"
 #include "kernel/rwlock.h"
+#include "arm/counter.h"
 #include "services/applet.h"
 #include "services/hid.h"
 #include "runtime/hosversion.h"
@@ -570,6 +571,175 @@ size_t hidGetSixAxisSensorStates(HidSixAxisSensorHandle handle, HidSixAxisSensor
     return total;
 }
 
+// Reads the entries of a LIFO with a sampling number newer than since, newest first.
+static size_t _hidGetStatesSince(HidCommonLifoHeader *header, void* in_states, size_t max_states, size_t state_offset, size_t sampling_number_offset, void* states, size_t entrysize, size_t count, u64 since, bool *out_dropped) {
+    s32 total_entries = (s32)atomic_load_explicit(&header->count, memory_order_acquire);
+    if (total_entries < 0) total_entries = 0;
+    if (total_entries > count) total_entries = count;
+    s32 tail = (s32)atomic_load_explicit(&header->tail, memory_order_acquire);
+
+    size_t num_read = 0;
+    u64 prev_sampling_number = 0;
+    bool reached_since = false;
+
+    for (s32 i=0; i<total_entries; i++) {
+        s32 entrypos = (tail + max_states - i) % max_states;
+        void* state_entry = (void*)((uintptr_t)in_states + entrypos*(state_offset+entrysize));
+        void* out_state = (void*)((uintptr_t)states + num_read*entrysize);
+
+        // Retry this entry alone if it was being written while we copied it.
+        bool valid = false;
+        for (u32 attempt=0; attempt<4 && !valid; attempt++) {
+            u64 sampling_number0 = atomic_load_explicit((u64*)state_entry, memory_order_acquire);
+            memcpy(out_state, (void*)((uintptr_t)state_entry + state_offset), entrysize);
+            u64 sampling_number1 = atomic_load_explicit((u64*)state_entry, memory_order_acquire);
+            valid = sampling_number0 == sampling_number1;
+        }
+        if (!valid)
+            break;
+
+        u64 sampling_number = *((u64*)((uintptr_t)out_state+sampling_number_offset));
+        if (sampling_number <= since) {
+            reached_since = true;
+            break;
+        }
+
+        // The writer wrapped around onto the older entries: what we have so far is still consistent.
+        if (i>0 && prev_sampling_number - sampling_number != 1)
+            break;
+
+        prev_sampling_number = sampling_number;
+        num_read++;
+    }
+
+    if (out_dropped)
+        *out_dropped = since != 0 && !reached_since && num_read && prev_sampling_number - since > 1;
+
+    return num_read;
+}
+
+static HidNpadCommonLifo* _hidGetNpadSnapshotLifo(HidNpadInternalState *npad, HidNpadIdType id, u32 style_set, u32 *out_style) {
+    if (id == HidNpadIdType_Handheld) {
+        *out_style = HidNpadStyleTag_NpadHandheld;
+        return &npad->handheld_lifo;
+    }
+
+    if (style_set & (HidNpadStyleTag_NpadSystemExt|HidNpadStyleTag_NpadSystem)) {
+        *out_style = style_set & (HidNpadStyleTag_NpadSystemExt|HidNpadStyleTag_NpadSystem);
+        return &npad->system_ext_lifo;
+    }
+    if (style_set & (HidNpadStyleTag_NpadFullKey|HidNpadStyleTag_NpadGc|HidNpadStyleTag_NpadLark|HidNpadStyleTag_NpadLucia|HidNpadStyleTag_NpadLagon|HidNpadStyleTag_NpadLager)) {
+        *out_style = HidNpadStyleTag_NpadFullKey;
+        return &npad->full_key_lifo;
+    }
+    if (style_set & (HidNpadStyleTag_NpadHandheld|HidNpadStyleTag_NpadHandheldLark)) {
+        *out_style = HidNpadStyleTag_NpadHandheld;
+        return &npad->handheld_lifo;
+    }
+    if (style_set & HidNpadStyleTag_NpadJoyDual) {
+        *out_style = HidNpadStyleTag_NpadJoyDual;
+        return &npad->joy_dual_lifo;
+    }
+    if (style_set & HidNpadStyleTag_NpadJoyLeft) {
+        *out_style = HidNpadStyleTag_NpadJoyLeft;
+        return &npad->joy_left_lifo;
+    }
+    if (style_set & HidNpadStyleTag_NpadJoyRight) {
+        *out_style = HidNpadStyleTag_NpadJoyRight;
+        return &npad->joy_right_lifo;
+    }
+    if (style_set & HidNpadStyleTag_NpadPalma) {
+        *out_style = HidNpadStyleTag_NpadPalma;
+        return &npad->palma_lifo;
+    }
+
+    *out_style = 0;
+    return NULL;
+}
+
+void hidInitializeInputSnapshot(HidInputSnapshot *s, const HidNpadIdType *ids, size_t count, bool read_six_axis) {
+    if (count > HID_INPUT_SNAPSHOT_MAX_NPADS)
+        diagAbortWithResult(MAKERESULT(Module_Libnx, LibnxError_BadInput));
+
+    memset(s, 0, sizeof(*s));
+    s->num_npads = count;
+    s->read_six_axis = read_six_axis;
+    for (size_t i=0; i<count; i++)
+        s->npads[i].id = ids[i];
+}
+
+void hidUpdateInputSnapshot(HidInputSnapshot *s) {
+    u64 start_tick = armGetSystemTick();
+
+    for (u32 i=0; i<s->num_npads; i++) {
+        HidNpadSnapshot *snap = &s->npads[i];
+        HidNpadInternalState *npad = _hidGetNpadInternalState(snap->id);
+
+        snap->style_set = atomic_load_explicit(&npad->style_set, memory_order_acquire);
+        snap->num_states = 0;
+        snap->num_six_axis_states[0] = snap->num_six_axis_states[1] = 0;
+        snap->dropped = false;
+        snap->six_axis_dropped[0] = snap->six_axis_dropped[1] = false;
+
+        u32 style = 0;
+        HidNpadCommonLifo *lifo = snap->style_set ? _hidGetNpadSnapshotLifo(npad, snap->id, snap->style_set, &style) : NULL;
+
+        // Sampling numbers are per-LIFO, so start over when switching to different LIFOs.
+        if (style != snap->cursor_style) {
+            snap->cursor_style = style;
+            snap->cursor = 0;
+            snap->six_axis_cursor[0] = snap->six_axis_cursor[1] = 0;
+        }
+
+        if (!lifo)
+            continue;
+
+        snap->num_states = _hidGetStatesSince(&lifo->header, lifo->storage, 17, offsetof(HidNpadCommonStateAtomicStorage,state), offsetof(HidNpadCommonState,sampling_number), snap->states, sizeof(HidNpadCommonState), HID_INPUT_SNAPSHOT_MAX_STATES, snap->cursor, &snap->dropped);
+        if (snap->num_states)
+            snap->cursor = snap->states[0].sampling_number;
+
+        if (!s->read_six_axis)
+            continue;
+
+        HidNpadSixAxisSensorLifo *six_axis_lifos[2] = {NULL, NULL};
+        switch (style) {
+            case HidNpadStyleTag_NpadFullKey:
+            case HidNpadStyleTag_NpadPalma:
+                six_axis_lifos[0] = &npad->full_key_six_axis_sensor_lifo;
+            break;
+
+            case HidNpadStyleTag_NpadHandheld:
+                six_axis_lifos[0] = &npad->handheld_six_axis_sensor_lifo;
+            break;
+
+            case HidNpadStyleTag_NpadJoyDual:
+                six_axis_lifos[0] = &npad->joy_dual_left_six_axis_sensor_lifo;
+                six_axis_lifos[1] = &npad->joy_dual_right_six_axis_sensor_lifo;
+            break;
+
+            case HidNpadStyleTag_NpadJoyLeft:
+                six_axis_lifos[0] = &npad->joy_left_six_axis_sensor_lifo;
+            break;
+
+            case HidNpadStyleTag_NpadJoyRight:
+                six_axis_lifos[0] = &npad->joy_right_six_axis_sensor_lifo;
+            break;
+        }
+
+        for (u32 dev=0; dev<2; dev++) {
+            HidNpadSixAxisSensorLifo *six_axis_lifo = six_axis_lifos[dev];
+            if (!six_axis_lifo)
+                continue;
+
+            snap->num_six_axis_states[dev] = _hidGetStatesSince(&six_axis_lifo->header, six_axis_lifo->storage, 17, offsetof(HidSixAxisSensorStateAtomicStorage,state), offsetof(HidSixAxisSensorState,sampling_number), snap->six_axis_states[dev], sizeof(HidSixAxisSensorState), HID_INPUT_SNAPSHOT_MAX_STATES, snap->six_axis_cursor[dev], &snap->six_axis_dropped[dev]);
+            if (snap->num_six_axis_states[dev])
+                snap->six_axis_cursor[dev] = snap->six_axis_states[dev][0].sampling_number;
+        }
+    }
+
+    s->update_ticks = armGetSystemTick() - start_tick;
+}
+
 void hidInitializeGesture(void) {
     Result rc = _hidActivateGesture();
     if (R_FAILED(rc)) diagAbortWithResult(rc);
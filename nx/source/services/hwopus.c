@@ -196,3 +196,175 @@ static Result _hwopusDecodeInterleaved(HwopusDecoder* decoder, s32 *DecodedDataS
     if (R_SUCCEEDED(rc) && perf) *perf = out.perf;
     return rc;
 }
+
+Result hwopusPcmRingInit(HwopusPcmRing* ring, s16 *buffer, size_t buffer_size, u32 channel_count) {
+    if (!channel_count || buffer_size < HWOPUS_PCM_RING_BUFFER_SIZE(HWOPUS_MAX_FRAME_SAMPLES, channel_count))
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    memset(ring, 0, sizeof(*ring));
+    ring->buffer = buffer;
+    ring->capacity = buffer_size / (channel_count * sizeof(s16)) - HWOPUS_MAX_FRAME_SAMPLES;
+    ring->channel_count = channel_count;
+    return 0;
+}
+
+u32 hwopusPcmRingGetAvailable(HwopusPcmRing* ring) {
+    u64 write_pos = __atomic_load_n(&ring->write_pos, __ATOMIC_ACQUIRE);
+    return write_pos - __atomic_load_n(&ring->read_pos, __ATOMIC_RELAXED);
+}
+
+u32 hwopusPcmRingRead(HwopusPcmRing* ring, s16 *out, u32 count) {
+    u32 avail = hwopusPcmRingGetAvailable(ring);
+    if (count > avail) count = avail;
+
+    u64 read_pos = ring->read_pos;
+    u32 offset = read_pos % ring->capacity;
+    u32 first = ring->capacity - offset;
+    if (first > count) first = count;
+
+    memcpy(out, &ring->buffer[offset*ring->channel_count], first*ring->channel_count*sizeof(s16));
+    if (count > first)
+        memcpy(&out[first*ring->channel_count], ring->buffer, (count-first)*ring->channel_count*sizeof(s16));
+
+    __atomic_store_n(&ring->read_pos, read_pos + count, __ATOMIC_RELEASE);
+    return count;
+}
+
+static Result _hwopusDecodePacket(HwopusDecoder* decoder, bool reset_context, s32 *DecodedDataSize, s32 *DecodedSampleCount, u64 *perf, const void* opusin, size_t opusin_size, s16 *pcmbuf, size_t pcmbuf_size) {
+    *perf = 0;
+    if (hosversionAtLeast(6,0,0)) return _hwopusDecodeInterleaved(decoder, DecodedDataSize, DecodedSampleCount, perf, reset_context, opusin, opusin_size, pcmbuf, pcmbuf_size);
+    if (hosversionAtLeast(4,0,0)) return _hwopusDecodeInterleavedWithPerfOld(decoder, DecodedDataSize, DecodedSampleCount, perf, opusin, opusin_size, pcmbuf, pcmbuf_size);
+    return hwopusDecodeInterleaved(decoder, DecodedDataSize, DecodedSampleCount, opusin, opusin_size, pcmbuf, pcmbuf_size);
+}
+
+static Result _hwopusDecodeBatch(HwopusDecoder* decoder, bool *reset_context, HwopusPcmRing* ring, const void* opusin, size_t opusin_size, HwopusBatchResult* out) {
+    Result rc=0;
+    HwopusBatchResult res={0};
+    const u8 *in = (const u8*)opusin;
+    u32 channels = ring->channel_count;
+    u64 write_pos = ring->write_pos;
+
+    while (opusin_size - res.consumed >= sizeof(HwopusHeader)) {
+        const HwopusHeader *hdr = (const HwopusHeader*)&in[res.consumed];
+        size_t packet_size = sizeof(HwopusHeader) + __builtin_bswap32(hdr->size);
+        if (packet_size > opusin_size - res.consumed)
+            break;
+
+        // Only decode when a packet of any length fits, the part past the end of the ring lands in the tail and is moved to the start.
+        u64 read_pos = __atomic_load_n(&ring->read_pos, __ATOMIC_ACQUIRE);
+        if (ring->capacity - (write_pos - read_pos) < HWOPUS_MAX_FRAME_SAMPLES)
+            break;
+
+        u32 offset = write_pos % ring->capacity;
+        s16 *pcm = &ring->buffer[offset*channels];
+        s32 DecodedDataSize=0, DecodedSampleCount=0;
+        u64 perf=0;
+
+        rc = _hwopusDecodePacket(decoder, *reset_context, &DecodedDataSize, &DecodedSampleCount, &perf, hdr, packet_size, pcm, HWOPUS_MAX_FRAME_SAMPLES*channels*sizeof(s16));
+        if (R_FAILED(rc)) break;
+        if (DecodedSampleCount < 0 || DecodedSampleCount > HWOPUS_MAX_FRAME_SAMPLES) {
+            rc = MAKERESULT(Module_Libnx, LibnxError_BadInput);
+            break;
+        }
+        *reset_context = false;
+
+        if (offset + DecodedSampleCount > ring->capacity)
+            memcpy(ring->buffer, &ring->buffer[ring->capacity*channels], (offset + DecodedSampleCount - ring->capacity)*channels*sizeof(s16));
+
+        write_pos += DecodedSampleCount;
+        __atomic_store_n(&ring->write_pos, write_pos, __ATOMIC_RELEASE);
+
+        res.packets++;
+        res.samples += DecodedSampleCount;
+        res.consumed += packet_size;
+        res.perf += perf;
+    }
+
+    if (out) *out = res;
+    return rc;
+}
+
+Result hwopusDecodeInterleavedBatch(HwopusDecoder* decoder, HwopusPcmRing* ring, const void* opusin, size_t opusin_size, HwopusBatchResult* out) {
+    bool reset_context=false;
+    return _hwopusDecodeBatch(decoder, &reset_context, ring, opusin, opusin_size, out);
+}
+
+Result hwopusDecoderPoolCreate(HwopusDecoderPool* pool, u32 num_decoders, s32 SampleRate, s32 ChannelCount) {
+    Result rc=0;
+
+    if (!num_decoders || num_decoders > HWOPUS_POOL_MAX_DECODERS)
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    memset(pool, 0, sizeof(*pool));
+    mutexInit(&pool->mutex);
+    condvarInit(&pool->condvar);
+
+    for (u32 i=0; i<num_decoders; i++) {
+        rc = hwopusDecoderInitialize(&pool->slots[i].decoder, SampleRate, ChannelCount);
+        if (R_FAILED(rc)) break;
+        pool->num_decoders++;
+    }
+
+    if (R_FAILED(rc)) hwopusDecoderPoolClose(pool);
+    return rc;
+}
+
+void hwopusDecoderPoolClose(HwopusDecoderPool* pool) {
+    for (u32 i=0; i<pool->num_decoders; i++)
+        hwopusDecoderExit(&pool->slots[i].decoder);
+    pool->num_decoders = 0;
+}
+
+static HwopusDecoderPoolSlot* _hwopusDecoderPoolAcquire(HwopusDecoderPool* pool, u64 stream_id, bool *reset_context, u64 *prev_owner) {
+    HwopusDecoderPoolSlot *slot = NULL;
+
+    mutexLock(&pool->mutex);
+    for (;;) {
+        HwopusDecoderPoolSlot *idle = NULL;
+        for (u32 i=0; i<pool->num_decoders; i++) {
+            HwopusDecoderPoolSlot *cur = &pool->slots[i];
+            if (cur->busy) continue;
+            if (cur->has_owner && cur->owner == stream_id) {
+                slot = cur;
+                break;
+            }
+            // Prefer decoders which were never used, so that their streams keep their context.
+            if (!idle || (idle->has_owner && !cur->has_owner))
+                idle = cur;
+        }
+
+        if (!slot) slot = idle;
+        if (slot) break;
+        condvarWait(&pool->condvar, &pool->mutex);
+    }
+
+    *reset_context = slot->has_owner && slot->owner != stream_id;
+    *prev_owner = slot->owner;
+    slot->owner = stream_id;
+    slot->has_owner = true;
+    slot->busy = true;
+    mutexUnlock(&pool->mutex);
+
+    return slot;
+}
+
+Result hwopusDecoderPoolDecodeBatch(HwopusDecoderPool* pool, u64 stream_id, HwopusPcmRing* ring, const void* opusin, size_t opusin_size, HwopusBatchResult* out) {
+    if (!pool->num_decoders)
+        return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+
+    bool reset_context=false;
+    u64 prev_owner=0;
+    HwopusDecoderPoolSlot *slot = _hwopusDecoderPoolAcquire(pool, stream_id, &reset_context, &prev_owner);
+
+    Result rc = _hwopusDecodeBatch(&slot->decoder, &reset_context, ring, opusin, opusin_size, out);
+
+    mutexLock(&pool->mutex);
+    slot->busy = false;
+    // Nothing was decoded, so the decoder still holds the context of the previous stream.
+    if (reset_context)
+        slot->owner = prev_owner;
+    condvarWakeOne(&pool->condvar);
+    mutexUnlock(&pool->mutex);
+
+    return rc;
+}
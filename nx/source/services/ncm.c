@@ -1,8 +1,14 @@
 #define NX_SERVICE_ASSUME_NON_DOMAIN
 #include <string.h>
 #include "service_guard.h"
+#include "arm/counter.h"
+#include "kernel/mutex.h"
+#include "kernel/condvar.h"
+#include "kernel/thread.h"
 #include "runtime/hosversion.h"
 #include "services/ncm.h"
+#include "crypto/sha256.h"
+#include "../runtime/alloc.h"
 
 static Service g_ncmSrv;
 
@@ -179,6 +185,188 @@ Result ncmContentStorageWritePlaceHolder(NcmContentStorage* cs, const NcmPlaceHo
     );
 }
 
+#define NCM_INSTALL_STACK_SIZE 0x4000
+
+typedef struct {
+    NcmContentStorage* cs;
+    const NcmPlaceHolderId* placeholder_id;
+
+    Mutex mutex;
+    CondVar cond;
+
+    u8* buffers;
+    size_t buffer_size;
+    u32 buffer_count;
+    size_t* sizes;
+
+    // Sequence numbers of the chunks read / hashed / written so far.
+    u64 filled, hashed, written;
+    bool eof;
+    Result rc;
+
+    Sha256Context sha;
+    u64 hash_ticks, write_ticks;
+} NcmInstallContext;
+
+__attribute__((weak)) u32 __nx_ncm_install_buffer_count = 4;
+__attribute__((weak)) size_t __nx_ncm_install_buffer_size = 0x100000;
+
+// Waits until the chunk with the given sequence number was read, returns false when there is nothing left to do.
+static bool _ncmInstallWaitFilled(NcmInstallContext* ctx, u64 seq) {
+    mutexLock(&ctx->mutex);
+    while (R_SUCCEEDED(ctx->rc) && seq >= ctx->filled && !ctx->eof)
+        condvarWait(&ctx->cond, &ctx->mutex);
+    bool ret = R_SUCCEEDED(ctx->rc) && seq < ctx->filled;
+    mutexUnlock(&ctx->mutex);
+    return ret;
+}
+
+static void _ncmInstallFinish(NcmInstallContext* ctx, u64* counter, Result rc) {
+    mutexLock(&ctx->mutex);
+    if (R_FAILED(rc)) {
+        if (R_SUCCEEDED(ctx->rc)) ctx->rc = rc;
+    } else {
+        (*counter)++;
+    }
+    condvarWakeAll(&ctx->cond);
+    mutexUnlock(&ctx->mutex);
+}
+
+static void _ncmInstallHashThread(void* arg) {
+    NcmInstallContext* ctx = (NcmInstallContext*)arg;
+
+    for (u64 seq = 0; _ncmInstallWaitFilled(ctx, seq); seq++) {
+        u32 slot = seq % ctx->buffer_count;
+        u64 tick = armGetSystemTick();
+        sha256ContextUpdate(&ctx->sha, ctx->buffers + slot * ctx->buffer_size, ctx->sizes[slot]);
+        ctx->hash_ticks += armGetSystemTick() - tick;
+        _ncmInstallFinish(ctx, &ctx->hashed, 0);
+    }
+}
+
+static void _ncmInstallWriteThread(void* arg) {
+    NcmInstallContext* ctx = (NcmInstallContext*)arg;
+    u64 offset = 0;
+
+    for (u64 seq = 0; _ncmInstallWaitFilled(ctx, seq); seq++) {
+        u32 slot = seq % ctx->buffer_count;
+        u64 tick = armGetSystemTick();
+        Result rc = ncmContentStorageWritePlaceHolder(ctx->cs, ctx->placeholder_id, offset, ctx->buffers + slot * ctx->buffer_size, ctx->sizes[slot]);
+        ctx->write_ticks += armGetSystemTick() - tick;
+        offset += ctx->sizes[slot];
+        _ncmInstallFinish(ctx, &ctx->written, rc);
+    }
+}
+
+Result ncmContentStorageWritePlaceHolderFromStream(NcmContentStorage* cs, const NcmPlaceHolderId* placeholder_id, const NcmContentId* content_id, NcmInstallReadFunc read_func, void* userdata, NcmInstallStats* out_stats) {
+    Result rc = 0;
+    NcmInstallContext ctx = {0};
+    Thread threads[2];
+    u32 num_threads = 0;
+    s32 prio = 0x2C;
+    u64 read_ticks = 0, total = 0;
+    u64 start_tick = armGetSystemTick();
+
+    ctx.cs = cs;
+    ctx.placeholder_id = placeholder_id;
+    ctx.buffer_count = __nx_ncm_install_buffer_count ? __nx_ncm_install_buffer_count : 1;
+    // WritePlaceHolder maps the data, keep the chunks page-aligned.
+    ctx.buffer_size = (__nx_ncm_install_buffer_size + 0xFFF) & ~0xFFF;
+    if (!ctx.buffer_size) ctx.buffer_size = 0x1000;
+    mutexInit(&ctx.mutex);
+    condvarInit(&ctx.cond);
+    sha256ContextCreate(&ctx.sha);
+
+    ctx.buffers = (u8*)__libnx_aligned_alloc(0x1000, ctx.buffer_count * ctx.buffer_size);
+    ctx.sizes = (size_t*)__libnx_alloc(ctx.buffer_count * sizeof(size_t));
+    if (!ctx.buffers || !ctx.sizes) rc = MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+
+    if (R_SUCCEEDED(rc)) {
+        svcGetThreadPriority(&prio, CUR_THREAD_HANDLE);
+
+        void (*funcs[2])(void*) = { _ncmInstallHashThread, _ncmInstallWriteThread };
+        for (u32 i = 0; i < 2 && R_SUCCEEDED(rc); i++) {
+            rc = threadCreate(&threads[i], funcs[i], &ctx, NULL, NCM_INSTALL_STACK_SIZE, prio, -2);
+            if (R_SUCCEEDED(rc)) {
+                rc = threadStart(&threads[i]);
+                if (R_FAILED(rc)) threadClose(&threads[i]);
+                else num_threads++;
+            }
+        }
+    }
+
+    // The calling thread reads, the chunks are hashed and written in parallel by the helper threads.
+    for (u64 seq = 0; R_SUCCEEDED(rc); seq++) {
+        u32 slot = seq % ctx.buffer_count;
+
+        // Wait for the slot to be released by both the hasher and the writer.
+        mutexLock(&ctx.mutex);
+        while (R_SUCCEEDED(ctx.rc) && seq - (ctx.hashed < ctx.written ? ctx.hashed : ctx.written) >= ctx.buffer_count)
+            condvarWait(&ctx.cond, &ctx.mutex);
+        rc = ctx.rc;
+        mutexUnlock(&ctx.mutex);
+        if (R_FAILED(rc)) break;
+
+        size_t size = 0;
+        u64 tick = armGetSystemTick();
+        rc = read_func(userdata, ctx.buffers + slot * ctx.buffer_size, ctx.buffer_size, &size);
+        read_ticks += armGetSystemTick() - tick;
+        if (size > ctx.buffer_size) size = ctx.buffer_size;
+
+        mutexLock(&ctx.mutex);
+        if (R_FAILED(rc)) {
+            if (R_SUCCEEDED(ctx.rc)) ctx.rc = rc;
+        } else if (!size) {
+            ctx.eof = true;
+        } else {
+            ctx.sizes[slot] = size;
+            ctx.filled++;
+            total += size;
+        }
+        condvarWakeAll(&ctx.cond);
+        mutexUnlock(&ctx.mutex);
+
+        if (!size) break;
+    }
+
+    // Wake up the helper threads if the loop above stopped on an error of its own.
+    if (R_FAILED(rc)) {
+        mutexLock(&ctx.mutex);
+        if (R_SUCCEEDED(ctx.rc)) ctx.rc = rc;
+        condvarWakeAll(&ctx.cond);
+        mutexUnlock(&ctx.mutex);
+    }
+
+    for (u32 i = 0; i < num_threads; i++) {
+        threadWaitForExit(&threads[i]);
+        threadClose(&threads[i]);
+    }
+
+    if (R_SUCCEEDED(rc)) rc = ctx.rc;
+
+    if (R_SUCCEEDED(rc) && content_id) {
+        u8 hash[SHA256_HASH_SIZE];
+        sha256ContextGetHash(&ctx.sha, hash);
+        // A ContentId is the first half of the SHA-256 of the content.
+        if (memcmp(hash, content_id->c, sizeof(content_id->c)) != 0)
+            rc = MAKERESULT(Module_Libnx, LibnxError_HashMismatch);
+    }
+
+    if (out_stats) {
+        u64 elapsed_ns = armTicksToNs(armGetSystemTick() - start_tick);
+        out_stats->total_size = total;
+        out_stats->elapsed_ns = elapsed_ns;
+        out_stats->read_ns = armTicksToNs(read_ticks);
+        out_stats->hash_ns = armTicksToNs(ctx.hash_ticks);
+        out_stats->write_ns = armTicksToNs(ctx.write_ticks);
+        out_stats->mb_per_sec = elapsed_ns ? (double)total * 1000.0 / (double)elapsed_ns : 0.0;
+    }
+
+    __libnx_free(ctx.sizes);
+    __libnx_free(ctx.buffers);
+    return rc;
+}
+
 Result ncmContentStorageRegister(NcmContentStorage* cs, const NcmContentId* content_id, const NcmPlaceHolderId* placeholder_id) {
     if (hosversionBefore(16,0,0)) {
         const struct {
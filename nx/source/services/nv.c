@@ -143,21 +143,27 @@ Result nvOpen(u32 *fd, const char *devicepath) {
 
 // Get the appropriate session for the specified request (same logic as official sw)
 static inline Service* _nvGetSessionForRequest(u32 request) {
-    u32 tmp = request & 0xC000FFFF;
-    if (
-        tmp     == 0xC0004402 ||                // NVGPU_DBG_GPU_IOCTL_REG_OPS
-        tmp     == 0xC000471C ||                // NVGPU_GPU_IOCTL_GET_GPU_TIME
-        tmp     == 0xC0004808 ||                // NVGPU_IOCTL_CHANNEL_SUBMIT_GPFIFO
-        tmp     == 0xC0000024 ||                // NVHOST_IOCTL_CHANNEL_SUBMIT_EX
-        tmp     == 0xC0000025 ||                // NVHOST_IOCTL_CHANNEL_MAP_CMD_BUFFER_EX
-        tmp     == 0xC0000026 ||                // NVHOST_IOCTL_CHANNEL_UNMAP_CMD_BUFFER_EX
-        request == 0xC018481B ||                // NVGPU_IOCTL_CHANNEL_KICKOFF_PB
-        request == 0xC004001C ||                // NVHOST_IOCTL_CTRL_EVENT_SIGNAL
-        request == 0xC010001E ||                // NVHOST_IOCTL_CTRL_EVENT_WAIT_ASYNC
-        request == 0xC4C80203 ||                // NVDISP_FLIP
-        request == 0x400C060E                   // NVSCHED_CTRL_PUT_CONDUCTOR_FLIP_FENCE
-        )
-        return &g_nvSrvClone;
+    // Requests matched regardless of their argument size.
+    switch (request & 0xC000FFFF) {
+        case 0xC0004402:                        // NVGPU_DBG_GPU_IOCTL_REG_OPS
+        case 0xC000471C:                        // NVGPU_GPU_IOCTL_GET_GPU_TIME
+        case 0xC0004808:                        // NVGPU_IOCTL_CHANNEL_SUBMIT_GPFIFO
+        case 0xC0000024:                        // NVHOST_IOCTL_CHANNEL_SUBMIT_EX
+        case 0xC0000025:                        // NVHOST_IOCTL_CHANNEL_MAP_CMD_BUFFER_EX
+        case 0xC0000026:                        // NVHOST_IOCTL_CHANNEL_UNMAP_CMD_BUFFER_EX
+            return &g_nvSrvClone;
+    }
+
+    // Requests matched exactly.
+    switch (request) {
+        case 0xC018481B:                        // NVGPU_IOCTL_CHANNEL_KICKOFF_PB
+        case 0xC004001C:                        // NVHOST_IOCTL_CTRL_EVENT_SIGNAL
+        case 0xC010001E:                        // NVHOST_IOCTL_CTRL_EVENT_WAIT_ASYNC
+        case 0xC4C80203:                        // NVDISP_FLIP
+        case 0x400C060E:                        // NVSCHED_CTRL_PUT_CONDUCTOR_FLIP_FENCE
+            return &g_nvSrvClone;
+    }
+
     return &g_nvSrv;
 }
 
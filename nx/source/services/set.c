@@ -1,19 +1,24 @@
 #define NX_SERVICE_ASSUME_NON_DOMAIN
 #include <string.h>
 #include "service_guard.h"
+#include "kernel/rwlock.h"
 #include "runtime/hosversion.h"
 #include "services/set.h"
 #include "services/applet.h"
+#include "../runtime/alloc.h"
 
 static Service g_setSrv;
 static Service g_setsysSrv;
 static Service g_setcalSrv;
 
+__attribute__((weak)) bool __nx_set_cache = false;
+
 static bool g_setLanguageCodesInitialized;
 static u64 g_setLanguageCodes[0x40];
 static s32 g_setLanguageCodesTotal;
 
 static Result _setMakeLanguageCode(s32 Language, u64 *LanguageCode);
+static Result _setCacheInvalidateAfter(Result rc);
 
 NX_GENERATE_SERVICE_GUARD(set);
 
@@ -24,6 +29,8 @@ Result _setInitialize(void) {
 }
 
 void _setCleanup(void) {
+    // Settings may change before the next initialization.
+    setCacheInvalidate();
     serviceClose(&g_setSrv);
 }
 
@@ -38,6 +45,8 @@ Result _setsysInitialize(void) {
 }
 
 void _setsysCleanup(void) {
+    // Settings may change before the next initialization.
+    setCacheInvalidate();
     serviceClose(&g_setsysSrv);
 }
 
@@ -99,7 +108,7 @@ static Result _setCmdNoInOutUuid(Service* srv, Uuid *out, u32 cmd_id) {
 }
 
 static Result _setCmdInU8NoOut(Service* srv, u8 inval, u64 cmd_id) {
-    return serviceDispatchIn(srv, cmd_id, inval);
+    return _setCacheInvalidateAfter(serviceDispatchIn(srv, cmd_id, inval));
 }
 
 static Result _setCmdInBoolNoOut(Service* srv, bool inval, u32 cmd_id) {
@@ -107,15 +116,15 @@ static Result _setCmdInBoolNoOut(Service* srv, bool inval, u32 cmd_id) {
 }
 
 static Result _setCmdInU32NoOut(Service* srv, u32 inval, u32 cmd_id) {
-    return serviceDispatchIn(srv, cmd_id, inval);
+    return _setCacheInvalidateAfter(serviceDispatchIn(srv, cmd_id, inval));
 }
 
 static Result _setCmdInU64NoOut(Service* srv, u64 inval, u32 cmd_id) {
-    return serviceDispatchIn(srv, cmd_id, inval);
+    return _setCacheInvalidateAfter(serviceDispatchIn(srv, cmd_id, inval));
 }
 
 static Result _setCmdInUuidNoOut(Service* srv, const Uuid *inval, u32 cmd_id) {
-    return serviceDispatchIn(srv, cmd_id, *inval);
+    return _setCacheInvalidateAfter(serviceDispatchIn(srv, cmd_id, *inval));
 }
 
 static Result _setCmdOutBufAliasFixed(Service* srv, void* buffer, size_t size, u32 cmd_id) {
@@ -125,6 +134,166 @@ static Result _setCmdOutBufAliasFixed(Service* srv, void* buffer, size_t size, u
     );
 }
 
+typedef struct {
+    Service* srv;
+    u32 cmd_id;
+    char name[SET_MAX_NAME_SIZE];     ///< Settings items only.
+    char item_key[SET_MAX_NAME_SIZE]; ///< Settings items only.
+    u64 size;                         ///< Size of the cached value.
+    u64 buf_size;                     ///< Size of the buffer the value was read into.
+    void* data;
+} SetCacheEntry;
+
+static RwLock g_setCacheLock;
+static SetCacheEntry* g_setCacheEntries;
+static u32 g_setCacheCount;
+static u32 g_setCacheCapacity;
+static u32 g_setCacheGeneration;
+
+static SetCacheEntry* _setCacheFind(Service* srv, u32 cmd_id, const char *name, const char *item_key) {
+    for (u32 i=0; i<g_setCacheCount; i++) {
+        SetCacheEntry *entry = &g_setCacheEntries[i];
+        if (entry->srv != srv || entry->cmd_id != cmd_id) continue;
+        if (name && (strncmp(entry->name, name, SET_MAX_NAME_SIZE-1) || strncmp(entry->item_key, item_key, SET_MAX_NAME_SIZE-1))) continue;
+        return entry;
+    }
+    return NULL;
+}
+
+// Returns true when the value was served from the cache. Otherwise *generation receives the value to pass to _setCacheStore.
+static bool _setCacheLookup(Service* srv, u32 cmd_id, const char *name, const char *item_key, void* out, size_t size, u64 *size_out, u32 *generation) {
+    bool found = false;
+    *generation = 0;
+
+    if (!__nx_set_cache) return false;
+
+    rwlockReadLock(&g_setCacheLock);
+    *generation = g_setCacheGeneration;
+
+    SetCacheEntry *entry = _setCacheFind(srv, cmd_id, name, item_key);
+    // A value read into a smaller buffer may have been truncated, unless it didn't fill it.
+    if (entry && (size <= entry->buf_size || entry->size < entry->buf_size)) {
+        u64 copy_size = size < entry->size ? size : entry->size;
+        memcpy(out, entry->data, copy_size);
+        if (size_out) *size_out = copy_size;
+        found = true;
+    }
+
+    rwlockReadUnlock(&g_setCacheLock);
+    return found;
+}
+
+static void _setCacheStore(Service* srv, u32 cmd_id, const char *name, const char *item_key, const void* data, u64 size, u64 buf_size, u32 generation) {
+    if (!__nx_set_cache) return;
+
+    rwlockWriteLock(&g_setCacheLock);
+
+    // Drop values read concurrently with a setter, they may be stale.
+    if (generation != g_setCacheGeneration) {
+        rwlockWriteUnlock(&g_setCacheLock);
+        return;
+    }
+
+    SetCacheEntry *entry = _setCacheFind(srv, cmd_id, name, item_key);
+    if (!entry && g_setCacheCount == g_setCacheCapacity) {
+        u32 capacity = g_setCacheCapacity ? 2*g_setCacheCapacity : 16;
+        SetCacheEntry *entries = (SetCacheEntry*)__libnx_alloc(capacity * sizeof(SetCacheEntry));
+        if (entries) {
+            if (g_setCacheEntries) memcpy(entries, g_setCacheEntries, g_setCacheCount * sizeof(SetCacheEntry));
+            __libnx_free(g_setCacheEntries);
+            g_setCacheEntries = entries;
+            g_setCacheCapacity = capacity;
+        }
+    }
+
+    if (!entry && g_setCacheCount < g_setCacheCapacity) {
+        entry = &g_setCacheEntries[g_setCacheCount];
+        memset(entry, 0, sizeof(*entry));
+        entry->srv = srv;
+        entry->cmd_id = cmd_id;
+        if (name) {
+            strncpy(entry->name, name, SET_MAX_NAME_SIZE-1);
+            strncpy(entry->item_key, item_key, SET_MAX_NAME_SIZE-1);
+        }
+        g_setCacheCount++;
+    }
+
+    if (entry) {
+        void* tmp = __libnx_alloc(size ? size : 1);
+        if (tmp) {
+            memcpy(tmp, data, size);
+            __libnx_free(entry->data);
+            entry->data = tmp;
+            entry->size = size;
+            entry->buf_size = buf_size;
+        } else {
+            // Leave the entry unusable rather than stale.
+            entry->buf_size = entry->size = 0;
+            entry->srv = NULL;
+        }
+    }
+
+    rwlockWriteUnlock(&g_setCacheLock);
+}
+
+void setCacheInvalidate(void) {
+    rwlockWriteLock(&g_setCacheLock);
+
+    g_setCacheGeneration++;
+    for (u32 i=0; i<g_setCacheCount; i++)
+        __libnx_free(g_setCacheEntries[i].data);
+    __libnx_free(g_setCacheEntries);
+    g_setCacheEntries = NULL;
+    g_setCacheCount = 0;
+    g_setCacheCapacity = 0;
+
+    rwlockWriteUnlock(&g_setCacheLock);
+}
+
+static Result _setCacheInvalidateAfter(Result rc) {
+    if (__nx_set_cache) setCacheInvalidate();
+    return rc;
+}
+
+static Result _setCmdNoInOut64Cached(Service* srv, u64 *out, u32 cmd_id) {
+    u32 generation;
+    if (_setCacheLookup(srv, cmd_id, NULL, NULL, out, sizeof(*out), NULL, &generation)) return 0;
+
+    Result rc = _setCmdNoInOut64(srv, out, cmd_id);
+    if (R_SUCCEEDED(rc)) _setCacheStore(srv, cmd_id, NULL, NULL, out, sizeof(*out), sizeof(*out), generation);
+    return rc;
+}
+
+static Result _setCmdNoInOutU32Cached(Service* srv, u32 *out, u32 cmd_id) {
+    u32 generation;
+    if (_setCacheLookup(srv, cmd_id, NULL, NULL, out, sizeof(*out), NULL, &generation)) return 0;
+
+    Result rc = _setCmdNoInOutU32(srv, out, cmd_id);
+    if (R_SUCCEEDED(rc)) _setCacheStore(srv, cmd_id, NULL, NULL, out, sizeof(*out), sizeof(*out), generation);
+    return rc;
+}
+
+static Result _setCmdNoInOutBoolCached(Service* srv, bool *out, u32 cmd_id) {
+    u32 generation;
+    u8 tmp=0;
+    if (!_setCacheLookup(srv, cmd_id, NULL, NULL, &tmp, sizeof(tmp), NULL, &generation)) {
+        Result rc = _setCmdNoInOutU8(srv, &tmp, cmd_id);
+        if (R_FAILED(rc)) return rc;
+        _setCacheStore(srv, cmd_id, NULL, NULL, &tmp, sizeof(tmp), sizeof(tmp), generation);
+    }
+    if (out) *out = tmp & 1;
+    return 0;
+}
+
+static Result _setCmdOutBufAliasFixedCached(Service* srv, void* buffer, size_t size, u32 cmd_id) {
+    u32 generation;
+    if (_setCacheLookup(srv, cmd_id, NULL, NULL, buffer, size, NULL, &generation)) return 0;
+
+    Result rc = _setCmdOutBufAliasFixed(srv, buffer, size, cmd_id);
+    if (R_SUCCEEDED(rc)) _setCacheStore(srv, cmd_id, NULL, NULL, buffer, size, size, generation);
+    return rc;
+}
+
 static Result setInitializeLanguageCodesCache(void) {
     if (g_setLanguageCodesInitialized) return 0;
     Result rc = 0;
@@ -181,7 +350,7 @@ Result setGetSystemLanguage(u64 *LanguageCode) {
 }
 
 Result setGetLanguageCode(u64 *LanguageCode) {
-    return _setCmdNoInOut64(&g_setSrv, LanguageCode, 0);
+    return _setCmdNoInOut64Cached(&g_setSrv, LanguageCode, 0);
 }
 
 Result setGetAvailableLanguageCodes(s32 *total_entries, u64 *LanguageCodes, size_t max_entries) {
@@ -215,7 +384,7 @@ Result setGetAvailableLanguageCodeCount(s32 *total) {
 
 Result setGetRegionCode(SetRegion *out) {
     s32 code=0;
-    Result rc = _setCmdNoInOutU32(&g_setSrv, (u32*)&code, 4);
+    Result rc = _setCmdNoInOutU32Cached(&g_setSrv, (u32*)&code, 4);
     if (R_SUCCEEDED(rc) && out) *out = code;
     return rc;
 }
@@ -224,14 +393,14 @@ Result setGetQuestFlag(bool *out) {
     if (hosversionBefore(5,0,0))
         return MAKERESULT(Module_Libnx, LibnxError_IncompatSysVer);
 
-    return _setCmdNoInOutBool(&g_setSrv, out, 8);
+    return _setCmdNoInOutBoolCached(&g_setSrv, out, 8);
 }
 
 Result setGetDeviceNickname(SetSysDeviceNickName *nickname) {
     if (hosversionBefore(10,1,0))
         return MAKERESULT(Module_Libnx, LibnxError_IncompatSysVer);
 
-    return _setCmdOutBufAliasFixed(&g_setSrv, nickname, sizeof(*nickname), 11);
+    return _setCmdOutBufAliasFixedCached(&g_setSrv, nickname, sizeof(*nickname), 11);
 }
 
 Result setsysSetLanguageCode(u64 LanguageCode) {
@@ -253,10 +422,15 @@ Result setsysGetNetworkSettings(s32 *total_out, SetSysNetworkSettings *settings,
 }
 
 static Result _setsysGetFirmwareVersionImpl(SetSysFirmwareVersion *out, u32 cmd_id) {
-    return serviceDispatch(&g_setsysSrv, cmd_id,
+    u32 generation;
+    if (_setCacheLookup(&g_setsysSrv, cmd_id, NULL, NULL, out, sizeof(*out), NULL, &generation)) return 0;
+
+    Result rc = serviceDispatch(&g_setsysSrv, cmd_id,
         .buffer_attrs = { SfBufferAttr_FixedSize | SfBufferAttr_HipcPointer | SfBufferAttr_Out },
         .buffers = { { out, sizeof(*out) } },
     );
+    if (R_SUCCEEDED(rc)) _setCacheStore(&g_setsysSrv, cmd_id, NULL, NULL, out, sizeof(*out), sizeof(*out), generation);
+    return rc;
 }
 
 Result setsysGetFirmwareVersion(SetSysFirmwareVersion *out) {
@@ -273,7 +447,7 @@ Result setsysGetFirmwareVersionDigest(SetSysFirmwareVersionDigest *out) {
 }
 
 Result setsysGetLockScreenFlag(bool *out) {
-    return _setCmdNoInOutBool(&g_setsysSrv, out, 7);
+    return _setCmdNoInOutBoolCached(&g_setsysSrv, out, 7);
 }
 
 Result setsysSetLockScreenFlag(bool flag) {
@@ -355,7 +529,7 @@ Result setsysSetEulaVersions(const SetSysEulaVersion *versions, s32 count) {
 
 Result setsysGetColorSetId(ColorSetId *out) {
     u32 color_set=0;
-    Result rc = _setCmdNoInOutU32(&g_setsysSrv, &color_set, 23);
+    Result rc = _setCmdNoInOutU32Cached(&g_setsysSrv, &color_set, 23);
     if (R_SUCCEEDED(rc) && out) *out = color_set;
     return rc;
 }
@@ -419,7 +593,10 @@ Result setsysGetSettingsItemValueSize(const char *name, const char *item_key, u6
     strncpy(send_name, name, SET_MAX_NAME_SIZE-1);
     strncpy(send_item_key, item_key, SET_MAX_NAME_SIZE-1);
 
-    return serviceDispatchOut(&g_setsysSrv, 37, *size_out,
+    u32 generation;
+    if (_setCacheLookup(&g_setsysSrv, 37, send_name, send_item_key, size_out, sizeof(*size_out), NULL, &generation)) return 0;
+
+    Result rc = serviceDispatchOut(&g_setsysSrv, 37, *size_out,
         .buffer_attrs = {
             SfBufferAttr_HipcPointer | SfBufferAttr_In,
             SfBufferAttr_HipcPointer | SfBufferAttr_In,
@@ -429,6 +606,8 @@ Result setsysGetSettingsItemValueSize(const char *name, const char *item_key, u6
             { send_item_key, SET_MAX_NAME_SIZE },
         },
     );
+    if (R_SUCCEEDED(rc)) _setCacheStore(&g_setsysSrv, 37, send_name, send_item_key, size_out, sizeof(*size_out), sizeof(*size_out), generation);
+    return rc;
 }
 
 Result setsysGetSettingsItemValue(const char *name, const char *item_key, void *value_out, size_t value_out_size, u64 *size_out) {
@@ -440,7 +619,10 @@ Result setsysGetSettingsItemValue(const char *name, const char *item_key, void *
     strncpy(send_name, name, SET_MAX_NAME_SIZE-1);
     strncpy(send_item_key, item_key, SET_MAX_NAME_SIZE-1);
 
-    return serviceDispatchOut(&g_setsysSrv, 38, *size_out,
+    u32 generation;
+    if (_setCacheLookup(&g_setsysSrv, 38, send_name, send_item_key, value_out, value_out_size, size_out, &generation)) return 0;
+
+    Result rc = serviceDispatchOut(&g_setsysSrv, 38, *size_out,
         .buffer_attrs = {
             SfBufferAttr_HipcPointer | SfBufferAttr_In,
             SfBufferAttr_HipcPointer | SfBufferAttr_In,
@@ -452,6 +634,8 @@ Result setsysGetSettingsItemValue(const char *name, const char *item_key, void *
             { value_out, value_out_size },
         },
     );
+    if (R_SUCCEEDED(rc)) _setCacheStore(&g_setsysSrv, 38, send_name, send_item_key, value_out, *size_out < value_out_size ? *size_out : value_out_size, value_out_size, generation);
+    return rc;
 }
 
 Result setsysGetTvSettings(SetSysTvSettings *out) {
@@ -501,7 +685,7 @@ Result setsysSetSpeakerAutoMuteFlag(bool flag) {
 }
 
 Result setsysGetQuestFlag(bool *out) {
-    return _setCmdNoInOutBool(&g_setsysSrv, out, 47);
+    return _setCmdNoInOutBoolCached(&g_setsysSrv, out, 47);
 }
 
 Result setsysSetQuestFlag(bool flag) {
@@ -569,7 +753,7 @@ Result setsysGetDebugModeFlag(bool *out) {
 
 Result setsysGetPrimaryAlbumStorage(SetSysPrimaryAlbumStorage *out) {
     u32 tmp=0;
-    Result rc = _setCmdNoInOutU32(&g_setsysSrv, &tmp, 63);
+    Result rc = _setCmdNoInOutU32Cached(&g_setsysSrv, &tmp, 63);
     if (R_SUCCEEDED(rc) && out) *out = tmp;
     return rc;
 }
@@ -591,7 +775,12 @@ Result setsysGetBatteryLot(SetBatteryLot *out) {
 }
 
 Result setsysGetSerialNumber(SetSysSerialNumber *out) {
-    return serviceDispatchOut(&g_setsysSrv, 68, *out);
+    u32 generation;
+    if (_setCacheLookup(&g_setsysSrv, 68, NULL, NULL, out, sizeof(*out), NULL, &generation)) return 0;
+
+    Result rc = serviceDispatchOut(&g_setsysSrv, 68, *out);
+    if (R_SUCCEEDED(rc)) _setCacheStore(&g_setsysSrv, 68, NULL, NULL, out, sizeof(*out), sizeof(*out), generation);
+    return rc;
 }
 
 Result setsysGetNfcEnableFlag(bool *out) {
@@ -627,19 +816,19 @@ Result setsysSetInitialLaunchSettings(const SetSysInitialLaunchSettings *setting
 }
 
 Result setsysGetDeviceNickname(SetSysDeviceNickName *nickname) {
-    return _setCmdOutBufAliasFixed(&g_setsysSrv, nickname, sizeof(*nickname), 77);
+    return _setCmdOutBufAliasFixedCached(&g_setsysSrv, nickname, sizeof(*nickname), 77);
 }
 
 Result setsysSetDeviceNickname(const SetSysDeviceNickName *nickname) {
-    return serviceDispatch(&g_setsysSrv, 78,
+    return _setCacheInvalidateAfter(serviceDispatch(&g_setsysSrv, 78,
         .buffer_attrs = { SfBufferAttr_HipcMapAlias | SfBufferAttr_In },
         .buffers = { { nickname, sizeof(*nickname) } },
-    );
+    ));
 }
 
 Result setsysGetProductModel(SetSysProductModel *model) {
     u32 product_model = 0;
-    Result rc = _setCmdNoInOutU32(&g_setsysSrv, &product_model, 79);
+    Result rc = _setCmdNoInOutU32Cached(&g_setsysSrv, &product_model, 79);
     if (R_SUCCEEDED(rc) && model) *model = product_model;
     return rc;
 }
@@ -1034,7 +1223,7 @@ Result setsysGetKeyboardLayout(SetKeyboardLayout *out) {
         return MAKERESULT(Module_Libnx, LibnxError_IncompatSysVer);
 
     u32 tmp=0;
-    Result rc = _setCmdNoInOutU32(&g_setsysSrv, &tmp, 136);
+    Result rc = _setCmdNoInOutU32Cached(&g_setsysSrv, &tmp, 136);
     if (R_SUCCEEDED(rc) && out) *out = tmp;
     return rc;
 }
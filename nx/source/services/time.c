@@ -319,3 +319,227 @@ Result timeToPosixTimeWithMyRule(const TimeCalendarTime *caltime, u64 *timestamp
         .buffers = { { timestamp_list, sizeof(u64)*timestamp_list_count } },
     );
 }
+
+// In-process time zone rule evaluation. TimeZoneRule is the tz "struct state" as used by the time service.
+
+#define TIME_TZ_MAX_TIMES        1000
+#define TIME_TZ_MAX_TYPES        128
+#define TIME_TZ_MAX_CHARS        512
+#define TIME_SECS_PER_DAY        86400
+#define TIME_SECS_PER_REPEAT     12622780800LL // 400 Gregorian years.
+
+typedef struct {
+    s32 gmt_offset;
+    u8 is_dst;
+    u8 pad[3];
+    s32 abbreviation_list_index;
+    u8 is_standard_time_daylight;
+    u8 is_gmt;
+    u8 pad2[2];
+} TimeZoneTypeInfo;
+
+typedef struct {
+    s32 time_count;
+    s32 type_count;
+    s32 char_count;
+    bool go_back;
+    bool go_ahead;
+    u8 pad[2];
+    s64 ats[TIME_TZ_MAX_TIMES];
+    s8 types[TIME_TZ_MAX_TIMES];
+    TimeZoneTypeInfo ttis[TIME_TZ_MAX_TYPES];
+    char chars[TIME_TZ_MAX_CHARS];
+    s32 default_type;
+    u8 pad2[0x12C4];
+} TimeZoneRuleData;
+
+_Static_assert(sizeof(TimeZoneRuleData) == sizeof(TimeZoneRule), "TimeZoneRuleData has the wrong size");
+
+// Last transition found by each thread; consecutive conversions are usually close together.
+static __thread const TimeZoneRuleData* g_timeTzCacheRule;
+static __thread s32 g_timeTzCacheIdx;
+
+static bool _timeZoneRuleIsValid(const TimeZoneRuleData* rule) {
+    if (rule->time_count < 0 || rule->time_count > TIME_TZ_MAX_TIMES)
+        return false;
+    if (rule->type_count <= 0 || rule->type_count > TIME_TZ_MAX_TYPES)
+        return false;
+    if (rule->default_type < 0 || rule->default_type >= rule->type_count)
+        return false;
+    return true;
+}
+
+static Result _timeZoneFindType(const TimeZoneRuleData* rule, s64 time, const TimeZoneTypeInfo** tti_out) {
+    s32 count = rule->time_count;
+
+    // Times past either end of the transition table repeat every 400 years, which is an exact
+    // number of days, so only the table lookup needs to be wrapped (not the calendar conversion).
+    if (count > 0 && ((rule->go_back && time < rule->ats[0]) || (rule->go_ahead && time > rule->ats[count-1]))) {
+        s64 seconds = time < rule->ats[0] ? rule->ats[0] - time : time - rule->ats[count-1];
+        s64 repeats = (seconds - 1) / TIME_SECS_PER_REPEAT + 1;
+        time += time < rule->ats[0] ? repeats*TIME_SECS_PER_REPEAT : -repeats*TIME_SECS_PER_REPEAT;
+
+        if (time < rule->ats[0] || time > rule->ats[count-1])
+            return MAKERESULT(116,200);
+    }
+
+    s32 type;
+    if (count == 0 || time < rule->ats[0])
+        type = rule->default_type;
+    else {
+        s32 low = 1, high = count;
+
+        // Try the cached transition first.
+        s32 idx = g_timeTzCacheIdx;
+        if (g_timeTzCacheRule == rule && idx >= 1 && idx <= count && time >= rule->ats[idx-1] && (idx == count || time < rule->ats[idx]))
+            low = idx;
+        else {
+            while (low < high) {
+                s32 mid = (low + high) >> 1;
+                if (time < rule->ats[mid])
+                    high = mid;
+                else
+                    low = mid + 1;
+            }
+
+            g_timeTzCacheRule = rule;
+            g_timeTzCacheIdx = low;
+        }
+
+        type = rule->types[low-1];
+    }
+
+    if (type < 0 || type >= rule->type_count)
+        return MAKERESULT(116,903);
+
+    *tti_out = &rule->ttis[type];
+    return 0;
+}
+
+static s64 _timeFloorDiv(s64 a, s64 b) {
+    s64 q = a / b;
+    if ((a % b) != 0 && ((a < 0) != (b < 0)))
+        q--;
+    return q;
+}
+
+static s64 _timeDaysFromCivil(s64 year, u32 month, u32 day) {
+    year -= month <= 2;
+    s64 era = _timeFloorDiv(year, 400);
+    u32 yoe = year - era*400;
+    u32 doy = (153*(month > 2 ? month-3 : month+9) + 2)/5 + day-1;
+    u32 doe = yoe*365 + yoe/4 - yoe/100 + doy;
+    return era*146097 + doe - 719468;
+}
+
+static void _timeCivilFromDays(s64 days, s64* year, u32* month, u32* day) {
+    days += 719468;
+    s64 era = _timeFloorDiv(days, 146097);
+    u32 doe = days - era*146097;
+    u32 yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365;
+    u32 doy = doe - (365*yoe + yoe/4 - yoe/100);
+    u32 mp = (5*doy + 2)/153;
+    *day = doy - (153*mp + 2)/5 + 1;
+    *month = mp < 10 ? mp+3 : mp-9;
+    *year = yoe + era*400 + (*month <= 2);
+}
+
+static Result _timeZoneToCalendarTime(const TimeZoneRuleData* rule, s64 time, TimeCalendarTime *caltime, TimeCalendarAdditionalInfo *info) {
+    const TimeZoneTypeInfo* tti;
+    Result rc = _timeZoneFindType(rule, time, &tti);
+    if (R_FAILED(rc))
+        return rc;
+
+    s64 local = time + tti->gmt_offset;
+    s64 days = _timeFloorDiv(local, TIME_SECS_PER_DAY);
+    s64 secs = local - days*TIME_SECS_PER_DAY;
+
+    s64 year;
+    u32 month, day;
+    _timeCivilFromDays(days, &year, &month, &day);
+    if (year < 0 || year > UINT16_MAX)
+        return MAKERESULT(116,201);
+
+    if (caltime) {
+        caltime->year = year;
+        caltime->month = month;
+        caltime->day = day;
+        caltime->hour = secs / 3600;
+        caltime->minute = (secs / 60) % 60;
+        caltime->second = secs % 60;
+        caltime->pad = 0;
+    }
+
+    if (info) {
+        memset(info, 0, sizeof(*info));
+        info->wday = days + 4 - _timeFloorDiv(days + 4, 7)*7; // 1970-01-01 was a Thursday.
+        info->yday = days - _timeDaysFromCivil(year, 1, 1);
+        info->DST = tti->is_dst;
+        info->offset = tti->gmt_offset;
+
+        s32 abbr = tti->abbreviation_list_index;
+        if (abbr >= 0 && abbr < TIME_TZ_MAX_CHARS)
+            strncpy(info->timezoneName, &rule->chars[abbr], sizeof(info->timezoneName));
+    }
+
+    return 0;
+}
+
+Result timeToCalendarTimeOffline(const TimeZoneRule *rule, u64 timestamp, TimeCalendarTime *caltime, TimeCalendarAdditionalInfo *info) {
+    const TimeZoneRuleData* data = (const TimeZoneRuleData*)rule;
+    if (!_timeZoneRuleIsValid(data))
+        return MAKERESULT(116,903);
+
+    return _timeZoneToCalendarTime(data, (s64)timestamp, caltime, info);
+}
+
+Result timeToPosixTimeOffline(const TimeZoneRule *rule, const TimeCalendarTime *caltime, u64 *timestamp_list, s32 timestamp_list_count, s32 *timestamp_count) {
+    const TimeZoneRuleData* data = (const TimeZoneRuleData*)rule;
+    if (!_timeZoneRuleIsValid(data))
+        return MAKERESULT(116,903);
+
+    // Normalize the month, then let day/hour/minute/second overflow naturally into the linear count.
+    s64 month = (s64)caltime->month - 1;
+    s64 year = (s64)caltime->year + _timeFloorDiv(month, 12);
+    month -= _timeFloorDiv(month, 12)*12;
+
+    s64 local = (_timeDaysFromCivil(year, month+1, 1) + caltime->day - 1)*TIME_SECS_PER_DAY
+        + caltime->hour*3600 + caltime->minute*60 + caltime->second;
+
+    // A POSIX time t maps to this local time iff t + offset(t) == local, so every
+    // candidate is local minus one of the rule's offsets.
+    s64 found[2];
+    s32 num_found = 0;
+
+    for (s32 i = 0; i < data->type_count && num_found < 2; i ++) {
+        s32 offset = data->ttis[i].gmt_offset;
+        bool dup = false;
+        for (s32 j = 0; j < i; j ++)
+            dup |= data->ttis[j].gmt_offset == offset;
+        if (dup)
+            continue;
+
+        const TimeZoneTypeInfo* tti;
+        s64 time = local - offset;
+        if (R_FAILED(_timeZoneFindType(data, time, &tti)) || tti->gmt_offset != offset)
+            continue;
+
+        if (num_found == 1 && found[0] > time) {
+            found[1] = found[0];
+            found[0] = time;
+        } else
+            found[num_found] = time;
+        num_found++;
+    }
+
+    if (!num_found)
+        return MAKERESULT(116,200);
+
+    s32 count = num_found < timestamp_list_count ? num_found : timestamp_list_count;
+    for (s32 i = 0; i < count; i ++)
+        timestamp_list[i] = found[i];
+    if (timestamp_count)
+        *timestamp_count = count;
+
+    return 0;
+}